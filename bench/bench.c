@@ -0,0 +1,845 @@
+// bench.c - Throughput benchmarks for json.h.
+// Copyright (c) 2025 Kacper Fiedorowicz. All rights reserved.
+// This software is licensed under the MIT License.
+// See LICENSE for more information.
+//
+// Build from the repository root, adding the configuration macros to compare
+// (e.g. -DJSON_INDEX or -DJSON_OBJECT_INITIAL_CAPACITY=8):
+//
+//     cc -O2 -std=c99 -D_POSIX_C_SOURCE=200809L -o bench/bench bench/bench.c -lm
+//
+// Usage: bench/bench [-w warmup] [-r repetitions] [-s scale] [-c corpus] [-o results.json] [-p 1]
+//
+// Every corpus is generated in memory from a fixed seed, so runs are
+// comparable across machines and over time without shipping data files.
+// Each operation runs `warmup` untimed and `repetitions` timed rounds; the
+// table shows the median and tail of the per-round times, and `-o` writes
+// the same results, together with the configuration, as JSON.
+//
+// On Linux, `-p 1` also reads hardware counters through perf_event_open
+// around every timed round and reports them per input byte and per node
+// (per lookup for lookups). Counters the kernel or CPU does not provide,
+// e.g. under a restrictive perf_event_paranoid or in a VM, are left out.
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+# define _GNU_SOURCE // syscall()
+#endif
+
+#include "../json.h"
+
+#include <math.h>
+#include <stdarg.h>
+#include <time.h>
+
+#if defined(__linux__)
+# include <linux/perf_event.h>
+# include <sys/ioctl.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+#endif
+
+struct buffer
+{
+    char *data;
+    size_t length;
+    size_t capacity;
+};
+
+static void put(struct buffer *buffer, const char *format, ...)
+{
+    va_list args;
+    int length;
+
+    for (;;) {
+        size_t room = buffer->capacity - buffer->length;
+
+        va_start(args, format);
+        length = vsnprintf(buffer->data + buffer->length, room, format, args);
+        va_end(args);
+
+        if (length >= 0 && (size_t) length < room)
+            break;
+
+        buffer->capacity = buffer->capacity ? buffer->capacity * 2 : 4096;
+        if ((buffer->data = (char *) realloc(buffer->data, buffer->capacity)) == NULL) {
+            fprintf(stderr, "bench: out of memory\n");
+            exit(1);
+        }
+    }
+
+    buffer->length += (size_t) length;
+}
+
+// xorshift64*, the corpora must not depend on the C library's rand()
+static unsigned long long rng_state;
+
+static unsigned long long rng(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static int rng_below(int limit)
+{
+    return (int) (rng() % (unsigned long long) limit);
+}
+
+static double rng_unit(void)
+{
+    return (double) (rng() >> 11) / 9007199254740992.0;
+}
+
+static const char *const words[] = {
+    "json",   "parser", "stream", "token", "value",  "object", "array", "number", "string", "fast",
+    "cache",  "thread", "buffer", "latency", "queue", "server", "client", "event", "status", "update",
+    "random", "sample", "metric", "vector", "header", "search", "result", "config", "commit", "branch",
+};
+
+#define WORD() (words[rng_below((int) (sizeof(words) / sizeof(words[0])))])
+
+static void put_sentence(struct buffer *b, int count)
+{
+    for (int i = 0; i < count; i++)
+        put(b, i ? " %s" : "%s", WORD());
+}
+
+// Timeline of status objects with nested users and entities
+static void generate_twitter(struct buffer *b, int scale)
+{
+    int statuses = 400 * scale;
+
+    put(b, "{\"statuses\":[");
+    for (int i = 0; i < statuses; i++) {
+        put(b, "%s{\"id\":%llu,\"id_str\":\"%llu\",\"created_at\":\"Sun Aug 31 00:%02d:%02d +0000 2014\",", i ? "," : "",
+            (unsigned long long) 505874924095815681ULL + i, (unsigned long long) 505874924095815681ULL + i,
+            rng_below(60), rng_below(60));
+        put(b, "\"text\":\"@%s ", WORD());
+        put_sentence(b, 8 + rng_below(12));
+        put(b, " #%s\",\"truncated\":false,\"in_reply_to_status_id\":null,", WORD());
+        put(b, "\"user\":{\"id\":%d,\"name\":\"%s %s\",\"screen_name\":\"%s_%d\",\"location\":\"\",", rng_below(1 << 30),
+            WORD(), WORD(), WORD(), rng_below(1000));
+        put(b, "\"description\":\"");
+        put_sentence(b, 5 + rng_below(10));
+        put(b, "\",\"url\":null,\"protected\":false,\"followers_count\":%d,\"friends_count\":%d,", rng_below(100000),
+            rng_below(5000));
+        put(b, "\"verified\":%s,\"profile_background_color\":\"C0DEED\",\"lang\":\"en\"},",
+            rng_below(10) ? "false" : "true");
+        put(b, "\"retweet_count\":%d,\"favorite_count\":%d,\"entities\":{\"hashtags\":[", rng_below(500), rng_below(500));
+        for (int h = 0, n = rng_below(3); h < n; h++)
+            put(b, "%s{\"text\":\"%s\",\"indices\":[%d,%d]}", h ? "," : "", WORD(), h * 10, h * 10 + 7);
+        put(b, "],\"symbols\":[],\"urls\":[],\"user_mentions\":[{\"screen_name\":\"%s\",\"id\":%d,\"indices\":[0,%d]}]},",
+            WORD(), rng_below(1 << 30), 3 + rng_below(12));
+        put(b, "\"favorited\":false,\"retweeted\":false,\"lang\":\"%s\"}", rng_below(4) ? "en" : "ja");
+    }
+    put(b, "],\"search_metadata\":{\"completed_in\":0.087,\"max_id\":505874924095815681,\"count\":%d}}", statuses);
+}
+
+// GeoJSON polygons, almost entirely floating-point coordinate pairs
+static void generate_canada(struct buffer *b, int scale)
+{
+    double lon = -65.613616999999977, lat = 43.420273000000009;
+
+    put(b, "{\"type\":\"FeatureCollection\",\"features\":[{\"type\":\"Feature\",\"properties\":{\"name\":\"Canada\"},");
+    put(b, "\"geometry\":{\"type\":\"Polygon\",\"coordinates\":[");
+    for (int ring = 0; ring < 48 * scale; ring++) {
+        put(b, "%s[", ring ? "," : "");
+        for (int i = 0; i < 512; i++) {
+            lon += (rng_unit() - 0.5) * 0.01;
+            lat += (rng_unit() - 0.5) * 0.01;
+            put(b, "%s[%.15f,%.15f]", i ? "," : "", lon, lat);
+        }
+        put(b, "]");
+    }
+    put(b, "]}}]}");
+}
+
+// Catalog with id-keyed maps and many small integer records
+static void generate_citm(struct buffer *b, int scale)
+{
+    int events = 180 * scale, performances = 240 * scale;
+
+    put(b, "{\"areaNames\":{");
+    for (int i = 0; i < 17; i++)
+        put(b, "%s\"2052%05d\":\"%s %s\"", i ? "," : "", 2000 + i, WORD(), WORD());
+    put(b, "},\"audienceSubCategoryNames\":{\"337100890\":\"Abonn\\u00e9\"},\"blockNames\":{},\"events\":{");
+    for (int i = 0; i < events; i++) {
+        put(b, "%s\"%d\":{\"description\":null,\"id\":%d,\"logo\":%s,\"name\":\"%s %s\",\"subTopicIds\":[", i ? "," : "",
+            138586341 + i, 138586341 + i, rng_below(3) ? "null" : "\"/images/UE0AAAAACEKo6QAAAAZDSVRN\"", WORD(),
+            WORD());
+        for (int t = 0, n = 1 + rng_below(4); t < n; t++)
+            put(b, "%s%d", t ? "," : "", 337184262 + rng_below(100));
+        put(b, "],\"subjectCode\":null,\"subtitle\":null,\"topicIds\":[%d,%d]}", 324846099 + rng_below(10),
+            107888604 + rng_below(10));
+    }
+    put(b, "},\"performances\":[");
+    for (int i = 0; i < performances; i++) {
+        put(b, "%s{\"eventId\":%d,\"id\":%d,\"logo\":null,\"name\":null,\"prices\":[", i ? "," : "",
+            138586341 + rng_below(events), 339887544 + i);
+        for (int p = 0, n = 2 + rng_below(4); p < n; p++)
+            put(b, "%s{\"amount\":%d,\"audienceSubCategoryId\":337100890,\"seatCategoryId\":%d}", p ? "," : "",
+                9000 + 1000 * rng_below(80), 338937295 + p);
+        put(b, "],\"seatCategories\":[");
+        for (int s = 0, n = 1 + rng_below(3); s < n; s++)
+            put(b, "%s{\"areas\":[{\"areaId\":205705999,\"blockIds\":[]},{\"areaId\":205705998,\"blockIds\":[]}],"
+                   "\"seatCategoryId\":%d}",
+                s ? "," : "", 338937295 + s);
+        put(b, "],\"seatMapImage\":null,\"start\":%lld,\"venueCode\":\"PLEYEL_PLEYEL\"}",
+            1372701600000LL + 86400000LL * rng_below(365));
+    }
+    put(b, "],\"venueNames\":{\"PLEYEL_PLEYEL\":\"Salle Pleyel\"}}");
+}
+
+// Integers, decimals and exponents in flat arrays
+static void generate_numbers(struct buffer *b, int scale)
+{
+    put(b, "[");
+    for (int i = 0; i < 60000 * scale; i++) {
+        const char *sep = i ? "," : "";
+
+        switch (rng_below(4)) {
+        case 0:
+            put(b, "%s%d", sep, rng_below(1 << 30) - (1 << 29));
+            break;
+        case 1:
+            put(b, "%s%.6f", sep, (rng_unit() - 0.5) * 1000.0);
+            break;
+        case 2:
+            put(b, "%s%.17g", sep, rng_unit());
+            break;
+        default:
+            put(b, "%s%.3e", sep, (rng_unit() - 0.5) * pow(10.0, rng_below(60) - 30));
+            break;
+        }
+    }
+    put(b, "]");
+}
+
+// Long strings full of escapes and non-ASCII code points
+static void generate_strings(struct buffer *b, int scale)
+{
+    static const char *const escapes[] = {"\\n", "\\t", "\\\"", "\\\\", "\\/", "\\u00e9", "\\u20ac", "\\ud83d\\ude00"};
+
+    put(b, "[");
+    for (int i = 0; i < 6000 * scale; i++) {
+        put(b, "%s\"", i ? "," : "");
+        for (int w = 0, n = 4 + rng_below(16); w < n; w++)
+            put(b, "%s%s", WORD(), escapes[rng_below(8)]);
+        put(b, "\"");
+    }
+    put(b, "]");
+}
+
+// Many small subtrees that alternate arrays and objects down to a fixed depth
+static void generate_nested(struct buffer *b, int scale)
+{
+    put(b, "[");
+    for (int i = 0; i < 400 * scale; i++) {
+        int depth = 64 + rng_below(64);
+
+        put(b, i ? "," : "");
+        for (int d = 0; d < depth; d++) {
+            if (d % 2)
+                put(b, "{\"%s\":", WORD());
+            else
+                put(b, "[%d,", rng_below(100));
+        }
+        put(b, "null");
+        for (int d = depth - 1; d >= 0; d--)
+            put(b, d % 2 ? "}" : "]");
+    }
+    put(b, "]");
+}
+
+// A single object with a very large number of members
+static void generate_wide(struct buffer *b, int scale)
+{
+    put(b, "{");
+    for (int i = 0; i < 5000 * scale; i++)
+        put(b, "%s\"%s_%d\":%d", i ? "," : "", WORD(), i, rng_below(1000));
+    put(b, "}");
+}
+
+struct corpus
+{
+    const char *name;
+    void (*generate)(struct buffer *b, int scale);
+};
+
+static const struct corpus corpora[] = {
+    {"twitter", generate_twitter}, {"canada", generate_canada}, {"citm", generate_citm},
+    {"numbers", generate_numbers}, {"strings", generate_strings}, {"nested", generate_nested},
+    {"wide", generate_wide},
+};
+
+struct lookup
+{
+    struct json_value *object;
+    const char *key;
+    int length;
+};
+
+#define MAX_LOOKUPS 65536
+
+// Gathers up to MAX_LOOKUPS existing members to look up again
+static int collect_lookups(struct json_value *value, struct lookup *lookups, int count)
+{
+    if (value->type == JSON_TYPE_OBJECT) {
+        for (int i = 0; i < value->object.n_items && count < MAX_LOOKUPS; i++) {
+            lookups[count].object = value;
+            lookups[count].key = value->object.items[i]->key;
+            lookups[count].length = value->object.items[i]->key_length;
+            count = collect_lookups(value->object.items[i]->value, lookups, count + 1);
+        }
+    } else if (value->type == JSON_TYPE_ARRAY) {
+        for (int i = 0; i < value->array.length && count < MAX_LOOKUPS; i++)
+            count = collect_lookups(value->array.items[i], lookups, count);
+    }
+
+    return count;
+}
+
+// Values, counting every element of packed number arrays
+static long count_nodes(const struct json_value *value)
+{
+    long count = 1;
+
+    if (value->type == JSON_TYPE_OBJECT) {
+        for (int i = 0; i < value->object.n_items; i++)
+            count += count_nodes(value->object.items[i]->value);
+    } else if (value->type == JSON_TYPE_ARRAY) {
+        for (int i = 0; i < value->array.length; i++)
+            count += count_nodes(value->array.items[i]);
+    } else if (value->type == JSON_TYPE_NUMBER_ARRAY) {
+        count += value->array.length;
+    }
+
+    return count;
+}
+
+enum counter
+{
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_BRANCH_MISSES,
+    COUNTER_L1D_MISSES,
+    COUNTER_LLC_MISSES,
+    COUNTER_DTLB_MISSES,
+    COUNTER_COUNT
+};
+
+static const char *const counter_names[COUNTER_COUNT] = {
+    "cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses", "dtlb_misses",
+};
+
+// Hardware counters summed over the timed rounds of one operation
+static struct
+{
+    int fds[COUNTER_COUNT];  // -1 where the counter is unavailable
+    int enabled;             // Any counter opened
+    int recording;           // Timed round, as opposed to warmup
+    double totals[COUNTER_COUNT];
+} counters;
+
+#if defined(__linux__)
+static int open_counter(unsigned int type, unsigned long long config)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // Counters are multiplexed when there are more than the PMU has, scale them back
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+# define CACHE_MISS(CACHE, OP) ((CACHE) | ((OP) << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+#endif
+
+static void counters_open(void)
+{
+    for (int i = 0; i < COUNTER_COUNT; i++)
+        counters.fds[i] = -1;
+
+#if defined(__linux__)
+    counters.fds[COUNTER_CYCLES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    counters.fds[COUNTER_INSTRUCTIONS] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    counters.fds[COUNTER_BRANCH_MISSES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    counters.fds[COUNTER_L1D_MISSES] =
+        open_counter(PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ));
+    counters.fds[COUNTER_LLC_MISSES] =
+        open_counter(PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ));
+    counters.fds[COUNTER_DTLB_MISSES] =
+        open_counter(PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ));
+#endif
+
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        if (counters.fds[i] >= 0)
+            counters.enabled = 1;
+        else
+            fprintf(stderr, "bench: counter %s unavailable\n", counter_names[i]);
+    }
+}
+
+static void counters_close(void)
+{
+#if defined(__linux__)
+    if (!counters.enabled)
+        return;
+
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        if (counters.fds[i] >= 0)
+            close(counters.fds[i]);
+    }
+#endif
+}
+
+static void counters_start(void)
+{
+#if defined(__linux__)
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        if (counters.fds[i] >= 0) {
+            ioctl(counters.fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(counters.fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+static void counters_stop(void)
+{
+#if defined(__linux__)
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        unsigned long long values[3]; // Count, time enabled, time running
+
+        if (counters.fds[i] < 0)
+            continue;
+
+        ioctl(counters.fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counters.fds[i], values, sizeof(values)) == (ssize_t) sizeof(values) && values[2] > 0)
+            counters.totals[i] += (double) values[0] * ((double) values[1] / (double) values[2]);
+    }
+#endif
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+}
+
+// Starts the measured part of a round
+static double phase_begin(void)
+{
+    if (counters.enabled && counters.recording)
+        counters_start();
+    return now_ns();
+}
+
+// Ends the measured part of a round, keeping the clock read out of the counts
+static double phase_end(void)
+{
+    double end = now_ns();
+
+    if (counters.enabled && counters.recording)
+        counters_stop();
+    return end;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted samples
+static double percentile(const double *sorted, int count, double p)
+{
+    int rank = (int) ceil(p / 100.0 * count);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+enum operation
+{
+    OP_DECODE,
+    OP_ENCODE,
+    OP_VALIDATE,
+    OP_LOOKUP,
+    OP_FREE,
+    OP_COUNT
+};
+
+static const char *const operation_names[OP_COUNT] = {"decode", "encode", "validate", "lookup", "free"};
+
+struct options
+{
+    int warmup;
+    int repetitions;
+    int scale;
+    const char *only;
+    const char *output;
+    int counters;
+};
+
+// Runs one round of an operation and returns its time, `tree` is decoded beforehand
+static double run_round(enum operation op, const struct buffer *input, struct json_value *tree,
+                        const struct lookup *lookups, int lookup_count)
+{
+    struct json_value *value;
+    double start, end;
+    char *text;
+    int found = 0;
+
+    switch (op) {
+    case OP_DECODE:
+        start = phase_begin();
+        value = json_decode_with_length(input->data, (int) input->length);
+        end = phase_end();
+        json_free(value);
+        return end - start;
+    case OP_ENCODE:
+        start = phase_begin();
+        text = json_encode(tree);
+        end = phase_end();
+        free(text);
+        return end - start;
+    case OP_VALIDATE:
+        // The library has no separate validator: accept or reject, keep nothing
+        start = phase_begin();
+        value = json_decode_with_length(input->data, (int) input->length);
+        if (value != NULL)
+            json_free(value);
+        end = phase_end();
+        return end - start;
+    case OP_LOOKUP:
+        start = phase_begin();
+        for (int i = 0; i < lookup_count; i++)
+            found += json_object_get_n(lookups[i].object, lookups[i].key, (size_t) lookups[i].length) != NULL;
+        end = phase_end();
+        if (found != lookup_count) {
+            fprintf(stderr, "bench: lookup missed a key\n");
+            exit(1);
+        }
+        return end - start;
+    case OP_FREE:
+        value = json_decode_with_length(input->data, (int) input->length);
+        start = phase_begin();
+        json_free(value);
+        end = phase_end();
+        return end - start;
+    default:
+        return 0;
+    }
+}
+
+// Prints the counters of the last operation and returns them for the JSON report
+static struct json_value *report_counters(enum operation op, int repetitions, double bytes, double nodes,
+                                          int lookup_count)
+{
+    struct json_value *report = json_object_new();
+
+    printf("%17s", "");
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        struct json_value *counter;
+        double total = counters.totals[i] / repetitions;
+
+        if (counters.fds[i] < 0)
+            continue;
+
+        counter = json_object_new();
+        json_object_set(counter, "total", json_number_new(total));
+        if (op == OP_LOOKUP) {
+            json_object_set(counter, "per_lookup", json_number_new(total / lookup_count));
+            printf(" %s/lookup %.2f", counter_names[i], total / lookup_count);
+        } else {
+            json_object_set(counter, "per_byte", json_number_new(total / bytes));
+            json_object_set(counter, "per_node", json_number_new(total / nodes));
+            printf(" %s/byte %.3f", counter_names[i], total / bytes);
+        }
+        json_object_set(report, counter_names[i], counter);
+    }
+
+    if (counters.fds[COUNTER_CYCLES] >= 0 && counters.fds[COUNTER_INSTRUCTIONS] >= 0 &&
+        counters.totals[COUNTER_CYCLES] > 0) {
+        double ipc = counters.totals[COUNTER_INSTRUCTIONS] / counters.totals[COUNTER_CYCLES];
+
+        json_object_set(report, "ipc", json_number_new(ipc));
+        printf(" ipc %.2f", ipc);
+    }
+    printf("\n");
+
+    return report;
+}
+
+#if defined(JSON_STATS)
+static const char *const stats_site_names[JSON_STATS_SITES] = {"node", "string", "key", "items", "encoder", "other"};
+
+// Prints what the library did per round of the last operation and returns it for the JSON report
+static struct json_value *report_stats(const struct json_stats *before, const struct json_stats *after,
+                                       int repetitions)
+{
+    struct json_value *report = json_object_new(), *sites = json_object_new();
+    double allocs = 0, growth, comparisons;
+
+    for (int i = 0; i < JSON_STATS_SITES; i++) {
+        struct json_value *site = json_object_new();
+        double count = (double) (after->sites[i].allocs - before->sites[i].allocs) / repetitions;
+
+        allocs += count;
+        json_object_set(site, "allocs", json_number_new(count));
+        json_object_set(site, "alloc_bytes",
+                        json_number_new((double) (after->sites[i].alloc_bytes - before->sites[i].alloc_bytes)
+                                        / repetitions));
+        json_object_set(site, "reallocs",
+                        json_number_new((double) (after->sites[i].reallocs - before->sites[i].reallocs) / repetitions));
+        json_object_set(site, "frees",
+                        json_number_new((double) (after->sites[i].frees - before->sites[i].frees) / repetitions));
+        json_object_set(sites, stats_site_names[i], site);
+    }
+
+    growth = (double) (after->growth_reallocs - before->growth_reallocs) / repetitions;
+    comparisons = (double) (after->key_comparisons - before->key_comparisons) / repetitions;
+    json_object_set(report, "sites", sites);
+    json_object_set(report, "growth_reallocs", json_number_new(growth));
+    json_object_set(report, "key_comparisons", json_number_new(comparisons));
+    printf("%17s allocs/round %.1f growth reallocs/round %.1f key comparisons/round %.1f\n", "", allocs, growth,
+           comparisons);
+
+    return report;
+}
+#endif
+
+static void benchmark_corpus(const struct corpus *corpus, const struct options *options, struct json_value *results)
+{
+    struct buffer input = {NULL, 0, 0};
+    struct json_value *tree;
+    struct lookup *lookups;
+    int lookup_count;
+    long nodes;
+    double *samples;
+
+    rng_state = 0x9e3779b97f4a7c15ULL;
+    corpus->generate(&input, options->scale);
+
+    if ((tree = json_decode_with_length(input.data, (int) input.length)) == NULL) {
+        fprintf(stderr, "bench: corpus %s does not decode\n", corpus->name);
+        exit(1);
+    }
+
+    lookups = (struct lookup *) malloc(sizeof(struct lookup) * MAX_LOOKUPS);
+    samples = (double *) malloc(sizeof(double) * options->repetitions);
+    if (lookups == NULL || samples == NULL) {
+        fprintf(stderr, "bench: out of memory\n");
+        exit(1);
+    }
+    lookup_count = collect_lookups(tree, lookups, 0);
+    nodes = count_nodes(tree);
+
+    for (int op = 0; op < OP_COUNT; op++) {
+        struct json_value *result;
+        double p50, items_per_s;
+#if defined(JSON_STATS)
+        struct json_stats before, after;
+#endif
+
+        if (op == OP_LOOKUP && lookup_count == 0)
+            continue;
+
+        for (int i = 0; i < options->warmup; i++)
+            run_round((enum operation) op, &input, tree, lookups, lookup_count);
+        memset(counters.totals, 0, sizeof(counters.totals));
+#if defined(JSON_STATS)
+        json_stats_snapshot(&before);
+#endif
+        counters.recording = 1;
+        for (int i = 0; i < options->repetitions; i++)
+            samples[i] = run_round((enum operation) op, &input, tree, lookups, lookup_count);
+        counters.recording = 0;
+#if defined(JSON_STATS)
+        json_stats_snapshot(&after);
+#endif
+        qsort(samples, (size_t) options->repetitions, sizeof(double), compare_doubles);
+
+        p50 = percentile(samples, options->repetitions, 50);
+        // Throughput uses the median, which a single descheduled round cannot skew
+        items_per_s = (op == OP_LOOKUP ? lookup_count : 1) * 1e9 / p50;
+
+        printf("%-8s %-8s %9.1f MB/s %12.1f %-9s p50 %10.1f us  p90 %10.1f us  p99 %10.1f us\n", corpus->name,
+               operation_names[op], op == OP_LOOKUP ? 0.0 : input.length / p50 * 1e9 / 1e6, items_per_s,
+               op == OP_LOOKUP ? "lookups/s" : "docs/s", p50 / 1e3, percentile(samples, options->repetitions, 90) / 1e3,
+               percentile(samples, options->repetitions, 99) / 1e3);
+
+        result = json_object_new();
+        json_object_set(result, "corpus", json_string_new(corpus->name));
+        json_object_set(result, "operation", json_string_new(operation_names[op]));
+        json_object_set(result, "bytes", json_number_new((double) input.length));
+        json_object_set(result, "items", json_number_new(op == OP_LOOKUP ? lookup_count : 1));
+        json_object_set(result, "min_ns", json_number_new(samples[0]));
+        json_object_set(result, "p50_ns", json_number_new(p50));
+        json_object_set(result, "p90_ns", json_number_new(percentile(samples, options->repetitions, 90)));
+        json_object_set(result, "p99_ns", json_number_new(percentile(samples, options->repetitions, 99)));
+        json_object_set(result, "max_ns", json_number_new(samples[options->repetitions - 1]));
+        if (op != OP_LOOKUP)
+            json_object_set(result, "mb_per_s", json_number_new(input.length / p50 * 1e9 / 1e6));
+        json_object_set(result, "items_per_s", json_number_new(items_per_s));
+        if (counters.enabled)
+            json_object_set(result, "counters", report_counters((enum operation) op, options->repetitions,
+                                                                (double) input.length, (double) nodes, lookup_count));
+#if defined(JSON_STATS)
+        json_object_set(result, "stats", report_stats(&before, &after, options->repetitions));
+#endif
+        json_array_push(results, result);
+    }
+
+    free(samples);
+    free(lookups);
+    json_free(tree);
+    free(input.data);
+}
+
+// The configuration the library was built with, to tell result files apart
+static struct json_value *configuration(const struct options *options)
+{
+    struct json_value *config = json_object_new();
+    struct json_value *flags = json_array_new();
+    struct json_value *events = json_array_new();
+
+    json_object_set(config, "warmup", json_number_new(options->warmup));
+    json_object_set(config, "repetitions", json_number_new(options->repetitions));
+    json_object_set(config, "scale", json_number_new(options->scale));
+    json_object_set(config, "JSON_ARRAY_INITIAL_CAPACITY", json_number_new(JSON_ARRAY_INITIAL_CAPACITY));
+    json_object_set(config, "JSON_ARRAY_CAPACITY_MULTIPLIER", json_number_new(JSON_ARRAY_CAPACITY_MULTIPLIER));
+    json_object_set(config, "JSON_ARRAY_CAPACITY_THRESHOLD", json_number_new(JSON_ARRAY_CAPACITY_THRESHOLD));
+    json_object_set(config, "JSON_OBJECT_INITIAL_CAPACITY", json_number_new(JSON_OBJECT_INITIAL_CAPACITY));
+    json_object_set(config, "JSON_OBJECT_CAPACITY_MULTIPLIER", json_number_new(JSON_OBJECT_CAPACITY_MULTIPLIER));
+    json_object_set(config, "JSON_OBJECT_CAPACITY_THRESHOLD", json_number_new(JSON_OBJECT_CAPACITY_THRESHOLD));
+
+#if defined(JSON_INDEX)
+    json_array_push(flags, json_string_new("JSON_INDEX"));
+#endif
+#if defined(JSON_HASH_CACHE)
+    json_array_push(flags, json_string_new("JSON_HASH_CACHE"));
+#endif
+#if defined(JSON_REFCOUNT)
+    json_array_push(flags, json_string_new("JSON_REFCOUNT"));
+#endif
+#if defined(JSON_NUMBER_ARRAYS)
+    json_array_push(flags, json_string_new("JSON_NUMBER_ARRAYS"));
+#endif
+#if defined(JSON_ERROR)
+    json_array_push(flags, json_string_new("JSON_ERROR"));
+#endif
+#if defined(JSON_STATS)
+    json_array_push(flags, json_string_new("JSON_STATS"));
+#endif
+    json_object_set(config, "flags", flags);
+
+    for (int i = 0; i < COUNTER_COUNT && counters.enabled; i++) {
+        if (counters.fds[i] >= 0)
+            json_array_push(events, json_string_new(counter_names[i]));
+    }
+    json_object_set(config, "counters", events);
+
+#if defined(__VERSION__)
+    json_object_set(config, "compiler", json_string_new(__VERSION__));
+#endif
+    return config;
+}
+
+static int parse_int(const char *text, const char *flag)
+{
+    char *end;
+    long value = strtol(text, &end, 10);
+
+    if (*text == '\0' || *end != '\0' || value < 1 || value > 1000000) {
+        fprintf(stderr, "bench: invalid value for %s: %s\n", flag, text);
+        exit(2);
+    }
+    return (int) value;
+}
+
+int main(int argc, char **argv)
+{
+    struct options options = {3, 20, 1, NULL, NULL, 0};
+    struct json_value *report, *results;
+    int ran = 0;
+
+    for (int i = 1; i < argc; i++) {
+        const char *flag = argv[i];
+
+        if (i + 1 >= argc) {
+            fprintf(stderr, "usage: %s [-w warmup] [-r repetitions] [-s scale] [-c corpus] [-o results.json] [-p 1]\n",
+                    argv[0]);
+            return 2;
+        }
+
+        if (strcmp(flag, "-w") == 0 && strcmp(argv[i + 1], "0") == 0)
+            options.warmup = 0;
+        else if (strcmp(flag, "-w") == 0)
+            options.warmup = parse_int(argv[i + 1], flag);
+        else if (strcmp(flag, "-r") == 0)
+            options.repetitions = parse_int(argv[i + 1], flag);
+        else if (strcmp(flag, "-s") == 0)
+            options.scale = parse_int(argv[i + 1], flag);
+        else if (strcmp(flag, "-c") == 0)
+            options.only = argv[i + 1];
+        else if (strcmp(flag, "-o") == 0)
+            options.output = argv[i + 1];
+        else if (strcmp(flag, "-p") == 0)
+            options.counters = strcmp(argv[i + 1], "0") != 0;
+        else {
+            fprintf(stderr, "bench: unknown option %s\n", flag);
+            return 2;
+        }
+        i++;
+    }
+
+    if (options.counters) {
+        counters_open();
+        if (!counters.enabled)
+            fprintf(stderr, "bench: no hardware counters, reporting times only\n");
+    }
+
+    report = json_object_new();
+    results = json_array_new();
+    json_object_set(report, "config", configuration(&options));
+
+    for (size_t i = 0; i < sizeof(corpora) / sizeof(corpora[0]); i++) {
+        if (options.only != NULL && strcmp(options.only, corpora[i].name) != 0)
+            continue;
+        benchmark_corpus(&corpora[i], &options, results);
+        ran++;
+    }
+    json_object_set(report, "results", results);
+
+    if (ran == 0) {
+        fprintf(stderr, "bench: unknown corpus %s\n", options.only);
+        json_free(report);
+        return 2;
+    }
+
+    if (options.output != NULL) {
+        FILE *file = fopen(options.output, "w");
+        char *text = json_encode(report);
+
+        if (file == NULL || text == NULL || fputs(text, file) == EOF || fputc('\n', file) == EOF) {
+            fprintf(stderr, "bench: cannot write %s\n", options.output);
+            return 1;
+        }
+        fclose(file);
+        free(text);
+    }
+
+    counters_close();
+    json_free(report);
+    return 0;
+}
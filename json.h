@@ -10,6 +10,20 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(JSON_SNAPSHOT)
+# include <errno.h>
+# include <fcntl.h>
+# include <stdint.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+#if defined(JSON_THREADS)
+# include <pthread.h>
+# include <unistd.h>
+#endif
+
 #if defined(JSON_STATIC)
 /**
  * Defines the linkage of JSON API functions.
@@ -69,6 +83,49 @@
 # define json__free(ptr) free(ptr)
 #endif
 
+#if defined(__GNUC__) || defined(__clang__)
+# define JSON__ATOMIC_INC(PTR) __atomic_add_fetch((PTR), 1, __ATOMIC_RELAXED)
+# define JSON__ATOMIC_DEC(PTR) __atomic_sub_fetch((PTR), 1, __ATOMIC_ACQ_REL)
+# define JSON__ATOMIC_LOAD(PTR) __atomic_load_n((PTR), __ATOMIC_ACQUIRE)
+# define JSON__ATOMIC_LOAD_SC(PTR) __atomic_load_n((PTR), __ATOMIC_SEQ_CST)
+# define JSON__ATOMIC_STORE_SC(PTR, VALUE) __atomic_store_n((PTR), (VALUE), __ATOMIC_SEQ_CST)
+# define JSON__ATOMIC_LOAD_PTR(PTR) __atomic_load_n((PTR), __ATOMIC_ACQUIRE)
+# define JSON__ATOMIC_CAS_PTR(PTR, OLD, NEW) __sync_bool_compare_and_swap((PTR), (OLD), (NEW))
+# define JSON__ATOMIC_LOAD_HASH(PTR) __atomic_load_n((PTR), __ATOMIC_RELAXED)
+# define JSON__ATOMIC_STORE_HASH(PTR, VALUE) __atomic_store_n((PTR), (VALUE), __ATOMIC_RELAXED)
+# define JSON__ATOMIC_LOAD_64(PTR) __atomic_load_n((PTR), __ATOMIC_ACQUIRE)
+# define JSON__ATOMIC_CAS_64(PTR, OLD, NEW) __sync_bool_compare_and_swap((PTR), (OLD), (NEW))
+#elif defined(_MSC_VER)
+# include <intrin.h>
+# define JSON__ATOMIC_INC(PTR) _InterlockedIncrement((volatile long *) (PTR))
+# define JSON__ATOMIC_DEC(PTR) _InterlockedDecrement((volatile long *) (PTR))
+# define JSON__ATOMIC_LOAD(PTR) (*(volatile const int *) (PTR))
+# define JSON__ATOMIC_LOAD_SC(PTR) (*(volatile const int *) (PTR))
+# define JSON__ATOMIC_STORE_SC(PTR, VALUE) _InterlockedExchange((volatile long *) (PTR), (long) (VALUE))
+# define JSON__ATOMIC_LOAD_PTR(PTR) (*(void *volatile const *) (PTR))
+# define JSON__ATOMIC_CAS_PTR(PTR, OLD, NEW)                                                                          \
+     (_InterlockedCompareExchangePointer((void *volatile *) (PTR), (NEW), (OLD)) == (OLD))
+# define JSON__ATOMIC_LOAD_HASH(PTR) (*(volatile const unsigned long long *) (PTR))
+# define JSON__ATOMIC_STORE_HASH(PTR, VALUE) (*(volatile unsigned long long *) (PTR) = (VALUE))
+# define JSON__ATOMIC_LOAD_64(PTR) ((unsigned long long) _InterlockedOr64((volatile long long *) (PTR), 0))
+# define JSON__ATOMIC_CAS_64(PTR, OLD, NEW)                                                                            \
+     (_InterlockedCompareExchange64((volatile long long *) (PTR), (long long) (NEW), (long long) (OLD)) ==            \
+      (long long) (OLD))
+#else
+/* No atomics available, values must not be shared across threads */
+# define JSON__ATOMIC_INC(PTR) (++*(PTR))
+# define JSON__ATOMIC_DEC(PTR) (--*(PTR))
+# define JSON__ATOMIC_LOAD(PTR) (*(PTR))
+# define JSON__ATOMIC_LOAD_SC(PTR) (*(PTR))
+# define JSON__ATOMIC_STORE_SC(PTR, VALUE) (*(PTR) = (VALUE))
+# define JSON__ATOMIC_LOAD_PTR(PTR) (*(PTR))
+# define JSON__ATOMIC_CAS_PTR(PTR, OLD, NEW) (*(PTR) == (OLD) ? (*(PTR) = (NEW), 1) : 0)
+# define JSON__ATOMIC_LOAD_HASH(PTR) (*(PTR))
+# define JSON__ATOMIC_STORE_HASH(PTR, VALUE) (*(PTR) = (VALUE))
+# define JSON__ATOMIC_LOAD_64(PTR) (*(PTR))
+# define JSON__ATOMIC_CAS_64(PTR, OLD, NEW) (*(PTR) == (OLD) ? (*(PTR) = (NEW), 1) : 0)
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -138,6 +195,137 @@ extern "C" {
 # define JSON_OBJECT_CAPACITY_THRESHOLD 1
 #endif
 
+#ifndef JSON_HASH_SEED
+/**
+ * @brief Seed used by `json_hash`.
+ *
+ * Override it with a per-deployment value to make hashes unpredictable
+ * to whoever supplies the documents.
+ */
+# define JSON_HASH_SEED 0x2545f4914f6cdd1dULL
+#endif
+
+#ifndef JSON_INDEX_THRESHOLD
+/**
+ * Minimum number of members for an object to get a lookup index.
+ *
+ * When `JSON_INDEX` is defined, lookups in objects with at least this many
+ * members build a hash index on first use instead of scanning the keys.
+ */
+# define JSON_INDEX_THRESHOLD 8
+#endif
+
+#ifndef JSON_BATCH_GRAIN
+/**
+ * Default number of documents a `json_decode_batch` worker claims at once.
+ *
+ * Larger values mean fewer atomic operations per document, smaller ones
+ * balance uneven batches better.
+ */
+# define JSON_BATCH_GRAIN 16
+#endif
+
+#ifndef JSON_CACHE_SHARDS
+/**
+ * Number of independently locked shards of a `json_cache`, a power of two.
+ */
+# define JSON_CACHE_SHARDS 16
+#endif
+
+#if defined(JSON_HASH_CACHE) || defined(JSON_INDEX)
+/**
+ * @brief Invalidates the cached data of a JSON container.
+ *
+ * When `JSON_HASH_CACHE` is defined, arrays and objects remember their
+ * structural hash until they are modified through the library API; with
+ * `JSON_INDEX`, objects also drop their lookup index.
+ *
+ * @param VALUE The JSON array or object being modified.
+ */
+# define JSON__CACHE_INVALIDATE(VALUE) json__cache_invalidate(VALUE)
+#else
+# define JSON__CACHE_INVALIDATE(VALUE) ((void) 0)
+#endif
+
+#if defined(JSON_REFCOUNT)
+/**
+ * @brief Whether a JSON value has more than one owner.
+ *
+ * Shared values, such as the nodes of a copy-on-write clone, are never
+ * modified in place: the mutators refuse them, and `json_make_mut` hands
+ * out a private copy to modify instead.
+ *
+ * @param VALUE The JSON value about to be modified.
+ */
+# define JSON__SHARED(VALUE) (JSON__ATOMIC_LOAD(&(VALUE)->refcount) > 1)
+#else
+# define JSON__SHARED(VALUE) 0
+#endif
+
+// Size of one element of a regular or packed array
+#define JSON__ARRAY_ITEM_SIZE(ARRAY)                                                                                   \
+    ((ARRAY)->type == JSON_TYPE_NUMBER_ARRAY ? sizeof(double) : sizeof(struct json_value *))
+
+/**
+ * @brief Enum representing the type of a JSON value.
+ *
+ * - `JSON_TYPE_NULL`: Represents a null value.
+ * - `JSON_TYPE_BOOLEAN`: Represents a boolean value (true/false).
+ * - `JSON_TYPE_NUMBER`: Represents a numeric value.
+ * - `JSON_TYPE_STRING`: Represents a string value.
+ * - `JSON_TYPE_ARRAY`: Represents an array of JSON values.
+ * - `JSON_TYPE_OBJECT`: Represents an object with key-value pairs.
+ * - `JSON_TYPE_NUMBER_ARRAY`: Represents an array of numbers stored
+ *   contiguously as `double`s.
+ */
+enum json_type
+{
+    JSON_TYPE_NULL,        /**< Null value. */
+    JSON_TYPE_BOOLEAN,     /**< Boolean value (true/false). */
+    JSON_TYPE_NUMBER,      /**< Numeric value. */
+    JSON_TYPE_STRING,      /**< String value. */
+    JSON_TYPE_ARRAY,       /**< Array of JSON values. */
+    JSON_TYPE_OBJECT,      /**< Object with key-value pairs. */
+    JSON_TYPE_NUMBER_ARRAY /**< Packed array of numbers. */
+};
+
+/**
+ * @brief Enum representing the type of error encountered while decoding.
+ *
+ * - `JSON_ERROR_NONE`: No error occurred.
+ * - `JSON_ERROR_SYNTAX`: A syntax error was encountered.
+ * - `JSON_ERROR_MEMORY`: A memory allocation error occurred.
+ * - `JSON_ERROR_EOF`: Unexpected end of input was encountered.
+ * - `JSON_ERROR_INVALID_NUMBER`: Failed to parse a number.
+ * - `JSON_ERROR_UNKNOWN`: Decoding failed, but `JSON_ERROR` is not defined
+ *   so the cause was not recorded.
+ */
+enum json_error
+{
+    JSON_ERROR_NONE,           /**< No error occurred. */
+    JSON_ERROR_SYNTAX,         /**< A syntax error was encountered. */
+    JSON_ERROR_MEMORY,         /**< A memory allocation error occurred. */
+    JSON_ERROR_EOF,            /**< Unexpected end of input was encountered. */
+    JSON_ERROR_INVALID_NUMBER, /**< Failed to parse number */
+    JSON_ERROR_UNKNOWN,        /**< Failed without recording why. */
+};
+
+// Lookup index of an object, see `JSON_INDEX`
+struct json__object_index;
+
+/**
+ * @brief A key-value pair stored in a JSON object.
+ */
+struct json_object_entry
+{
+    char *key;                /**< Pointer to a null-terminated string representing
+                                 the key. */
+    int key_length;           /**< Length of the key in bytes, excluding the null
+                                 terminator. */
+    struct json_value *value; /**< Pointer to a `json_value` representing
+                                 the associated value. */
+};
+
 /**
  * @brief Represents a JSON value.
  *
@@ -149,26 +337,32 @@ extern "C" {
 struct json_value
 {
     /**
-     * @brief Enum representing the type of the JSON value.
+     * @brief The type of the JSON value, determines which member of the
+     * union is valid.
+     */
+    enum json_type type;
+
+#if defined(JSON_REFCOUNT)
+    /**
+     * @brief Number of owners of the value.
      *
-     * The type determines which member of the union is valid.
+     * Starts at 1 and is updated atomically by `json_retain` and
+     * `json_release`. The value is torn down when it drops to zero.
+     */
+    int refcount;
+#endif
+
+#if defined(JSON_HASH_CACHE) || defined(JSON_INDEX)
+    /**
+     * @brief Set on arrays and objects by `json_freeze`, and on those of
+     * `json::static_value`.
      *
-     * - `JSON_TYPE_NULL`: Represents a null value.
-     * - `JSON_TYPE_BOOLEAN`: Represents a boolean value (true/false).
-     * - `JSON_TYPE_NUMBER`: Represents a numeric value.
-     * - `JSON_TYPE_STRING`: Represents a string value.
-     * - `JSON_TYPE_ARRAY`: Represents an array of JSON values.
-     * - `JSON_TYPE_OBJECT`: Represents an object with key-value pairs.
+     * The hashes and indexes cached in a frozen subtree are complete and
+     * current, so comparisons may trust them, and reads no longer fill
+     * them in lazily.
      */
-    enum
-    {
-        JSON_TYPE_NULL,    /**< Null value. */
-        JSON_TYPE_BOOLEAN, /**< Boolean value (true/false). */
-        JSON_TYPE_NUMBER,  /**< Numeric value. */
-        JSON_TYPE_STRING,  /**< String value. */
-        JSON_TYPE_ARRAY,   /**< Array of JSON values. */
-        JSON_TYPE_OBJECT   /**< Object with key-value pairs. */
-    } type;
+    unsigned char frozen;
+#endif
 
     /**
      * @brief Union holding the actual data of the JSON value.
@@ -190,13 +384,22 @@ struct json_value
          * - `length`: The current number of elements in the array.
          * - `items`: A pointer to an array of pointers to `json_value`
          * elements.
+         * - `numbers`: The elements themselves when `type` is
+         * `JSON_TYPE_NUMBER_ARRAY`.
          */
         struct
         {
-            int capacity;              /**< Total allocated capacity of the array. */
-            int length;                /**< Current number of elements in the array. */
-            struct json_value **items; /**< Pointer to an array of pointers to
-                                          `json_value` elements. */
+            int capacity; /**< Total allocated capacity of the array. */
+            int length;   /**< Current number of elements in the array. */
+            union
+            {
+                struct json_value **items; /**< Pointer to an array of pointers to
+                                              `json_value` elements. */
+                double *numbers;           /**< Packed elements of a number array. */
+            };
+#if defined(JSON_HASH_CACHE)
+            unsigned long long hash; /**< Cached structural hash, 0 if unknown. */
+#endif
         } array;
 
         /**
@@ -225,6 +428,7 @@ struct json_value
          * structures. Each key-value pair consists of:
          *     - `key`: A pointer to a null-terminated string representing the
          * key.
+         *     - `key_length`: The length of the key in bytes.
          *     - `value`: A pointer to a `json_value` representing the
          * associated value.
          */
@@ -233,14 +437,14 @@ struct json_value
             int capacity; /**< Total allocated capacity for key-value pairs. */
             int n_items;  /**< Current number of key-value pairs in the object.
                            */
-            struct
-            {
-                char *key;                /**< Pointer to a null-terminated string representing
-                                             the key. */
-                struct json_value *value; /**< Pointer to a `json_value` representing
-                                             the associated value. */
-            } **items;                    /**< Pointer to an array of pointers to key-value pair
-                                             structures. */
+            struct json_object_entry **items; /**< Pointer to an array of pointers to key-value
+                                                 pair structures. */
+#if defined(JSON_HASH_CACHE)
+            unsigned long long hash; /**< Cached structural hash, 0 if unknown. */
+#endif
+#if defined(JSON_INDEX)
+            struct json__object_index *index; /**< Lookup index, NULL until first needed. */
+#endif
         } object;
     };
 };
@@ -255,7 +459,7 @@ struct json_value
  * @param VALUE The JSON value to check.
  * @return Non-zero if the value is an array, 0 otherwise.
  */
-#define json_is_array(VALUE) ((VALUE) && (VALUE)->type == JSON_TYPE_ARRAY)
+#define json_is_array(VALUE) ((VALUE) && ((VALUE)->type == JSON_TYPE_ARRAY || (VALUE)->type == JSON_TYPE_NUMBER_ARRAY))
 
 /**
  * @brief Checks if a JSON value is a boolean.
@@ -372,28 +576,61 @@ struct json_value
  *
  * This function retrieves an element from a JSON array at the specified index.
  *
+ * @warning On a packed number array this is a mutating call: the array is
+ * first converted into a regular one, with a node per element. It must not
+ * be used on packed arrays shared between threads; read those with
+ * `json_number_array_get` instead.
+ *
  * @param array The JSON array to retrieve from.
  * @param index The index of the element to retrieve.
  * @return A pointer to the element at the specified index, or NULL if out of
- * bounds.
+ * bounds or if a packed array could not be converted.
  */
 JSON_API struct json_value *json_array_get(struct json_value *array, int index);
 
+static int json__array_unpack(struct json_value *array);
+#if defined(JSON_HASH_CACHE) || defined(JSON_INDEX)
+static void json__cache_invalidate(struct json_value *value);
+#endif
+
 inline struct json_value *json_array_get(struct json_value *array, int index)
 {
+    if (json__array_unpack(array) != 0)
+        return NULL;
+
     return index < array->array.length ? array->array.items[index] : NULL;
 }
 
 /**
  * @brief Sets an element in a JSON array.
  *
- * This macro sets an element in a JSON array at the specified index.
+ * This function stores `value` at the specified index. The element it
+ * replaces is left to the caller, who may still hold or move it; use
+ * `json_array_replace` to free it instead. A packed number array is
+ * converted into a regular one first, and the node made for the slot is
+ * freed, as nothing else can refer to it.
  *
  * @param array The JSON array to modify.
  * @param index The index of the element to set.
  * @param value The new value to set.
+ * @return 0 on success, or -1 if `index` is out of bounds or a packed array
+ *         could not be converted.
+ */
+JSON_API int json_array_set(struct json_value *array, int index, struct json_value *value);
+
+/**
+ * @brief Replaces an element in a JSON array and frees the previous one.
+ *
+ * Same as `json_array_set`, but the replaced element is released with
+ * `json_free`, like `json_object_set` does for members.
+ *
+ * @param array The JSON array to modify.
+ * @param index The index of the element to replace.
+ * @param value The new value, owned by the array afterwards.
+ * @return 0 on success, or -1 if `index` is out of bounds or a packed array
+ *         could not be converted.
  */
-#define json_array_set(ARRAY, INDEX, VALUE) ((ARRAY)->array.items[(INDEX)] = (VALUE))
+JSON_API int json_array_replace(struct json_value *array, int index, struct json_value *value);
 
 /**
  * @brief Retrieves the number of key-value pairs in a JSON object.
@@ -450,6 +687,168 @@ JSON_API struct json_value *json_decode(const char *json);
  */
 JSON_API struct json_value *json_decode_with_length(const char *json, int length);
 
+/**
+ * @brief Creates a reusable decoding context.
+ *
+ * A context keeps the parser's scratch space (the container stack, the
+ * string buffer and, with `JSON_NUMBER_ARRAYS`, the number stack) between
+ * calls to `json_ctx_decode`. Once it has grown to fit the documents being
+ * decoded, the only allocations left are those of the resulting tree.
+ * A context must not be used by two threads at once; keep one per thread.
+ *
+ * @return A new context, or NULL on failure.
+ */
+JSON_API struct json_parser_ctx *json_parser_ctx_new(void);
+
+/**
+ * @brief Frees a decoding context and its scratch space.
+ *
+ * @param ctx The context to free, may be NULL.
+ */
+JSON_API void json_parser_ctx_free(struct json_parser_ctx *ctx);
+
+/**
+ * @brief Decodes a JSON string of known length, reusing a context's scratch space.
+ *
+ * Same as `json_decode_with_length` otherwise.
+ *
+ * @param ctx The context to decode with.
+ * @param json The JSON string to decode.
+ * @param length The length of the JSON string in bytes.
+ * @return A pointer to the decoded JSON value, or NULL if decoding fails.
+ */
+JSON_API struct json_value *json_ctx_decode(struct json_parser_ctx *ctx, const char *json, int length);
+
+/**
+ * @brief Runs `count` invocations of `task(arg)` and waits for all of them.
+ *
+ * Plugs `json_decode_batch` into an existing thread pool: submit `count`
+ * jobs calling `task(arg)` and return once every one has finished. The
+ * invocations share the batch among themselves, so running them one after
+ * another is correct, only slower.
+ */
+typedef void (*json_executor_fn)(void *executor, void (*task)(void *), void *arg, int count);
+
+/**
+ * @brief Options for `json_decode_batch`, zero-initialize for the defaults.
+ */
+struct json_batch_options
+{
+    int threads;               /**< Number of workers, 0 picks one per CPU. */
+    int grain;                 /**< Documents claimed at a time, 0 uses `JSON_BATCH_GRAIN`. */
+    json_executor_fn executor; /**< Runs the workers, NULL uses the built-in threads. */
+    void *executor_data;       /**< First argument of `executor`. */
+    enum json_error *errors;   /**< Optional, receives the outcome of every document. */
+};
+
+/**
+ * @brief Decodes many independent documents in parallel.
+ *
+ * Every worker starts with an equal share of the batch, decodes it in
+ * chunks of `grain` documents with its own `json_parser_ctx`, and once
+ * done steals half of the remaining work of another worker. Results are
+ * stored in input order: `out[i]` is the tree decoded from `bufs[i]`, or
+ * NULL if that document failed, in which case `opts->errors[i]` tells why.
+ *
+ * Without `JSON_THREADS` and without an executor the batch is decoded on
+ * the calling thread, and `threads` defaults to 1.
+ *
+ * @param bufs The documents to decode.
+ * @param lens Lengths of the documents in bytes, or NULL if they are null-terminated.
+ * @param n Number of documents.
+ * @param out Receives the decoded trees, one per document.
+ * @param opts The options, or NULL for the defaults.
+ * @return The number of documents that failed, or -1 if the batch could not be started.
+ */
+JSON_API int json_decode_batch(const char *const *bufs, const int *lens, int n, struct json_value **out,
+                               const struct json_batch_options *opts);
+
+#if defined(JSON_THREADS)
+/**
+ * @brief A fixed set of threads `json_decode_batch` can run on.
+ */
+struct json_pool;
+
+/**
+ * @brief Starts a thread pool.
+ *
+ * The thread calling `json_pool_run` takes part in the work, so a pool of
+ * `threads` threads runs up to `threads + 1` workers.
+ *
+ * @param threads The number of threads to start, 0 for one less than the number of CPUs.
+ * @return A new pool, or NULL on failure.
+ */
+JSON_API struct json_pool *json_pool_new(int threads);
+
+/**
+ * @brief Stops the threads of a pool and frees it.
+ *
+ * @param pool The pool to free, may be NULL.
+ */
+JSON_API void json_pool_free(struct json_pool *pool);
+
+/**
+ * @brief Runs `count` invocations of `task(arg)` on a pool, see `json_executor_fn`.
+ *
+ * Pass it as the `executor` of `json_batch_options` with the pool as
+ * `executor_data`. Jobs from several threads are run one at a time; a
+ * task must not submit to the pool it runs on.
+ *
+ * @param pool The `struct json_pool` to run on.
+ * @param task The function to invoke.
+ * @param arg The argument passed to `task`.
+ * @param count The number of invocations.
+ */
+JSON_API void json_pool_run(void *pool, void (*task)(void *), void *arg, int count);
+
+/**
+ * @brief Fills `buffer` with up to `size` bytes of input.
+ *
+ * @return The number of bytes read, 0 at the end of the input, or -1 on error.
+ */
+typedef int (*json_read_fn)(void *source, char *buffer, int size);
+
+/**
+ * @brief Receives a decoded document, which it then owns.
+ *
+ * @return 0 to continue, anything else stops the pipeline.
+ */
+typedef int (*json_consume_fn)(void *data, struct json_value *value);
+
+/**
+ * @brief Options for `json_pipeline_run`, zero-initialize for the defaults.
+ */
+struct json_pipeline_options
+{
+    int buffer_size; /**< Size of a read buffer in bytes, 0 for 64 KiB. */
+    int buffers;     /**< Number of read buffers, 0 for 4. */
+    int depth;       /**< Decoded documents waiting for the consumer, 0 for 64. */
+};
+
+/**
+ * @brief Decodes a stream of documents with reading, decoding and consuming overlapped.
+ *
+ * The input is a sequence of JSON values separated by optional whitespace,
+ * such as newline-delimited JSON. One thread calls `read` into a fixed set
+ * of buffers, a second one splits them into documents and decodes them, and
+ * the calling thread hands each document to `consume` in input order. The
+ * stages are connected by bounded single-producer single-consumer rings;
+ * buffers go back to the reader once decoded, so apart from the trees
+ * themselves nothing is allocated once the pipeline is running.
+ *
+ * @param read Reads the input, called on the reader thread.
+ * @param source First argument of `read`.
+ * @param consume Processes the documents, called on the calling thread.
+ * @param data First argument of `consume`.
+ * @param opts The options, or NULL for the defaults.
+ * @return 0 once the whole input was consumed, the value returned by
+ *         `consume` if it stopped early, or -1 on a read, decode or
+ *         allocation error.
+ */
+JSON_API int json_pipeline_run(json_read_fn read, void *source, json_consume_fn consume, void *data,
+                               const struct json_pipeline_options *opts);
+#endif
+
 /**
  * @brief Creates a new JSON object.
  *
@@ -481,6 +880,19 @@ JSON_API void json_object_free(struct json_value *object);
  */
 JSON_API struct json_value *json_object_get(struct json_value *object, const char *key);
 
+/**
+ * @brief Retrieves the value associated with a key of known length.
+ *
+ * Same as `json_object_get`, but the key does not need to be
+ * null-terminated. Keys are compared by length first, then byte by byte.
+ *
+ * @param object The JSON object to query.
+ * @param key The key to look up.
+ * @param length The length of the key in bytes.
+ * @return A pointer to the associated value, or NULL if the key does not exist.
+ */
+JSON_API struct json_value *json_object_get_n(struct json_value *object, const char *key, size_t length);
+
 /**
  * @brief Sets a key-value pair in a JSON object.
  *
@@ -494,6 +906,49 @@ JSON_API struct json_value *json_object_get(struct json_value *object, const cha
  */
 JSON_API int json_object_set(struct json_value *object, const char *key, struct json_value *value);
 
+/**
+ * @brief Sets a key-value pair in a JSON object, with a key of known length.
+ *
+ * Same as `json_object_set`, but the key does not need to be
+ * null-terminated; a null-terminated copy of it is stored.
+ *
+ * @param object The JSON object to modify.
+ * @param key The key to set in the object.
+ * @param length The length of the key in bytes.
+ * @param value The value to associate with the key.
+ * @return 0 on success, or -1 on failure.
+ */
+JSON_API int json_object_set_n(struct json_value *object, const char *key, size_t length, struct json_value *value);
+
+/**
+ * @brief Sets a key-value pair in a JSON object, handing back the value it replaces.
+ *
+ * Works like `json_object_set`, but a value previously stored under `key`
+ * is moved to `previous` instead of being freed, so it can be placed in
+ * another document without copying.
+ *
+ * @param object The JSON object to modify.
+ * @param key The key to set in the object.
+ * @param value The value to associate with the key.
+ * @param previous Receives the replaced value, or NULL if the key was new.
+ *        If `previous` itself is NULL, the replaced value is freed.
+ * @return 0 on success, or -1 on failure.
+ */
+JSON_API int json_object_set_move(struct json_value *object, const char *key, struct json_value *value,
+                                  struct json_value **previous);
+
+/**
+ * @brief Detaches a value from a JSON object without freeing it.
+ *
+ * The member is removed from the object and ownership of its value is
+ * transferred to the caller.
+ *
+ * @param object The JSON object to modify.
+ * @param key The key to detach.
+ * @return The detached value, or NULL if the key does not exist.
+ */
+JSON_API struct json_value *json_object_take(struct json_value *object, const char *key);
+
 /**
  * @brief Checks if a key exists in a JSON object.
  *
@@ -505,6 +960,16 @@ JSON_API int json_object_set(struct json_value *object, const char *key, struct
  */
 JSON_API int json_object_has(struct json_value *object, const char *key);
 
+/**
+ * @brief Checks if a key of known length exists in a JSON object.
+ *
+ * @param object The JSON object to query.
+ * @param key The key to check for, not necessarily null-terminated.
+ * @param length The length of the key in bytes.
+ * @return 1 if the key exists, 0 otherwise.
+ */
+JSON_API int json_object_has_n(struct json_value *object, const char *key, size_t length);
+
 /**
  * @brief Removes a key-value pair from a JSON object.
  *
@@ -516,6 +981,50 @@ JSON_API int json_object_has(struct json_value *object, const char *key);
  */
 JSON_API void json_object_remove(struct json_value *object, const char *key);
 
+/**
+ * @brief Removes a key-value pair with a key of known length from a JSON object.
+ *
+ * @param object The JSON object to modify.
+ * @param key The key to remove, not necessarily null-terminated.
+ * @param length The length of the key in bytes.
+ */
+JSON_API void json_object_remove_n(struct json_value *object, const char *key, size_t length);
+
+/**
+ * @brief Removes several key-value pairs from a JSON object in one pass.
+ *
+ * The keys are hashed and sorted once, then every member is checked
+ * against them, so the cost is O((n + m) log m) instead of one scan of
+ * the object per key. The remaining members keep their order.
+ *
+ * @param object The JSON object to modify.
+ * @param keys The keys to remove, missing keys are ignored.
+ * @param count The number of keys.
+ * @return The number of members removed, or -1 on failure.
+ */
+JSON_API int json_object_remove_many(struct json_value *object, const char *const *keys, int count);
+
+/**
+ * @brief Removes all key-value pairs from a JSON object.
+ *
+ * Every member is freed in a single pass; the object keeps its capacity.
+ *
+ * @param object The JSON object to clear.
+ */
+JSON_API void json_object_clear(struct json_value *object);
+
+/**
+ * @brief Reserves room for members in a JSON object.
+ *
+ * After a successful call, the object holds up to `capacity` members
+ * without reallocating. The capacity is never reduced.
+ *
+ * @param object The JSON object to grow.
+ * @param capacity The number of members to make room for.
+ * @return 0 on success, or -1 on failure.
+ */
+JSON_API int json_object_reserve(struct json_value *object, int capacity);
+
 /**
  * @brief Iterates over the key-value pairs in a JSON object.
  *
@@ -592,1503 +1101,7020 @@ JSON_API void json_string_free(struct json_value *string);
 JSON_API void json_array_remove(struct json_value *array, int index);
 
 /**
- * @brief Retrieves the length of a JSON array.
+ * @brief Removes a value from a JSON array in constant time.
  *
- * This function returns the number of elements in the JSON array.
+ * The last element is moved into the freed slot, so the order of the
+ * remaining elements is not preserved.
  *
- * @param array The JSON array to query.
- * @return The number of elements in the array.
+ * @param array The JSON array to modify.
+ * @param index The index to remove the value from.
  */
-JSON_API int json_array_length(struct json_value *array);
+JSON_API void json_array_swap_remove(struct json_value *array, int index);
 
 /**
- * @brief Iterates over the elements in a JSON array.
+ * @brief Detaches a value from a JSON array without freeing it.
  *
- * This function provides a way to iterate through all elements in a JSON array.
- * The iteration index should be initialized to 0 before the first call.
+ * The element is removed from the array and ownership is transferred to
+ * the caller.
  *
- * @param array The JSON array to iterate over.
- * @param index A pointer to the iteration index (should be initialized to 0).
- * @param value A pointer to store the current value.
- * @return 1 on success, or 0 if the iteration is complete.
+ * @param array The JSON array to modify.
+ * @param index The index of the element to detach.
+ * @return The detached value, or NULL if out of bounds.
  */
-JSON_API int json_array_iter(struct json_value *array, int *index, struct json_value **value);
+JSON_API struct json_value *json_array_take(struct json_value *array, int index);
 
 /**
- * @brief Creates a new JSON string with the specified value.
+ * @brief Moves all elements of one JSON array to the end of another.
  *
- * This function allocates and initializes a new JSON string with the
- * provided string value.
+ * The element pointers are copied in a single block, or the whole buffer
+ * is handed over when `dst` is empty. Only the item buffer of `src` is
+ * freed: `src` is left as an empty array, still owned by the caller.
  *
- * @param value The string value to initialize the JSON string with.
- * @return A pointer to the newly created JSON string, or NULL on failure.
+ * @param dst The JSON array to append to.
+ * @param src The JSON array whose elements are moved.
+ * @return 0 on success, or -1 on failure or if `dst` and `src` are the
+ *         same array, in which case both arrays are left with their elements.
  */
-JSON_API struct json_value *json_string_new(const char *value);
+JSON_API int json_array_append_all(struct json_value *dst, struct json_value *src);
 
 /**
- * @brief Creates a new JSON number with the specified value.
+ * @brief Replaces a range of a JSON array with other values.
  *
- * This function allocates and initializes a new JSON number with the
- * provided numeric value.
+ * Frees the `count` elements starting at `start` and inserts `n` values
+ * from `items` in their place, moving the tail of the array once.
+ * Ownership of the inserted values is transferred to the array.
  *
- * @param value The numeric value to initialize the JSON number with.
- * @return A pointer to the newly created JSON number, or NULL on failure.
+ * @param array The JSON array to modify.
+ * @param start The index of the first element to replace.
+ * @param count The number of elements to remove.
+ * @param items The values to insert, may be NULL if `n` is 0.
+ * @param n The number of values to insert.
+ * @return 0 on success, or -1 on failure.
  */
-JSON_API struct json_value *json_number_new(double value);
+JSON_API int json_array_splice(struct json_value *array, int start, int count, struct json_value **items, int n);
 
 /**
- * @brief Creates a new JSON boolean with the specified value.
+ * @brief Removes all values from a JSON array.
  *
- * This function allocates and initializes a new JSON boolean with the
- * provided boolean value.
+ * Every element is freed in a single pass; the array keeps its capacity.
  *
- * @param value The boolean value to initialize the JSON boolean with.
- * @return A pointer to the newly created JSON boolean, or NULL on failure.
+ * @param array The JSON array to clear.
  */
-JSON_API struct json_value *json_boolean_new(int value);
+JSON_API void json_array_clear(struct json_value *array);
 
 /**
- * @brief Deallocates memory associated with a JSON value and its descendants.
+ * @brief Reserves room for elements in a JSON array.
  *
- * This function performs a comprehensive cleanup of the specified JSON value,
- * including recursively freeing all child elements, whether they are objects,
- * arrays, or strings. It ensures that all allocated memory is properly released.
+ * After a successful call, the array holds up to `capacity` elements
+ * without reallocating. The capacity is never reduced.
  *
- * @param value A pointer to the JSON value to be deallocated.
+ * @param array The JSON array to grow.
+ * @param capacity The number of elements to make room for.
+ * @return 0 on success, or -1 on failure.
  */
-JSON_API void json_free(struct json_value *value);
+JSON_API int json_array_reserve(struct json_value *array, int capacity);
 
 /**
- * @brief Copy the whole value and all its children into a new json_value.
- *
- * In theory, no memory should be shared with the previous value.
+ * @brief Releases the unused capacity of a JSON array.
  *
- * @param value The JSON value to deep-copy.
+ * @param array The JSON array to shrink.
+ * @return 0 on success, or -1 on failure, in which case the array is
+ *         left untouched.
+ */
+JSON_API int json_array_shrink_to_fit(struct json_value *array);
+
+/**
+ * @brief Retrieves the length of a JSON array.
+ *
+ * This function returns the number of elements in the JSON array.
+ *
+ * @param array The JSON array to query.
+ * @return The number of elements in the array.
+ */
+JSON_API int json_array_length(struct json_value *array);
+
+/**
+ * @brief Iterates over the elements in a JSON array.
+ *
+ * This function provides a way to iterate through all elements in a JSON array.
+ * The iteration index should be initialized to 0 before the first call.
+ * Like `json_array_get`, it converts a packed number array into a regular
+ * one, which is a write.
+ *
+ * @param array The JSON array to iterate over.
+ * @param index A pointer to the iteration index (should be initialized to 0).
+ * @param value A pointer to store the current value.
+ * @return 1 on success, or 0 if the iteration is complete.
+ */
+JSON_API int json_array_iter(struct json_value *array, int *index, struct json_value **value);
+
+/**
+ * @brief Creates a packed JSON number array.
+ *
+ * The numbers are stored contiguously instead of one `struct json_value`
+ * per element. `json_number_array_push` and `json_number_array_get` keep the
+ * array packed; anything that needs element nodes, such as `json_array_get`,
+ * `json_array_iter` or `json_array_push`, first converts it into a regular
+ * array.
+ *
+ * @param numbers The numbers to copy into the array, may be NULL if `count` is 0.
+ * @param count The number of elements.
+ * @return A pointer to the newly created array, or NULL on failure.
+ */
+JSON_API struct json_value *json_number_array_new(const double *numbers, int count);
+
+/**
+ * @brief Retrieves the elements of a packed JSON number array.
+ *
+ * The returned pointer gives direct access to the `json_array_count`
+ * elements and stays valid until the array is resized or converted.
+ *
+ * @param array The JSON array to access.
+ * @return The packed elements, or NULL if `array` is not a packed number array.
+ */
+JSON_API double *json_number_array_data(struct json_value *array);
+
+/**
+ * @brief Reads a number from a packed or regular JSON array.
+ *
+ * Never modifies the array, so it is safe on trees shared between threads.
+ *
+ * @param array The JSON array to read from.
+ * @param index The index of the element to read.
+ * @param number Receives the element.
+ * @return 0 on success, or -1 if `index` is out of bounds or the element is
+ *         not a number.
+ */
+JSON_API int json_number_array_get(const struct json_value *array, int index, double *number);
+
+/**
+ * @brief Appends a number to a JSON array.
+ *
+ * A packed array stays packed; a regular array gets a new number node.
+ *
+ * @param array The JSON array to modify.
+ * @param number The number to append.
+ * @return 0 on success, or -1 on failure.
+ */
+JSON_API int json_number_array_push(struct json_value *array, double number);
+
+/**
+ * @brief Creates a new JSON string with the specified value.
+ *
+ * This function allocates and initializes a new JSON string with the
+ * provided string value.
+ *
+ * @param value The string value to initialize the JSON string with.
+ * @return A pointer to the newly created JSON string, or NULL on failure.
+ */
+JSON_API struct json_value *json_string_new(const char *value);
+
+/**
+ * @brief Creates a new JSON number with the specified value.
+ *
+ * This function allocates and initializes a new JSON number with the
+ * provided numeric value.
+ *
+ * @param value The numeric value to initialize the JSON number with.
+ * @return A pointer to the newly created JSON number, or NULL on failure.
+ */
+JSON_API struct json_value *json_number_new(double value);
+
+/**
+ * @brief Creates a new JSON boolean with the specified value.
+ *
+ * This function allocates and initializes a new JSON boolean with the
+ * provided boolean value.
+ *
+ * @param value The boolean value to initialize the JSON boolean with.
+ * @return A pointer to the newly created JSON boolean, or NULL on failure.
+ */
+JSON_API struct json_value *json_boolean_new(int value);
+
+/**
+ * @brief Deallocates memory associated with a JSON value and its descendants.
+ *
+ * This function performs a comprehensive cleanup of the specified JSON value,
+ * including recursively freeing all child elements, whether they are objects,
+ * arrays, or strings. It ensures that all allocated memory is properly released.
+ *
+ * @param value A pointer to the JSON value to be deallocated.
+ */
+JSON_API void json_free(struct json_value *value);
+
+/**
+ * @brief Copy the whole value and all its children into a new json_value.
+ *
+ * In theory, no memory should be shared with the previous value.
+ *
+ * @param value The JSON value to deep-copy.
  */
 JSON_API struct json_value *json_deep_copy(struct json_value *value);
 
+#if defined(JSON_REFCOUNT)
 /**
- * @brief Represents a JSON parser for decoding JSON strings.
+ * @brief Adds an owner to a JSON value.
  *
- * This structure is used internally by the JSON library to parse
- * JSON-encoded strings into structured `json_value` objects.
+ * A retained value can be stored in several containers, or kept alive
+ * after its container is freed, without copying it. Every owner releases
+ * it with `json_release` (or `json_free`), and it is torn down when the
+ * last owner does. Shared values are not copied on write: a change made
+ * through one owner is seen by all of them.
  *
- * @note This structure is private and should not be accessed directly
- *       outside of the JSON library's internal implementation.
+ * @param value The JSON value to retain.
+ * @return The same value, for convenience.
  */
-struct json_parser
-{
-    /**
-     * @brief The input JSON string to be parsed.
-     *
-     * This is a pointer to the null-terminated JSON string that the parser
-     * operates on.
-     */
-    const char *input;
+JSON_API struct json_value *json_retain(struct json_value *value);
 
-    /**
-     * @brief The length of the input JSON string.
-     *
-     * This value represents the total number of characters in the input
-     * JSON string, excluding the null terminator.
-     */
-    int length;
+/**
+ * @brief Removes an owner from a JSON value.
+ *
+ * The value and its children are freed when the last owner releases it.
+ * With `JSON_REFCOUNT` defined, `json_free` behaves the same way.
+ *
+ * @param value The JSON value to release.
+ */
+JSON_API void json_release(struct json_value *value);
 
-    /**
-     * @brief The current position in the input JSON string.
-     *
-     * This value indicates the index of the character currently being
-     * processed by the parser.
-     */
-    int position;
+/**
+ * @brief Creates a copy-on-write clone of a JSON document.
+ *
+ * The clone shares every node with `doc` and costs a single reference
+ * count increment. Before modifying a clone, obtain the nodes to change
+ * through `json_make_mut`, `json_object_get_mut`, `json_array_get_mut` or
+ * `json_pointer_get_mut`: they copy the shared nodes on the path from the
+ * root to the modified node, and nothing else. The clone itself is shared,
+ * so even root-level changes start with `json_make_mut(&clone)`. The
+ * mutators, such as `json_object_set` or `json_array_push`, fail on a node
+ * with more than one owner instead of changing it for every owner; those
+ * returning nothing leave it untouched.
+ *
+ * @param doc The JSON document to clone.
+ * @return The clone, to be released with `json_free`.
+ */
+JSON_API struct json_value *json_clone_cow(struct json_value *doc);
 
-#if defined(JSON_ERROR)
-    /**
-     * @brief Represents error information for the JSON parser.
-     *
-     * This structure is used to store details about any errors encountered
-     * during the parsing process.
-     */
-    struct
-    {
-        /**
-         * @brief Enum representing the type of error encountered.
-         *
-         * - `JSON_ERROR_NONE`: No error occurred.
-         * - `JSON_ERROR_SYNTAX`: A syntax error was encountered.
-         * - `JSON_ERROR_MEMORY`: A memory allocation error occurred.
-         * - `JSON_ERROR_EOF`: Unexpected end of input was encountered.
-         */
-        enum
-        {
-            JSON_ERROR_NONE,           /**< No error occurred. */
-            JSON_ERROR_SYNTAX,         /**< A syntax error was encountered. */
-            JSON_ERROR_MEMORY,         /**< A memory allocation error occurred. */
-            JSON_ERROR_EOF,            /**< Unexpected end of input was encountered. */
-            JSON_ERROR_INVALID_NUMBER, /**< Failed to parse number */
-        } code;
+/**
+ * @brief Makes the value stored in a slot exclusively owned.
+ *
+ * If the value is shared, it is replaced in the slot by a shallow copy
+ * whose children are retained rather than copied, and the original is
+ * released. Otherwise the slot is left untouched.
+ *
+ * @param slot A pointer to the root pointer, or to a container slot.
+ * @return The exclusively owned value, or NULL on failure.
+ */
+JSON_API struct json_value *json_make_mut(struct json_value **slot);
 
-        /**
-         * @brief The line number where the error occurred.
-         *
-         * This value is used for debugging purposes to identify the location
-         * of the error in the source code.
-         */
-        int line;
+/**
+ * @brief Retrieves a member of an exclusively owned object for modification.
+ *
+ * The member is made exclusively owned with `json_make_mut` first.
+ *
+ * @param object An exclusively owned JSON object.
+ * @param key The key to look up.
+ * @return The exclusively owned member, or NULL if it does not exist.
+ */
+JSON_API struct json_value *json_object_get_mut(struct json_value *object, const char *key);
 
-        /**
-         * @brief The name of the function where the error occurred.
-         *
-         * This is a pointer to a string containing the name of the function
-         * in which the error was detected.
-         */
-        const char *func;
+/**
+ * @brief Retrieves an element of an exclusively owned array for modification.
+ *
+ * The element is made exclusively owned with `json_make_mut` first.
+ *
+ * @param array An exclusively owned JSON array.
+ * @param index The index of the element to retrieve.
+ * @return The exclusively owned element, or NULL if out of bounds.
+ */
+JSON_API struct json_value *json_array_get_mut(struct json_value *array, int index);
 
-        /**
-         * @brief A descriptive message about the error.
-         *
-         * This is a pointer to a string containing a human-readable
-         * description of the error.
-         */
-        const char *message;
-    } error;
+/**
+ * @brief Resolves a JSON pointer (RFC 6901) for modification.
+ *
+ * Every node on the path, including the root stored in `root`, is made
+ * exclusively owned with `json_make_mut`.
+ *
+ * @param root A pointer to the root of the document.
+ * @param path The JSON pointer to resolve.
+ * @return The exclusively owned value, or NULL if the path does not exist.
+ */
+JSON_API struct json_value *json_pointer_get_mut(struct json_value **root, const char *path);
 #endif
-};
 
 /**
- * Initializes a JSON object.
+ * @brief Applies a JSON Patch (RFC 6902) to a document in place.
  *
- * This function is responsible for setting up the internal structure
- * of a JSON object, ensuring it is ready for use. It is invoked by
- * both json_object_new() and json_object_free() to manage the lifecycle
- * of JSON objects.
+ * Every operation resolves its pointer once and mutates `doc` directly,
+ * `move` relinks the subtree instead of copying it. Values taken from the
+ * patch are copied, so `patch` is left untouched. The patch is atomic: if
+ * any operation fails, the operations already applied are rolled back and
+ * `doc` is left exactly as it was.
  *
- * @param object A pointer to the JSON object to be initialized.
+ * @param doc The JSON document to modify.
+ * @param patch A JSON array of patch operations.
+ * @return 0 on success, or -1 on failure.
+ */
+JSON_API int json_patch_apply(struct json_value *doc, struct json_value *patch);
+
+/**
+ * @brief Generates a JSON Patch (RFC 6902) turning one document into another.
  *
- * @note This function is marked as privative and should not be used
- *       directly outside of the JSON library's internal implementation.
+ * Subtrees are compared by structural hash first, so unchanged subtrees are
+ * skipped quickly and common array prefixes and suffixes are never patched.
+ * The caller is responsible for freeing the returned patch using `json_free()`.
+ *
+ * @param a The source document.
+ * @param b The target document.
+ * @return A JSON array of patch operations, or NULL on failure.
  */
-JSON_API void json_object_init(struct json_value *object);
+JSON_API struct json_value *json_diff(struct json_value *a, struct json_value *b);
 
-#if defined(JSON_ERROR)
 /**
- * @brief Sets an error in the JSON parser.
+ * @brief Applies a JSON Merge Patch (RFC 7396) to a document in place.
  *
- * This macro assigns error details to the JSON parser's error structure.
- * It captures the error code, the line number, the function name, and
- * a descriptive error message.
+ * Objects are merged recursively, members whose patch value is null are
+ * removed, and every other patch value is moved into `target` without
+ * being copied. The function takes ownership of `patch`, which must not
+ * be used afterwards. With `JSON_REFCOUNT`, a patch that is still held
+ * elsewhere is merged from a copy and left untouched. If `patch` is not an object, the contents of
+ * `target` are replaced by it.
  *
- * @param PARSER The JSON parser where the error occurred.
- * @param CODE The error code to set.
- * @param MESSAGE A descriptive message about the error.
+ * @param target The JSON document to modify.
+ * @param patch The merge patch to apply, consumed by the call.
+ * @return 0 on success, or -1 if memory ran out, in which case `target`
+ *         may be partially merged.
  */
-# define JSON_PARSER_ERROR(PARSER, CODE, MESSAGE)                                                                      \
-     (PARSER)->error.code = (CODE);                                                                                    \
-     (PARSER)->error.line = __LINE__;                                                                                  \
-     (PARSER)->error.func = __func__;                                                                                  \
-     (PARSER)->error.message = (MESSAGE)
-#else
+JSON_API int json_merge_patch(struct json_value *target, struct json_value *patch);
+
 /**
- * @brief No-op macro for JSON parser errors.
+ * @brief Computes a 64-bit structural hash of a JSON value.
  *
- * When JSON_ERROR is not defined, this macro does nothing.
+ * Equal values hash equally: object members are combined independently of
+ * their order and numbers are hashed by value. The hash is seeded with
+ * `JSON_HASH_SEED`. When `JSON_HASH_CACHE` is defined, the hashes that
+ * `json_freeze` cached in frozen arrays and objects are reused; unfrozen
+ * trees are always hashed in full, so in-place changes anywhere in them
+ * are reflected.
  *
- * @param PARSER The JSON parser (unused).
- * @param CODE The error code (unused).
- * @param MESSAGE The error message (unused).
+ * @param value The JSON value to hash.
+ * @return The hash of the value.
  */
-# define JSON_PARSER_ERROR(PARSER, CODE, MESSAGE)
+JSON_API unsigned long long json_hash(const struct json_value *value);
+
+/**
+ * @brief Computes a 64-bit structural hash of a JSON value with a seed.
+ *
+ * Same as `json_hash`, but seeded at run time. Cached hashes are neither
+ * read nor written.
+ *
+ * @param value The JSON value to hash.
+ * @param seed The seed to mix into the hash.
+ * @return The hash of the value.
+ */
+JSON_API unsigned long long json_hash_seeded(const struct json_value *value, unsigned long long seed);
+
+/**
+ * @brief Compares two JSON values structurally.
+ *
+ * Object members are compared regardless of their order. When
+ * `JSON_HASH_CACHE` is defined, the hashes cached by `json_freeze` are
+ * compared first, so that differing frozen values are rejected without
+ * walking them. Hashes cached in unfrozen trees are not trusted, as they
+ * may miss in-place changes to descendants.
+ *
+ * @param a The first JSON value.
+ * @param b The second JSON value.
+ * @return 1 if the values are equal, 0 otherwise.
+ */
+JSON_API int json_equal(const struct json_value *a, const struct json_value *b);
+
+#if defined(JSON_HASH_CACHE)
+/**
+ * @brief Drops the cached hashes of a value and all its children.
+ *
+ * Modifying a child of a frozen tree in place does not reach the hashes
+ * cached by its ancestors; call this on the root after such a change, or
+ * freeze the tree again.
+ *
+ * @param value The JSON value whose cached hashes are dropped.
+ */
+JSON_API void json_hash_invalidate(struct json_value *value);
 #endif
 
-static int json__decode_value(struct json_parser *parser, struct json_value *value);
+/**
+ * @brief Prepares a tree to be read by many threads at once.
+ *
+ * Caches the hash of every container with `JSON_HASH_CACHE`, builds the
+ * object lookup indexes that `JSON_INDEX` would otherwise build lazily, and
+ * unpacks packed number arrays, which `json_array_get` would unpack on
+ * first access. The containers are then marked frozen, so `json_hash` and
+ * `json_equal` may trust their hashes. Modifying a container through the
+ * library clears its mark; freezing again refreshes the whole tree.
+ *
+ * Afterwards any number of threads may call read-only functions on the
+ * tree concurrently without locking, as long as none modifies it. Lazy
+ * caches are also published atomically, so sharing an unfrozen tree is safe
+ * too, apart from packed arrays.
+ *
+ * @param value The root of the tree to freeze.
+ * @return 0 on success, or -1 if memory ran out.
+ */
+JSON_API int json_freeze(struct json_value *value);
+
+#if defined(JSON_REFCOUNT)
+/**
+ * @brief A cache of decoded documents keyed by their text.
+ */
+struct json_cache;
+
+/**
+ * @brief Counters of a `json_cache`, see `json_cache_stats`.
+ */
+struct json_cache_stats
+{
+    unsigned long long hits;      /**< Lookups answered from the cache. */
+    unsigned long long misses;    /**< Lookups that had to decode. */
+    unsigned long long evictions; /**< Documents dropped to stay within capacity. */
+    size_t bytes;                 /**< Input bytes currently cached. */
+    int entries;                  /**< Documents currently cached. */
+};
+
+/**
+ * @brief Creates a cache of decoded documents.
+ *
+ * The cache is split into `JSON_CACHE_SHARDS` shards by input hash, each
+ * with its own lock (with `JSON_THREADS`) and least recently used list.
+ * A shard holds at most `capacity / JSON_CACHE_SHARDS` bytes of input;
+ * larger documents are decoded but not cached.
+ *
+ * @param capacity The total size of the cached inputs in bytes.
+ * @return A new cache, or NULL on failure.
+ */
+JSON_API struct json_cache *json_cache_new(size_t capacity);
+
+/**
+ * @brief Frees a cache and releases the documents it holds.
+ *
+ * Documents still retained by callers stay valid.
+ *
+ * @param cache The cache to free, may be NULL.
+ */
+JSON_API void json_cache_free(struct json_cache *cache);
+
+/**
+ * @brief Decodes a document, or returns the tree of an identical earlier one.
+ *
+ * Inputs are looked up by a 64-bit hash of their bytes and compared in full
+ * before a cached tree is returned. New trees are frozen with `json_freeze`
+ * before being cached and are shared by every caller, so they must not be
+ * modified. Failed decodes are not cached.
+ *
+ * @param cache The cache to use.
+ * @param json The JSON string to decode.
+ * @param length The length of the JSON string in bytes.
+ * @return A retained tree the caller must `json_release`, or NULL if decoding fails.
+ */
+JSON_API struct json_value *json_cache_decode(struct json_cache *cache, const char *json, int length);
+
+/**
+ * @brief Reads the counters of a cache, summed over its shards.
+ *
+ * @param cache The cache to query.
+ * @param stats Receives the counters.
+ */
+JSON_API void json_cache_stats(struct json_cache *cache, struct json_cache_stats *stats);
+#endif
+
+#if defined(JSON_STATS)
+/**
+ * @brief What an allocation counted by `JSON_STATS` was made for.
+ */
+enum json_stats_site
+{
+    JSON_STATS_NODE,    /**< `struct json_value` nodes. */
+    JSON_STATS_STRING,  /**< String contents. */
+    JSON_STATS_KEY,     /**< Object keys and their entries. */
+    JSON_STATS_ITEMS,   /**< Array and object item storage. */
+    JSON_STATS_ENCODER, /**< Encoder output buffers. */
+    JSON_STATS_OTHER,   /**< Everything else, such as parser scratch space. */
+    JSON_STATS_SITES    /**< Number of sites. */
+};
+
+/**
+ * @brief Allocator calls made for one `enum json_stats_site`.
+ */
+struct json_stats_allocations
+{
+    unsigned long long allocs;        /**< Successful allocations, including reallocations of NULL. */
+    unsigned long long alloc_bytes;   /**< Bytes requested by them. */
+    unsigned long long reallocs;      /**< Successful reallocations of existing blocks. */
+    unsigned long long realloc_bytes; /**< New sizes requested by them. */
+    unsigned long long frees;         /**< Non-NULL frees. */
+};
+
+/**
+ * @brief Library-wide counters, see `json_stats_snapshot`.
+ */
+struct json_stats
+{
+    struct json_stats_allocations sites[JSON_STATS_SITES]; /**< Allocator calls by site. */
+    unsigned long long nodes[JSON_TYPE_NUMBER_ARRAY + 1];  /**< Nodes created, by `enum json_type`. */
+    unsigned long long growth_reallocs; /**< Reallocations made to grow an array or object. */
+    unsigned long long key_comparisons; /**< Keys compared by object lookups and updates. */
+};
+
+/**
+ * @brief Sums the counters of every thread that has used the library.
+ *
+ * Each thread counts into its own block, so counting takes no locks and
+ * shares no cache lines. The blocks are never freed and keep the totals of
+ * threads that have exited. Counters of threads running concurrently with
+ * the snapshot may be slightly behind.
+ *
+ * @param stats Receives the totals since the program started.
+ */
+JSON_API void json_stats_snapshot(struct json_stats *stats);
+#endif
+
+#if defined(JSON_PERSISTENT)
+struct json__pmap_node;
+struct json__pvec_node;
+
+/**
+ * @brief An immutable, reference-counted JSON value.
+ *
+ * Updating a persistent value never modifies it, it returns a new version
+ * that shares every untouched node with the old one. Objects are hash array
+ * mapped tries and arrays are 32-way vector tries with a tail buffer, so
+ * lookups and updates take O(log32 n) and copy only the path to the change.
+ * Versions can be read from any number of threads without locking, node
+ * ownership is tracked with atomic reference counts.
+ *
+ * @note This structure is private and should not be accessed directly
+ *       outside of the JSON library's internal implementation.
+ */
+struct json_pvalue
+{
+    int type;     /**< One of the `JSON_TYPE_*` values. */
+    int refcount; /**< Number of owners of the version. */
+    int count;    /**< String length, element count or member count. */
+
+    union {
+        double number; /**< Number or boolean value. */
+        char *string;  /**< Null-terminated string data. */
+
+        struct json__pmap_node *map; /**< Root of an object trie, NULL when empty. */
+
+        struct {
+            struct json__pvec_node *root; /**< Elements before the tail, NULL when none. */
+            struct json__pvec_node *tail; /**< Last 1 to 32 elements, NULL when empty. */
+            int shift;                    /**< Bit shift of the root level. */
+        } vector;
+    };
+};
+
+/**
+ * @brief Retrieves the type of a persistent value.
+ *
+ * @param VALUE The persistent value to query.
+ * @return One of the `JSON_TYPE_*` values.
+ */
+# define json_pvalue_type(VALUE) ((VALUE)->type)
+
+/**
+ * @brief Retrieves the length of a persistent string or the number of
+ *        elements or members of a persistent array or object.
+ *
+ * @param VALUE The persistent value to query.
+ * @return The length or element count.
+ */
+# define json_pvalue_count(VALUE) ((VALUE)->count)
+
+/**
+ * @brief Retrieves the value of a persistent number or boolean.
+ *
+ * @param VALUE The persistent number or boolean to read.
+ * @return The numeric value.
+ */
+# define json_pvalue_number(VALUE) ((VALUE)->number)
+
+/**
+ * @brief Retrieves the null-terminated data of a persistent string.
+ *
+ * @param VALUE The persistent string to read.
+ * @return A pointer to the string data, valid as long as the value is.
+ */
+# define json_pvalue_string(VALUE) ((const char *) (VALUE)->string)
+
+/**
+ * @brief Converts a JSON value into a persistent value.
+ *
+ * @param value The JSON value to convert, left untouched.
+ * @return A new persistent value, or NULL on failure.
+ */
+JSON_API struct json_pvalue *json_pvalue_from(const struct json_value *value);
+
+/**
+ * @brief Converts a persistent value back into a mutable JSON value.
+ *
+ * Object members are emitted in trie order rather than insertion order.
+ *
+ * @param value The persistent value to convert.
+ * @return A new JSON value, or NULL on failure.
+ */
+JSON_API struct json_value *json_pvalue_to_value(const struct json_pvalue *value);
+
+/**
+ * @brief Encodes a persistent value with the regular JSON encoder.
+ *
+ * @param value The persistent value to encode.
+ * @return A newly allocated JSON string, or NULL on failure.
+ */
+JSON_API char *json_pvalue_encode(const struct json_pvalue *value);
+
+/**
+ * @brief Creates an empty persistent object.
+ *
+ * @return A new persistent object, or NULL on failure.
+ */
+JSON_API struct json_pvalue *json_pvalue_object_new(void);
+
+/**
+ * @brief Creates an empty persistent array.
+ *
+ * @return A new persistent array, or NULL on failure.
+ */
+JSON_API struct json_pvalue *json_pvalue_array_new(void);
+
+/**
+ * @brief Creates a persistent string holding a copy of `string`.
+ *
+ * @param string The null-terminated string to copy.
+ * @return A new persistent string, or NULL on failure.
+ */
+JSON_API struct json_pvalue *json_pvalue_string_new(const char *string);
+
+/**
+ * @brief Creates a persistent number.
+ *
+ * @param number The numeric value.
+ * @return A new persistent number, or NULL on failure.
+ */
+JSON_API struct json_pvalue *json_pvalue_number_new(double number);
+
+/**
+ * @brief Creates a persistent boolean.
+ *
+ * @param boolean The boolean value.
+ * @return A new persistent boolean, or NULL on failure.
+ */
+JSON_API struct json_pvalue *json_pvalue_boolean_new(int boolean);
+
+/**
+ * @brief Creates a persistent null.
+ *
+ * @return A new persistent null, or NULL on failure.
+ */
+JSON_API struct json_pvalue *json_pvalue_null_new(void);
+
+/**
+ * @brief Adds an owner to a persistent value.
+ *
+ * @param value The persistent value to retain.
+ * @return The same value.
+ */
+JSON_API struct json_pvalue *json_pvalue_retain(struct json_pvalue *value);
+
+/**
+ * @brief Removes an owner from a persistent value.
+ *
+ * Nodes shared with other versions stay alive until their last version
+ * is released.
+ *
+ * @param value The persistent value to release, may be NULL.
+ */
+JSON_API void json_pvalue_release(struct json_pvalue *value);
+
+/**
+ * @brief Looks up a member of a persistent object.
+ *
+ * @param object The persistent object to search.
+ * @param key The key to look up.
+ * @return The borrowed member, or NULL if it does not exist.
+ */
+JSON_API struct json_pvalue *json_pvalue_get(const struct json_pvalue *object, const char *key);
+
+/**
+ * @brief Retrieves an element of a persistent array.
+ *
+ * @param array The persistent array to read.
+ * @param index The index of the element.
+ * @return The borrowed element, or NULL if out of bounds.
+ */
+JSON_API struct json_pvalue *json_pvalue_at(const struct json_pvalue *array, int index);
+
+/**
+ * @brief Returns a new version of an object with `key` set to `value`.
+ *
+ * `object` is left untouched and still owned by the caller. Ownership of
+ * `value` moves to the new version, it is released on failure.
+ *
+ * @param object The persistent object to update.
+ * @param key The key to set.
+ * @param value The member value.
+ * @return The new version, or NULL on failure.
+ */
+JSON_API struct json_pvalue *json_pvalue_set(const struct json_pvalue *object, const char *key, struct json_pvalue *value);
+
+/**
+ * @brief Returns a new version of an object without `key`.
+ *
+ * @param object The persistent object to update, left untouched.
+ * @param key The key to remove.
+ * @return The new version, or NULL on failure.
+ */
+JSON_API struct json_pvalue *json_pvalue_remove(const struct json_pvalue *object, const char *key);
+
+/**
+ * @brief Returns a new version of an array with `value` appended.
+ *
+ * `array` is left untouched. Ownership of `value` moves to the new
+ * version, it is released on failure.
+ *
+ * @param array The persistent array to update.
+ * @param value The element to append.
+ * @return The new version, or NULL on failure.
+ */
+JSON_API struct json_pvalue *json_pvalue_push(const struct json_pvalue *array, struct json_pvalue *value);
+
+/**
+ * @brief Returns a new version of an array with the element at `index`
+ *        replaced by `value`.
+ *
+ * `array` is left untouched. Ownership of `value` moves to the new
+ * version, it is released on failure.
+ *
+ * @param array The persistent array to update.
+ * @param index The index of the element to replace.
+ * @param value The new element.
+ * @return The new version, or NULL on failure.
+ */
+JSON_API struct json_pvalue *json_pvalue_replace(const struct json_pvalue *array, int index, struct json_pvalue *value);
+
+/**
+ * @brief Calls `callback` for every member of a persistent object.
+ *
+ * Members are visited in trie order. Iteration stops early when the
+ * callback returns non-zero.
+ *
+ * @param object The persistent object to walk.
+ * @param callback The function to call with each key and borrowed value.
+ * @param context Passed through to `callback`.
+ * @return The last value returned by `callback`, or 0.
+ */
+JSON_API int json_pvalue_object_foreach(const struct json_pvalue *object,
+                                        int (*callback)(const char *key, struct json_pvalue *value, void *context),
+                                        void *context);
+#endif
+
+#if defined(JSON_SNAPSHOT)
+/**
+ * @brief A read-only node inside a memory-mapped snapshot.
+ *
+ * Every node starts on an 8-byte boundary with this header and is followed
+ * by its payload:
+ *
+ * - `JSON_TYPE_NUMBER`: a `double`.
+ * - `JSON_TYPE_BOOLEAN`: nothing, `length` holds the value.
+ * - `JSON_TYPE_STRING`: `length` bytes followed by a null terminator.
+ * - `JSON_TYPE_ARRAY`: `length` signed 64-bit offsets to the elements.
+ * - `JSON_TYPE_OBJECT`: `length` entries in insertion order, followed by
+ *   `length` 32-bit entry indices sorted by key hash.
+ *
+ * All offsets are relative to the node that holds them, so the image is
+ * position independent and can be mapped at any address.
+ */
+struct json_snapshot_value
+{
+    uint32_t type;   /**< One of the `JSON_TYPE_*` values. */
+    uint32_t length; /**< String length, element count or boolean value. */
+};
+
+/**
+ * @brief A snapshot file mapped into memory.
+ *
+ * @note This structure is private and should not be accessed directly
+ *       outside of the JSON library's internal implementation.
+ */
+struct json_snapshot
+{
+    const char *base;                       /**< Start of the mapping. */
+    size_t size;                            /**< Size of the mapping in bytes. */
+    const struct json_snapshot_value *root; /**< Root node inside the mapping. */
+};
+
+/**
+ * @brief Retrieves the type of a snapshot node.
+ *
+ * @param VALUE The snapshot node to query.
+ * @return One of the `JSON_TYPE_*` values.
+ */
+# define json_snapshot_type(VALUE) ((int) (VALUE)->type)
+
+/**
+ * @brief Retrieves the number of elements or members of a snapshot node.
+ *
+ * @param VALUE The snapshot array or object to query.
+ * @return The element count of an array or the member count of an object.
+ */
+# define json_snapshot_count(VALUE) ((int) (VALUE)->length)
+
+/**
+ * @brief Retrieves the numeric value of a snapshot number.
+ *
+ * @param VALUE The snapshot number to read.
+ * @return The numeric value.
+ */
+# define json_snapshot_number(VALUE) (*(const double *) ((VALUE) + 1))
+
+/**
+ * @brief Retrieves the boolean value of a snapshot boolean.
+ *
+ * @param VALUE The snapshot boolean to read.
+ * @return Non-zero if the boolean is true, 0 if false.
+ */
+# define json_snapshot_boolean(VALUE) ((VALUE)->length != 0)
+
+/**
+ * @brief Retrieves the null-terminated data of a snapshot string.
+ *
+ * The length of the string is available through `json_snapshot_count`.
+ *
+ * @param VALUE The snapshot string to read.
+ * @return A pointer into the mapping.
+ */
+# define json_snapshot_string(VALUE) ((const char *) ((VALUE) + 1))
+
+/**
+ * @brief Writes a JSON value as a relocatable binary snapshot.
+ *
+ * The image is written sequentially, so `fd` may be a pipe or a socket.
+ * Object keys are hashed and indexed at write time, which makes lookups
+ * in the mapped image a binary search instead of a linear scan.
+ *
+ * @param value The JSON value to write.
+ * @param fd The file descriptor to write to.
+ * @return 0 on success, or -1 on failure.
+ */
+JSON_API int json_snapshot_write(struct json_value *value, int fd);
+
+/**
+ * @brief Maps a snapshot file into memory.
+ *
+ * No deserialization takes place, the pages are shared through the page
+ * cache with every other process mapping the same file. The file is
+ * trusted: only its header and trailer are validated.
+ *
+ * @param path The path of the snapshot file.
+ * @return The mapped snapshot, or NULL on failure.
+ */
+JSON_API struct json_snapshot *json_snapshot_open(const char *path);
+
+/**
+ * @brief Unmaps a snapshot.
+ *
+ * Every node obtained from the snapshot becomes invalid.
+ *
+ * @param snapshot The snapshot to close.
+ */
+JSON_API void json_snapshot_close(struct json_snapshot *snapshot);
+
+/**
+ * @brief Retrieves the root node of a snapshot.
+ *
+ * @param snapshot The snapshot to query.
+ * @return The root node.
+ */
+JSON_API const struct json_snapshot_value *json_snapshot_root(const struct json_snapshot *snapshot);
+
+/**
+ * @brief Retrieves an element from a snapshot array.
+ *
+ * @param array The snapshot array to retrieve from.
+ * @param index The index of the element to retrieve.
+ * @return The element, or NULL if out of bounds.
+ */
+JSON_API const struct json_snapshot_value *json_snapshot_array_get(const struct json_snapshot_value *array, int index);
+
+/**
+ * @brief Retrieves the value associated with a key in a snapshot object.
+ *
+ * @param object The snapshot object to query.
+ * @param key The key to look up.
+ * @return The associated value, or NULL if the key does not exist.
+ */
+JSON_API const struct json_snapshot_value *json_snapshot_object_get(const struct json_snapshot_value *object,
+                                                                    const char *key);
+
+/**
+ * @brief Iterates over the elements in a snapshot array.
+ *
+ * @param array The snapshot array to iterate over.
+ * @param index A pointer to the iteration index (should be initialized to 0).
+ * @param value A pointer to store the current value.
+ * @return 1 on success, or 0 if the iteration is complete.
+ */
+JSON_API int json_snapshot_array_iter(const struct json_snapshot_value *array, int *index,
+                                      const struct json_snapshot_value **value);
+
+/**
+ * @brief Iterates over the key-value pairs in a snapshot object.
+ *
+ * Members are visited in the order they had in the original object.
+ *
+ * @param object The snapshot object to iterate over.
+ * @param iter A pointer to the iteration index (should be initialized to 0).
+ * @param key A pointer to store the current key.
+ * @param value A pointer to store the current value.
+ * @return 1 if there are more items to iterate, 0 otherwise.
+ */
+JSON_API int json_snapshot_object_iter(const struct json_snapshot_value *object, int *iter, const char **key,
+                                       const struct json_snapshot_value **value);
+#endif
+
+/**
+ * @brief Scratch space kept between decodes, see `json_parser_ctx_new`.
+ */
+struct json_parser_ctx
+{
+    void **stack;         /**< Container stack. */
+    int stack_capacity;   /**< Allocated size of the container stack. */
+    char *scratch;        /**< String decoding buffer. */
+    int scratch_capacity; /**< Allocated size of the string buffer. */
+#if defined(JSON_NUMBER_ARRAYS)
+    double *numbers;      /**< Number stack. */
+    int numbers_capacity; /**< Allocated size of the number stack. */
+#endif
+};
+
+/**
+ * @brief Represents a JSON parser for decoding JSON strings.
+ *
+ * This structure is used internally by the JSON library to parse
+ * JSON-encoded strings into structured `json_value` objects.
+ *
+ * @note This structure is private and should not be accessed directly
+ *       outside of the JSON library's internal implementation.
+ */
+struct json_parser
+{
+    /**
+     * @brief The input JSON string to be parsed.
+     *
+     * This is a pointer to the null-terminated JSON string that the parser
+     * operates on.
+     */
+    const char *input;
+
+    /**
+     * @brief The length of the input JSON string.
+     *
+     * This value represents the total number of characters in the input
+     * JSON string, excluding the null terminator.
+     */
+    int length;
+
+    /**
+     * @brief The current position in the input JSON string.
+     *
+     * This value indicates the index of the character currently being
+     * processed by the parser.
+     */
+    int position;
+
+    /**
+     * @brief Scratch stack of decoded children.
+     *
+     * Arrays push their elements and objects their entries here while they
+     * are parsed, then move them into an exactly sized block once the
+     * closing bracket is reached. The stack is shared by all nesting levels
+     * and grows only for the deepest, widest part of the document.
+     */
+    void **stack;
+
+    /**
+     * @brief Number of children currently on the scratch stack.
+     */
+    int stack_length;
+
+    /**
+     * @brief Allocated size of the scratch stack.
+     */
+    int stack_capacity;
+
+    /**
+     * @brief Scratch space strings are decoded into before being copied
+     * into a block of their exact size.
+     */
+    char *scratch;
+
+    /**
+     * @brief Allocated size of the string scratch space.
+     */
+    int scratch_capacity;
+
+#if defined(JSON_NUMBER_ARRAYS)
+    /**
+     * @brief Scratch stack of numbers for arrays that may be packed.
+     *
+     * As long as an array holds only numbers, they are collected here
+     * without allocating a node per element.
+     */
+    double *numbers;
+
+    /**
+     * @brief Number of entries on the number stack.
+     */
+    int numbers_length;
+
+    /**
+     * @brief Allocated size of the number stack.
+     */
+    int numbers_capacity;
+#endif
+
+#if defined(JSON_ERROR)
+    /**
+     * @brief Represents error information for the JSON parser.
+     *
+     * This structure is used to store details about any errors encountered
+     * during the parsing process.
+     */
+    struct
+    {
+        /**
+         * @brief The type of error encountered, see `enum json_error`.
+         */
+        enum json_error code;
+
+        /**
+         * @brief The line number where the error occurred.
+         *
+         * This value is used for debugging purposes to identify the location
+         * of the error in the source code.
+         */
+        int line;
+
+        /**
+         * @brief The name of the function where the error occurred.
+         *
+         * This is a pointer to a string containing the name of the function
+         * in which the error was detected.
+         */
+        const char *func;
+
+        /**
+         * @brief A descriptive message about the error.
+         *
+         * This is a pointer to a string containing a human-readable
+         * description of the error.
+         */
+        const char *message;
+    } error;
+#endif
+};
+
+/**
+ * Initializes a JSON object.
+ *
+ * This function is responsible for setting up the internal structure
+ * of a JSON object, ensuring it is ready for use. It is invoked by
+ * both json_object_new() and json_object_free() to manage the lifecycle
+ * of JSON objects.
+ *
+ * @param object A pointer to the JSON object to be initialized.
+ *
+ * @note This function is marked as privative and should not be used
+ *       directly outside of the JSON library's internal implementation.
+ */
+JSON_API void json_object_init(struct json_value *object);
+
+#if defined(JSON_ERROR)
+/**
+ * @brief Sets an error in the JSON parser.
+ *
+ * This macro assigns error details to the JSON parser's error structure.
+ * It captures the error code, the line number, the function name, and
+ * a descriptive error message.
+ *
+ * @param PARSER The JSON parser where the error occurred.
+ * @param CODE The error code to set.
+ * @param MESSAGE A descriptive message about the error.
+ */
+# define JSON_PARSER_ERROR(PARSER, CODE, MESSAGE)                                                                      \
+     (PARSER)->error.code = (CODE);                                                                                    \
+     (PARSER)->error.line = __LINE__;                                                                                  \
+     (PARSER)->error.func = __func__;                                                                                  \
+     (PARSER)->error.message = (MESSAGE)
+#else
+/**
+ * @brief No-op macro for JSON parser errors.
+ *
+ * When JSON_ERROR is not defined, this macro does nothing.
+ *
+ * @param PARSER The JSON parser (unused).
+ * @param CODE The error code (unused).
+ * @param MESSAGE The error message (unused).
+ */
+# define JSON_PARSER_ERROR(PARSER, CODE, MESSAGE)
+#endif
+
+static int json__decode_value(struct json_parser *parser, struct json_value *value);
+
+static int json__strlen(const char *str)
+{
+    int len = 0;
+    while (*str++)
+        len++;
+    return len;
+}
+
+static int json__streq(const char *s1, const char *s2)
+{
+    if (json__strlen(s1) != json__strlen(s2))
+        return 0;
+
+    while (*s1 && *s1 == *s2) {
+        s1++;
+        s2++;
+    }
+
+    if (*s1 == 0 && *s2 == 0)
+        return 1;
+
+    return 0;
+}
+
+static inline unsigned long long json__hash_bytes(const void *data, size_t length, unsigned long long seed)
+{
+    const unsigned long long m = 0xc6a4a7935bd1e995ULL;
+    const unsigned char *p = (const unsigned char *) data;
+    unsigned long long h = seed ^ (length * m);
+
+    // Mix 8 bytes at a time, then fold in the tail
+    while (length >= 8) {
+        unsigned long long k;
+        memcpy(&k, p, 8);
+        k *= m;
+        k ^= k >> 47;
+        k *= m;
+        h ^= k;
+        h *= m;
+        p += 8;
+        length -= 8;
+    }
+
+    switch (length) {
+    case 7:
+        h ^= (unsigned long long) p[6] << 48; /* fallthrough */
+    case 6:
+        h ^= (unsigned long long) p[5] << 40; /* fallthrough */
+    case 5:
+        h ^= (unsigned long long) p[4] << 32; /* fallthrough */
+    case 4:
+        h ^= (unsigned long long) p[3] << 24; /* fallthrough */
+    case 3:
+        h ^= (unsigned long long) p[2] << 16; /* fallthrough */
+    case 2:
+        h ^= (unsigned long long) p[1] << 8; /* fallthrough */
+    case 1:
+        h ^= (unsigned long long) p[0];
+        h *= m;
+    }
+
+    h ^= h >> 47;
+    h *= m;
+    h ^= h >> 47;
+    return h;
+}
+
+#if defined(JSON_STATS)
+# if defined(__cplusplus)
+#  define JSON__THREAD_LOCAL thread_local
+# elif defined(_MSC_VER)
+#  define JSON__THREAD_LOCAL __declspec(thread)
+# elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#  define JSON__THREAD_LOCAL _Thread_local
+# else
+#  define JSON__THREAD_LOCAL __thread
+# endif
+
+struct json__stats_block
+{
+    struct json_stats stats;
+    struct json__stats_block *next;
+};
+
+// Every thread's block, newest first. Blocks are only ever pushed
+static struct json__stats_block *json__stats_blocks;
+static JSON__THREAD_LOCAL struct json__stats_block *json__stats_local;
+
+static struct json_stats *json__stats(void)
+{
+    struct json__stats_block *block = json__stats_local;
+
+    if (block == NULL) {
+        if ((block = (struct json__stats_block *) json_alloc(sizeof(*block))) == NULL)
+            return NULL;
+        memset(block, 0, sizeof(*block));
+
+        do
+            block->next = (struct json__stats_block *) JSON__ATOMIC_LOAD_PTR(&json__stats_blocks);
+        while (!JSON__ATOMIC_CAS_PTR(&json__stats_blocks, block->next, block));
+        json__stats_local = block;
+    }
+    return &block->stats;
+}
+
+// Only the owning thread writes a counter, the atomic accesses keep concurrent snapshots well defined
+# define JSON__STATS_ADD(FIELD, N)                                                                                    \
+     do {                                                                                                             \
+         struct json_stats *stats_ = json__stats();                                                                   \
+         if (stats_ != NULL)                                                                                          \
+             JSON__ATOMIC_STORE_HASH(&stats_->FIELD,                                                                  \
+                                     JSON__ATOMIC_LOAD_HASH(&stats_->FIELD) + (unsigned long long) (N));              \
+     } while (0)
+
+static void *json__stats_alloc(enum json_stats_site site, size_t size)
+{
+    void *ptr = json_alloc(size);
+
+    if (ptr != NULL) {
+        JSON__STATS_ADD(sites[site].allocs, 1);
+        JSON__STATS_ADD(sites[site].alloc_bytes, size);
+    }
+    return ptr;
+}
+
+// Growing from NULL counts as an allocation, so allocations and frees pair up
+static void *json__stats_realloc(enum json_stats_site site, void *ptr, size_t size)
+{
+    void *moved;
+
+    if (ptr == NULL)
+        return json__stats_alloc(site, size);
+
+    if ((moved = json_realloc(ptr, size)) != NULL) {
+        JSON__STATS_ADD(sites[site].reallocs, 1);
+        JSON__STATS_ADD(sites[site].realloc_bytes, size);
+    }
+    return moved;
+}
+
+static void json__stats_free(enum json_stats_site site, void *ptr)
+{
+    if (ptr != NULL)
+        JSON__STATS_ADD(sites[site].frees, 1);
+    json__free(ptr);
+}
+
+JSON_API void json_stats_snapshot(struct json_stats *stats)
+{
+    const unsigned long long *from;
+    unsigned long long *to = (unsigned long long *) stats;
+    size_t count = sizeof(*stats) / sizeof(unsigned long long);
+
+    memset(stats, 0, sizeof(*stats));
+    for (struct json__stats_block *block = (struct json__stats_block *) JSON__ATOMIC_LOAD_PTR(&json__stats_blocks);
+         block != NULL; block = block->next) {
+        from = (const unsigned long long *) &block->stats;
+        for (size_t i = 0; i < count; i++)
+            to[i] += JSON__ATOMIC_LOAD_HASH(&from[i]);
+    }
+}
+
+// From here on allocations are counted: tagged ones by their site, the rest as JSON_STATS_OTHER
+# undef json_alloc
+# undef json_realloc
+# undef json__free
+# define json_alloc(size) json__stats_alloc(JSON_STATS_OTHER, (size))
+# define json_realloc(ptr, size) json__stats_realloc(JSON_STATS_OTHER, (ptr), (size))
+# define json__free(ptr) json__stats_free(JSON_STATS_OTHER, (ptr))
+# define json__alloc_as(SITE, size) json__stats_alloc((SITE), (size))
+# define json__realloc_as(SITE, ptr, size) json__stats_realloc((SITE), (ptr), (size))
+# define json__free_as(SITE, ptr) json__stats_free((SITE), (ptr))
+# define JSON__STATS_NODE(TYPE) JSON__STATS_ADD(nodes[(TYPE)], 1)
+# define JSON__STATS_GROWTH() JSON__STATS_ADD(growth_reallocs, 1)
+# define JSON__STATS_KEY_COMPARISONS(N) JSON__STATS_ADD(key_comparisons, (N))
+#else
+# define json__alloc_as(SITE, size) json_alloc(size)
+# define json__realloc_as(SITE, ptr, size) json_realloc(ptr, size)
+# define json__free_as(SITE, ptr) json__free(ptr)
+# define JSON__STATS_NODE(TYPE) ((void) 0)
+# define JSON__STATS_GROWTH() ((void) 0)
+# define JSON__STATS_KEY_COMPARISONS(N) ((void) 0)
+#endif
+
+static struct json_value *json__value_alloc(void)
+{
+    struct json_value *value = (struct json_value *) json__alloc_as(JSON_STATS_NODE, sizeof(struct json_value));
+
+#if defined(JSON_REFCOUNT)
+    if (value != NULL)
+        value->refcount = 1;
+#endif
+#if defined(JSON_HASH_CACHE) || defined(JSON_INDEX)
+    if (value != NULL)
+        value->frozen = 0;
+#endif
+    return value;
+}
+
+// Copies the contents of `source` into `target`, leaving its reference count alone
+static void json__value_assign(struct json_value *target, const struct json_value *source)
+{
+#if defined(JSON_REFCOUNT)
+    int refcount = target->refcount;
+    *target = *source;
+    target->refcount = refcount;
+#else
+    *target = *source;
+#endif
+#if defined(JSON_HASH_CACHE) || defined(JSON_INDEX)
+    target->frozen = 0;
+#endif
+}
+
+static int json__parser_reserve_scratch(struct json_parser *parser, int length)
+{
+    if (length > parser->scratch_capacity) {
+        int capacity = parser->scratch_capacity > 0 ? parser->scratch_capacity : 64;
+        char *scratch;
+
+        while (capacity < length)
+            capacity *= 2;
+
+        if ((scratch = (char *) json_realloc(parser->scratch, capacity)) == NULL) {
+            JSON_PARSER_ERROR(parser, JSON_ERROR_MEMORY, "Memory allocation failed");
+            return -1;
+        }
+
+        parser->scratch = scratch;
+        parser->scratch_capacity = capacity;
+    }
+
+    return 0;
+}
+
+static int json__parser_push(struct json_parser *parser, void *child)
+{
+    if (parser->stack_length == parser->stack_capacity) {
+        int capacity = parser->stack_capacity > 0 ? parser->stack_capacity * 2 : 64;
+        void **stack = (void **) json_realloc(parser->stack, capacity * sizeof(void *));
+
+        if (stack == NULL)
+            return -1;
+
+        parser->stack = stack;
+        parser->stack_capacity = capacity;
+    }
+
+    parser->stack[parser->stack_length++] = child;
+    return 0;
+}
+
+#if defined(JSON_NUMBER_ARRAYS)
+static int json__parser_push_number(struct json_parser *parser, double number)
+{
+    if (parser->numbers_length == parser->numbers_capacity) {
+        int capacity = parser->numbers_capacity > 0 ? parser->numbers_capacity * 2 : 64;
+        double *numbers = (double *) json_realloc(parser->numbers, capacity * sizeof(double));
+
+        if (numbers == NULL)
+            return -1;
+
+        parser->numbers = numbers;
+        parser->numbers_capacity = capacity;
+    }
+
+    parser->numbers[parser->numbers_length++] = number;
+    return 0;
+}
+
+// Turns the numbers collected since `base` into nodes on the scratch stack
+static int json__parser_spill_numbers(struct json_parser *parser, int base)
+{
+    for (int i = base; i < parser->numbers_length; i++) {
+        struct json_value *item = json_number_new(parser->numbers[i]);
+
+        if (item == NULL || json__parser_push(parser, item) != 0) {
+            json__free_as(JSON_STATS_NODE, item);
+            return -1;
+        }
+    }
+
+    parser->numbers_length = base;
+    return 0;
+}
+#endif
+
+static void json__parse_whitespace(struct json_parser *parser)
+{
+    const char *ptr = parser->input;
+    int pos = parser->position;
+    int len = parser->length;
+
+    while (pos < len && (ptr[pos] == ' ' || ptr[pos] == '\t' || ptr[pos] == '\n' || ptr[pos] == '\r'))
+        pos++;
+
+    parser->position = pos;
+}
+
+static int json__decode_string(struct json_parser *parser, struct json_value *value, int key)
+{
+    int start = parser->position + 1;
+    int end = start;
+    int buffer_length = 0;
+    char *buffer;
+
+    while (end < parser->length && parser->input[end] != '"') {
+        if (parser->input[end] == '\\') {
+            end++;
+            if (end >= parser->length) {
+                JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX, "Unterminated escape sequence");
+                return -1;
+            }
+
+            if (parser->input[end] == 'u') {
+                // Handle \uXXXX Unicode escape sequences
+                end++;
+                if (end + 3 >= parser->length) {
+                    JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX, "Incomplete Unicode escape sequence");
+                    return -1;
+                }
+
+                // Parse 4 hex digits
+                unsigned int code_point = 0;
+                for (int i = 0; i < 4; i++) {
+                    char c = parser->input[end + i];
+                    code_point <<= 4;
+
+                    if (c >= '0' && c <= '9') {
+                        code_point |= (c - '0');
+                    } else if (c >= 'a' && c <= 'f') {
+                        code_point |= (c - 'a' + 10);
+                    } else if (c >= 'A' && c <= 'F') {
+                        code_point |= (c - 'A' + 10);
+                    } else {
+                        JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX, "Invalid hex digit in Unicode escape");
+                        return -1;
+                    }
+                }
+
+                // Check for surrogate pair
+                if (code_point >= 0xD800 && code_point <= 0xDBFF) {
+                    // High surrogate - need to get the low surrogate
+                    end += 4; // Move past the first \uXXXX
+
+                    // Check for the sequence \uYYYY where YYYY is the low surrogate
+                    if (end + 1 >= parser->length || parser->input[end] != '\\' || parser->input[end + 1] != 'u') {
+                        JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX, "Expected low surrogate after high surrogate");
+                        return -1;
+                    }
+
+                    end += 2; // Move past \u
+                    if (end + 3 >= parser->length) {
+                        JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX,
+                                          "Incomplete Unicode escape sequence for low surrogate");
+                        return -1;
+                    }
+
+                    // Parse 4 hex digits for low surrogate
+                    unsigned int low_surrogate = 0;
+                    for (int i = 0; i < 4; i++) {
+                        char c = parser->input[end + i];
+                        low_surrogate <<= 4;
+
+                        if (c >= '0' && c <= '9') {
+                            low_surrogate |= (c - '0');
+                        } else if (c >= 'a' && c <= 'f') {
+                            low_surrogate |= (c - 'a' + 10);
+                        } else if (c >= 'A' && c <= 'F') {
+                            low_surrogate |= (c - 'A' + 10);
+                        } else {
+                            JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX, "Invalid hex digit in low surrogate");
+                            return -1;
+                        }
+                    }
+
+                    // Validate low surrogate range
+                    if (low_surrogate < 0xDC00 || low_surrogate > 0xDFFF) {
+                        JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX, "Invalid low surrogate value");
+                        return -1;
+                    }
+
+                    // Combine surrogate pair to get actual code point
+                    code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low_surrogate - 0xDC00);
+                    end += 4; // Move past the second \uXXXX
+                } else {
+                    end += 4; // Move past \uXXXX for non-surrogate case
+                }
+
+                // Encode code point as UTF-8
+                if (code_point < 0x80) {
+                    // 1-byte character
+                    if (json__parser_reserve_scratch(parser, buffer_length + 1) != 0)
+                        return -1;
+                    parser->scratch[buffer_length++] = (char) code_point;
+                } else if (code_point < 0x800) {
+                    // 2-byte character
+                    if (json__parser_reserve_scratch(parser, buffer_length + 2) != 0)
+                        return -1;
+                    parser->scratch[buffer_length++] = (char) (0xC0 | (code_point >> 6));
+                    parser->scratch[buffer_length++] = (char) (0x80 | (code_point & 0x3F));
+                } else if (code_point < 0x10000) {
+                    // 3-byte character
+                    if (json__parser_reserve_scratch(parser, buffer_length + 3) != 0)
+                        return -1;
+                    parser->scratch[buffer_length++] = (char) (0xE0 | (code_point >> 12));
+                    parser->scratch[buffer_length++] = (char) (0x80 | ((code_point >> 6) & 0x3F));
+                    parser->scratch[buffer_length++] = (char) (0x80 | (code_point & 0x3F));
+                } else {
+                    // 4-byte character
+                    if (json__parser_reserve_scratch(parser, buffer_length + 4) != 0)
+                        return -1;
+                    parser->scratch[buffer_length++] = (char) (0xF0 | (code_point >> 18));
+                    parser->scratch[buffer_length++] = (char) (0x80 | ((code_point >> 12) & 0x3F));
+                    parser->scratch[buffer_length++] = (char) (0x80 | ((code_point >> 6) & 0x3F));
+                    parser->scratch[buffer_length++] = (char) (0x80 | (code_point & 0x3F));
+                }
+
+                continue; // Skip the increment at the end of the loop
+            } else {
+                // Handle standard escape sequences
+                char escaped_char;
+                switch (parser->input[end]) {
+                case '"':
+                    escaped_char = '"';
+                    break;
+                case '\\':
+                    escaped_char = '\\';
+                    break;
+                case '/':
+                    escaped_char = '/';
+                    break;
+                case 'b':
+                    escaped_char = '\b';
+                    break;
+                case 'f':
+                    escaped_char = '\f';
+                    break;
+                case 'n':
+                    escaped_char = '\n';
+                    break;
+                case 'r':
+                    escaped_char = '\r';
+                    break;
+                case 't':
+                    escaped_char = '\t';
+                    break;
+                default:
+                    JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX, "Invalid escape character");
+                    return -1;
+                }
+
+                if (json__parser_reserve_scratch(parser, buffer_length + 1) != 0)
+                    return -1;
+
+                parser->scratch[buffer_length++] = escaped_char;
+            }
+        } else {
+            if (json__parser_reserve_scratch(parser, buffer_length + 1) != 0)
+                return -1;
+
+            parser->scratch[buffer_length++] = parser->input[end];
+        }
+        end++;
+    }
+
+    if (end == parser->length) {
+        JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX, "Unterminated string");
+        return -1;
+    }
+
+    // The string is decoded into the parser's scratch space and copied out
+    // once, so its final block is allocated at its exact size
+    buffer = (char *) (key ? json__alloc_as(JSON_STATS_KEY, buffer_length + 1)
+                           : json__alloc_as(JSON_STATS_STRING, buffer_length + 1));
+    if (buffer == NULL) {
+        JSON_PARSER_ERROR(parser, JSON_ERROR_MEMORY, "Memory allocation failed");
+        return -1;
+    }
+
+    memcpy(buffer, parser->scratch, buffer_length);
+    buffer[buffer_length] = 0;
+
+    value->type = JSON_TYPE_STRING;
+    value->string.value = buffer;
+    value->string.length = buffer_length;
+    value->string.capacity = buffer_length + 1;
+
+    parser->position = end + 1;
+    return 0;
+}
+
+static void json__parser_consume_digits(struct json_parser *parser)
+{
+    while (parser->position < parser->length && parser->input[parser->position] >= '0'
+           && parser->input[parser->position] <= '9') {
+        parser->position++;
+    }
+}
+
+static int json__decode_number(struct json_parser *parser, struct json_value *value)
+{
+    int start = parser->position, length;
+    char small[64], *digits;
+    char *endptr;
+
+    if (parser->position < parser->length && parser->input[parser->position] == '-')
+        parser->position++;
+
+    if (parser->position < parser->length && parser->input[parser->position] == '0') {
+        parser->position++;
+    } else if (parser->position < parser->length && parser->input[parser->position] >= '1'
+               && parser->input[parser->position] <= '9') {
+        json__parser_consume_digits(parser);
+    } else {
+        JSON_PARSER_ERROR(parser, JSON_ERROR_INVALID_NUMBER, "Invalid number");
+        return -1;
+    }
+
+    if (parser->position < parser->length && parser->input[parser->position] == '.') {
+        parser->position++;
+        if (parser->position < parser->length && parser->input[parser->position] >= '0'
+            && parser->input[parser->position] <= '9') {
+            json__parser_consume_digits(parser);
+        } else {
+            JSON_PARSER_ERROR(parser, JSON_ERROR_INVALID_NUMBER, "Invalid number");
+            return -1;
+        }
+    }
+
+    if (parser->position < parser->length
+        && (parser->input[parser->position] == 'e' || parser->input[parser->position] == 'E')) {
+        parser->position++;
+        if (parser->position < parser->length
+            && (parser->input[parser->position] == '-' || parser->input[parser->position] == '+')) {
+            parser->position++;
+        }
+        if (parser->position < parser->length && parser->input[parser->position] >= '0'
+            && parser->input[parser->position] <= '9') {
+            json__parser_consume_digits(parser);
+        } else {
+            JSON_PARSER_ERROR(parser, JSON_ERROR_INVALID_NUMBER, "Invalid number");
+            return -1;
+        }
+    }
+
+    if (start == parser->position) {
+        JSON_PARSER_ERROR(parser, JSON_ERROR_INVALID_NUMBER, "Invalid number");
+        return -1;
+    }
+
+    // The input need not end right after the number, as when decoding a slice
+    // of a larger buffer, so strtod reads a terminated copy of it
+    length = parser->position - start;
+    if (length < (int) sizeof(small))
+        digits = small;
+    else if (json__parser_reserve_scratch(parser, length + 1) == 0)
+        digits = parser->scratch;
+    else
+        return -1;
+
+    memcpy(digits, parser->input + start, length);
+    digits[length] = '\0';
+
+    value->type = JSON_TYPE_NUMBER;
+    endptr = NULL;
+    value->number = strtod(digits, &endptr);
+
+    if (endptr != digits + length) {
+        JSON_PARSER_ERROR(parser, JSON_ERROR_INVALID_NUMBER, "Invalid number");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int json__decode_array(struct json_parser *parser, struct json_value *array)
+{
+    int base = parser->stack_length, count;
+#if defined(JSON_NUMBER_ARRAYS)
+    int numbers_base = parser->numbers_length, packed = 1;
+#endif
+
+    if (parser->length - parser->position < 1) {
+        JSON_PARSER_ERROR(parser, JSON_ERROR_EOF, "Unexpected end of input");
+        return -1;
+    }
+
+    if (parser->input[parser->position] != '[') {
+        JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX, "Expected '['");
+        return -1;
+    }
+
+    array->type = JSON_TYPE_ARRAY;
+    json_array_init(array);
+
+    parser->position += 1; // Skip '['
+    json__parse_whitespace(parser);
+
+    // Whitespace alone, as in "[ ]", is still an empty array
+    if (parser->position < parser->length && parser->input[parser->position] == ']') {
+        parser->position++;
+        return 0;
+    }
+
+    while (parser->position < parser->length && parser->input[parser->position] != ']') {
+        json__parse_whitespace(parser);
+
+#if defined(JSON_NUMBER_ARRAYS)
+        if (packed && parser->position < parser->length
+            && (parser->input[parser->position] == '-'
+                || (parser->input[parser->position] >= '0' && parser->input[parser->position] <= '9'))) {
+            struct json_value number;
+
+            if (json__decode_number(parser, &number) != 0)
+                goto fail;
+
+            if (json__parser_push_number(parser, number.number) != 0) {
+                JSON_PARSER_ERROR(parser, JSON_ERROR_MEMORY, "Memory allocation failed");
+                goto fail;
+            }
+
+            json__parse_whitespace(parser);
+            if (parser->position < parser->length && parser->input[parser->position] == ',') // Skip ','
+                parser->position++;
+            continue;
+        }
+
+        // Not a number after all, the array is built from nodes
+        if (packed) {
+            packed = 0;
+            if (json__parser_spill_numbers(parser, numbers_base) != 0) {
+                JSON_PARSER_ERROR(parser, JSON_ERROR_MEMORY, "Memory allocation failed");
+                goto fail;
+            }
+        }
+#endif
+
+        struct json_value *item;
+        if ((item = json__value_alloc()) == NULL) {
+            JSON_PARSER_ERROR(parser, JSON_ERROR_MEMORY, "Memory allocation failed");
+            goto fail;
+        }
+
+        if (json__decode_value(parser, item) != 0) {
+            json__free_as(JSON_STATS_NODE, item);
+            goto fail;
+        }
+
+        if (json__parser_push(parser, item) != 0) {
+            json_free(item);
+            JSON_PARSER_ERROR(parser, JSON_ERROR_MEMORY, "Memory allocation failed");
+            goto fail;
+        }
+
+        json__parse_whitespace(parser);
+
+        if (parser->position < parser->length && parser->input[parser->position] == ',') // Skip ','
+            parser->position++;
+    }
+
+    if (parser->position >= parser->length || parser->input[parser->position] != ']') {
+        JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX, "Expected closing ']' for array");
+        goto fail;
+    }
+
+#if defined(JSON_NUMBER_ARRAYS)
+    if (packed && (count = parser->numbers_length - numbers_base) > 0) {
+        if ((array->array.numbers = (double *) json__alloc_as(JSON_STATS_ITEMS, count * sizeof(double))) == NULL) {
+            JSON_PARSER_ERROR(parser, JSON_ERROR_MEMORY, "Memory allocation failed");
+            goto fail;
+        }
+
+        memcpy(array->array.numbers, parser->numbers + numbers_base, count * sizeof(double));
+        array->type = JSON_TYPE_NUMBER_ARRAY;
+        array->array.length = array->array.capacity = count;
+        parser->numbers_length = numbers_base;
+    }
+#endif
+
+    // The element count is known now, so the items are allocated exactly once
+    if ((count = parser->stack_length - base) > 0) {
+        array->array.items = (struct json_value **) json__alloc_as(JSON_STATS_ITEMS,
+                                                                   count * sizeof(struct json_value *));
+        if (array->array.items == NULL) {
+            JSON_PARSER_ERROR(parser, JSON_ERROR_MEMORY, "Memory allocation failed");
+            goto fail;
+        }
+
+        memcpy(array->array.items, parser->stack + base, count * sizeof(struct json_value *));
+        array->array.length = array->array.capacity = count;
+        parser->stack_length = base;
+    }
+
+    if (parser->position < parser->length) // Skip ']'
+        parser->position++;
+    return 0;
+
+fail:
+#if defined(JSON_NUMBER_ARRAYS)
+    parser->numbers_length = numbers_base;
+#endif
+    while (parser->stack_length > base)
+        json_free((struct json_value *) parser->stack[--parser->stack_length]);
+    return -1;
+}
+
+static int json__decode_object(struct json_parser *parser, struct json_value *object)
+{
+    int base = parser->stack_length, count;
+
+    object->type = JSON_TYPE_OBJECT;
+    json_object_init(object);
+
+    parser->position++;
+    json__parse_whitespace(parser);
+
+    while (parser->position < parser->length && parser->input[parser->position] != '}') {
+        struct json_value key, *value;
+        struct json_object_entry *entry = NULL;
+        json__parse_whitespace(parser);
+
+        if (parser->input[parser->position] != '"') {
+            JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX, "Expected string key");
+            goto fail;
+        }
+
+        if (json__decode_string(parser, &key, 1) != 0) {
+            JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX, "Failed to parse string key");
+            goto fail;
+        }
+
+        json__parse_whitespace(parser);
+        if (parser->position >= parser->length || parser->input[parser->position] != ':') {
+            json__free_as(JSON_STATS_KEY, key.string.value);
+            JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX, "Expected ':' after string key");
+            goto fail;
+        }
+        parser->position++; // Skip the colon
+
+        value = json__value_alloc();
+        if (value == NULL) {
+            json__free_as(JSON_STATS_KEY, key.string.value);
+            JSON_PARSER_ERROR(parser, JSON_ERROR_MEMORY, "Failed to allocate memory for JSON item");
+            goto fail;
+        }
+
+        json__parse_whitespace(parser);
+        if (json__decode_value(parser, value) != 0) {
+            json__free_as(JSON_STATS_NODE, value);
+            json__free_as(JSON_STATS_KEY, key.string.value);
+            JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX, "Failed to parse JSON value");
+            goto fail;
+        }
+
+        // A repeated key keeps its first position and takes the last value, like json_object_set
+        for (int i = base; i < parser->stack_length; i++) {
+            struct json_object_entry *other = (struct json_object_entry *) parser->stack[i];
+            if (other->key_length == key.string.length && memcmp(other->key, key.string.value, key.string.length) == 0) {
+                entry = other;
+                break;
+            }
+        }
+
+        if (entry != NULL) {
+            json_free(entry->value);
+            json__free_as(JSON_STATS_KEY, key.string.value);
+            entry->value = value;
+        } else if ((entry = (struct json_object_entry *) json__alloc_as(JSON_STATS_KEY, sizeof(*entry))) == NULL
+                   || json__parser_push(parser, entry) != 0) {
+            json__free_as(JSON_STATS_KEY, entry);
+            json_free(value);
+            json__free_as(JSON_STATS_KEY, key.string.value);
+            JSON_PARSER_ERROR(parser, JSON_ERROR_MEMORY, "Failed to set key-value pair in object");
+            goto fail;
+        } else {
+            // The decoded key buffer is moved into the entry, not copied
+            entry->key = key.string.value;
+            entry->key_length = key.string.length;
+            entry->value = value;
+        }
+
+        json__parse_whitespace(parser);
+        if (parser->position < parser->length && parser->input[parser->position] == ',')
+            parser->position++; // Skip comma or closing brace
+    }
+
+    if (parser->position >= parser->length || parser->input[parser->position] != '}') {
+        JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX, "Expected '}' after JSON object");
+        goto fail;
+    }
+
+    if ((count = parser->stack_length - base) > 0) {
+        object->object.items = (struct json_object_entry **) json__alloc_as(JSON_STATS_ITEMS,
+                                                                            count * sizeof(struct json_object_entry *));
+        if (object->object.items == NULL) {
+            JSON_PARSER_ERROR(parser, JSON_ERROR_MEMORY, "Failed to allocate memory for JSON object");
+            goto fail;
+        }
+
+        memcpy(object->object.items, parser->stack + base, count * sizeof(struct json_object_entry *));
+        object->object.n_items = object->object.capacity = count;
+        parser->stack_length = base;
+    }
+
+    parser->position++; // Skip the closing brace
+
+    return 0;
+
+fail:
+    while (parser->stack_length > base) {
+        struct json_object_entry *entry = (struct json_object_entry *) parser->stack[--parser->stack_length];
+        json_free(entry->value);
+        json__free_as(JSON_STATS_KEY, entry->key);
+        json__free_as(JSON_STATS_KEY, entry);
+    }
+    return -1;
+}
+
+// Inputs may be slices of a larger buffer, so nothing is read past `length`
+static int json__parser_literal(const struct json_parser *parser, const char *literal, int length)
+{
+    return parser->length - parser->position >= length
+        && memcmp(parser->input + parser->position, literal, length) == 0;
+}
+
+static int json__decode_value(struct json_parser *parser, struct json_value *value)
+{
+    int rc;
+    char c;
+
+    if (parser->position >= parser->length) {
+        JSON_PARSER_ERROR(parser, JSON_ERROR_EOF, "Unexpected end of input");
+        return -1;
+    }
+
+    c = parser->input[parser->position];
+
+    if (c == '"') {
+        rc = json__decode_string(parser, value, 0);
+    } else if (c == '[') {
+        rc = json__decode_array(parser, value);
+    } else if (c == '{') {
+        rc = json__decode_object(parser, value);
+    } else if (json__parser_literal(parser, "true", 4)) {
+        value->type = JSON_TYPE_BOOLEAN;
+        value->number = 1;
+        parser->position += 4;
+        rc = 0;
+    } else if (json__parser_literal(parser, "false", 5)) {
+        value->type = JSON_TYPE_BOOLEAN;
+        value->number = 0;
+        parser->position += 5;
+        rc = 0;
+    } else if (json__parser_literal(parser, "null", 4)) {
+        value->type = JSON_TYPE_NULL;
+        parser->position += 4;
+        rc = 0;
+    } else {
+        rc = json__decode_number(parser, value);
+    }
+
+#if defined(JSON_ERROR)
+    if (rc != 0 && parser->error.code == JSON_ERROR_NONE) {
+        JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX, "Expected value");
+    }
+#endif
+
+    if (rc == 0)
+        JSON__STATS_NODE(value->type);
+    return rc;
+}
+
+static void json__parser_ctx_release(struct json_parser_ctx *ctx)
+{
+    json__free(ctx->stack);
+    json__free(ctx->scratch);
+#if defined(JSON_NUMBER_ARRAYS)
+    json__free(ctx->numbers);
+#endif
+}
+
+JSON_API struct json_parser_ctx *json_parser_ctx_new(void)
+{
+    struct json_parser_ctx *ctx = (struct json_parser_ctx *) json_alloc(sizeof(struct json_parser_ctx));
+
+    if (ctx != NULL)
+        memset(ctx, 0, sizeof(*ctx));
+    return ctx;
+}
+
+JSON_API void json_parser_ctx_free(struct json_parser_ctx *ctx)
+{
+    if (ctx == NULL)
+        return;
+
+    json__parser_ctx_release(ctx);
+    json__free(ctx);
+}
+
+static struct json_value *json__ctx_decode(struct json_parser_ctx *ctx, const char *json, int length,
+                                           enum json_error *error)
+{
+    struct json_parser parser;
+    struct json_value *value = NULL;
+    int status;
+
+    parser.input = json;
+    parser.length = length;
+    parser.position = 0;
+    parser.stack = ctx->stack;
+    parser.stack_length = 0;
+    parser.stack_capacity = ctx->stack_capacity;
+    parser.scratch = ctx->scratch;
+    parser.scratch_capacity = ctx->scratch_capacity;
+#if defined(JSON_NUMBER_ARRAYS)
+    parser.numbers = ctx->numbers;
+    parser.numbers_length = 0;
+    parser.numbers_capacity = ctx->numbers_capacity;
+#endif
+
+#if defined(JSON_ERROR)
+    parser.error.code = JSON_ERROR_NONE;
+    parser.error.message = NULL;
+#endif
+
+    if ((value = json__value_alloc()) == NULL) {
+        *error = JSON_ERROR_MEMORY;
+        return NULL;
+    }
+
+    status = json__decode_value(&parser, value);
+
+    // The scratch space may have grown, keep it for the next call
+    ctx->stack = parser.stack;
+    ctx->stack_capacity = parser.stack_capacity;
+    ctx->scratch = parser.scratch;
+    ctx->scratch_capacity = parser.scratch_capacity;
+#if defined(JSON_NUMBER_ARRAYS)
+    ctx->numbers = parser.numbers;
+    ctx->numbers_capacity = parser.numbers_capacity;
+#endif
+
+    if (status != 0) {
+#if defined(JSON_ERROR) && !defined(JSON_ERROR_HANDLER)
+        if (parser.error.code != JSON_ERROR_NONE) {
+            fprintf(stderr, "JSON(\033[1merror\033[m): %s:%d %s at\n", parser.error.func, parser.error.line,
+                    parser.error.message);
+        }
+#elif defined(JSON_ERROR) && defined(JSON_ERROR_HANDLER)
+        if (parser.error.code != JSON_ERROR_NONE) {
+            JSON_ERROR_HANDLER(parser.error.code, parser.error.message);
+        }
+#endif
+#if defined(JSON_ERROR)
+        *error = parser.error.code != JSON_ERROR_NONE ? parser.error.code : JSON_ERROR_SYNTAX;
+#else
+        *error = JSON_ERROR_UNKNOWN;
+#endif
+        json__free_as(JSON_STATS_NODE, value);
+        return NULL;
+    }
+
+    *error = JSON_ERROR_NONE;
+    return value;
+}
+
+JSON_API struct json_value *json_ctx_decode(struct json_parser_ctx *ctx, const char *json, int length)
+{
+    enum json_error error;
+
+    return json__ctx_decode(ctx, json, length, &error);
+}
+
+struct json_value *json_decode_with_length(const char *json, int length)
+{
+    struct json_parser_ctx ctx;
+    struct json_value *value;
+
+    memset(&ctx, 0, sizeof(ctx));
+    value = json_ctx_decode(&ctx, json, length);
+    json__parser_ctx_release(&ctx);
+    return value;
+}
+
+struct json_value *json_decode(const char *json)
+{
+    return json_decode_with_length(json, json__strlen(json));
+}
+
+// Work left to a batch worker, on its own cache line as every claim writes it
+struct json__batch_range
+{
+    unsigned long long range; // First document in the low half, end in the high half
+    char padding[64 - sizeof(unsigned long long)];
+};
+
+struct json__batch
+{
+    const char *const *bufs;
+    const int *lens;
+    struct json_value **out;
+    enum json_error *errors;
+    struct json__batch_range *ranges;
+    int workers;
+    int grain;
+    int next_worker;
+    int failures;
+};
+
+#define JSON__BATCH_RANGE(BEGIN, END) (((unsigned long long) (END) << 32) | (unsigned int) (BEGIN))
+#define JSON__BATCH_BEGIN(RANGE) ((int) ((RANGE) & 0xffffffffu))
+#define JSON__BATCH_END(RANGE) ((int) ((RANGE) >> 32))
+
+// Takes up to `grain` documents from the front of a worker's own range
+static int json__batch_claim(struct json__batch *batch, int self, int *begin, int *end)
+{
+    unsigned long long *slot = &batch->ranges[self].range;
+    unsigned long long range;
+    int first, last;
+
+    do {
+        range = JSON__ATOMIC_LOAD_64(slot);
+        first = JSON__BATCH_BEGIN(range);
+        last = JSON__BATCH_END(range);
+        if (first >= last)
+            return 0;
+        *begin = first;
+        *end = last - first > batch->grain ? first + batch->grain : last;
+    } while (!JSON__ATOMIC_CAS_64(slot, range, JSON__BATCH_RANGE(*end, last)));
+
+    return 1;
+}
+
+// Moves the back half of another worker's range into the empty range of `self`
+static int json__batch_steal(struct json__batch *batch, int self)
+{
+    for (int i = 1; i < batch->workers; i++) {
+        unsigned long long *slot = &batch->ranges[(self + i) % batch->workers].range;
+        unsigned long long range, own;
+        int first, last, split;
+
+        do {
+            range = JSON__ATOMIC_LOAD_64(slot);
+            first = JSON__BATCH_BEGIN(range);
+            last = JSON__BATCH_END(range);
+            if (first >= last)
+                break;
+            split = last - (last - first + 1) / 2;
+        } while (!JSON__ATOMIC_CAS_64(slot, range, JSON__BATCH_RANGE(first, split)));
+
+        if (first >= last)
+            continue;
+
+        // Thieves leave empty ranges alone, so only this worker writes its own
+        own = JSON__ATOMIC_LOAD_64(&batch->ranges[self].range);
+        JSON__ATOMIC_CAS_64(&batch->ranges[self].range, own, JSON__BATCH_RANGE(split, last));
+        return 1;
+    }
+
+    return 0;
+}
+
+static void json__batch_worker(void *arg)
+{
+    struct json__batch *batch = (struct json__batch *) arg;
+    struct json_parser_ctx ctx;
+    int self = JSON__ATOMIC_INC(&batch->next_worker) - 1;
+    int begin, end;
+
+    if (self >= batch->workers)
+        return;
+
+    memset(&ctx, 0, sizeof(ctx));
+    for (;;) {
+        if (!json__batch_claim(batch, self, &begin, &end)) {
+            if (!json__batch_steal(batch, self))
+                break;
+            continue;
+        }
+
+        for (int i = begin; i < end; i++) {
+            int length = batch->lens != NULL ? batch->lens[i] : json__strlen(batch->bufs[i]);
+            enum json_error error;
+
+            if ((batch->out[i] = json__ctx_decode(&ctx, batch->bufs[i], length, &error)) == NULL)
+                JSON__ATOMIC_INC(&batch->failures);
+            if (batch->errors != NULL)
+                batch->errors[i] = error;
+        }
+    }
+    json__parser_ctx_release(&ctx);
+}
+
+#if defined(JSON_THREADS)
+struct json__thread_start
+{
+    void (*task)(void *);
+    void *arg;
+};
+
+static void *json__thread_main(void *arg)
+{
+    struct json__thread_start *start = (struct json__thread_start *) arg;
+
+    start->task(start->arg);
+    return NULL;
+}
+
+static int json__cpu_count(void)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return count > 0 ? (int) count : 1;
+}
+
+// Runs the workers on threads started for this call alone
+static void json__threads_run(void (*task)(void *), void *arg, int count)
+{
+    pthread_t *threads = (pthread_t *) json_alloc(sizeof(pthread_t) * (count - 1));
+    struct json__thread_start start;
+    int started = 0;
+
+    start.task = task;
+    start.arg = arg;
+
+    // Workers that fail to start are harmless, the others steal their share
+    if (threads != NULL) {
+        while (started < count - 1 && pthread_create(&threads[started], NULL, json__thread_main, &start) == 0)
+            started++;
+    }
+
+    task(arg);
+    while (started > 0)
+        pthread_join(threads[--started], NULL);
+    json__free(threads);
+}
+
+struct json_pool
+{
+    pthread_mutex_t lock;
+    pthread_cond_t wake; // Signalled when a job is submitted or the pool stops
+    pthread_cond_t idle; // Signalled when a job finishes
+    pthread_t *threads;
+    int size;
+    void (*task)(void *);
+    void *arg;
+    int pending; // Invocations of the current job not started yet
+    int running; // Invocations of the current job not finished yet
+    int busy;
+    int stop;
+};
+
+// Runs one pending invocation, called and returns with the lock held
+static void json__pool_step(struct json_pool *pool)
+{
+    void (*task)(void *) = pool->task;
+    void *arg = pool->arg;
+
+    pool->pending--;
+    pthread_mutex_unlock(&pool->lock);
+    task(arg);
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->running == 0)
+        pthread_cond_broadcast(&pool->idle);
+}
+
+static void *json__pool_main(void *arg)
+{
+    struct json_pool *pool = (struct json_pool *) arg;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->pending == 0 && !pool->stop)
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        if (pool->pending == 0)
+            break;
+        json__pool_step(pool);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+JSON_API struct json_pool *json_pool_new(int threads)
+{
+    struct json_pool *pool;
+
+    if (threads <= 0)
+        threads = json__cpu_count() - 1;
+
+    if ((pool = (struct json_pool *) json_alloc(sizeof(struct json_pool))) == NULL)
+        return NULL;
+
+    memset(pool, 0, sizeof(*pool));
+    if (threads > 0 && (pool->threads = (pthread_t *) json_alloc(sizeof(pthread_t) * threads)) == NULL) {
+        json__free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+
+    for (; pool->size < threads; pool->size++) {
+        if (pthread_create(&pool->threads[pool->size], NULL, json__pool_main, pool) != 0) {
+            json_pool_free(pool);
+            return NULL;
+        }
+    }
+
+    return pool;
+}
+
+JSON_API void json_pool_free(struct json_pool *pool)
+{
+    if (pool == NULL)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->size; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->idle);
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+    json__free(pool->threads);
+    json__free(pool);
+}
+
+JSON_API void json_pool_run(void *executor, void (*task)(void *), void *arg, int count)
+{
+    struct json_pool *pool = (struct json_pool *) executor;
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy)
+        pthread_cond_wait(&pool->idle, &pool->lock);
+
+    pool->busy = 1;
+    pool->task = task;
+    pool->arg = arg;
+    pool->pending = count;
+    pool->running = count;
+    pthread_cond_broadcast(&pool->wake);
+
+    // The submitting thread works too instead of only waiting
+    while (pool->pending > 0)
+        json__pool_step(pool);
+    while (pool->running > 0)
+        pthread_cond_wait(&pool->idle, &pool->lock);
+
+    pool->busy = 0;
+    pthread_cond_broadcast(&pool->idle);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Bounded single-producer single-consumer queue of pointers
+struct json__ring
+{
+    void **slots;
+    unsigned int mask;
+    unsigned int head; // Next slot to pop, written by the consumer only
+    char padding[64];
+    unsigned int tail; // Next slot to push, written by the producer only
+    int waiting;       // Threads blocked on `cond`, only changed under `lock`
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+struct json__pipeline_buffer
+{
+    char *data;
+    int length; // Bytes read, 0 at the end of the input, -1 after a read error
+};
+
+struct json__pipeline
+{
+    json_read_fn read;
+    void *source;
+    int buffer_size;
+    struct json__ring free;   // Empty buffers, parser to reader
+    struct json__ring filled; // Read buffers, reader to parser
+    struct json__ring values; // Decoded documents, parser to consumer
+    int stop;
+    int status;
+};
+
+static int json__ring_init(struct json__ring *ring, int capacity)
+{
+    unsigned int size = 1;
+
+    while (size < (unsigned int) capacity)
+        size *= 2;
+
+    memset(ring, 0, sizeof(*ring));
+    if ((ring->slots = (void **) json_alloc(sizeof(void *) * size)) == NULL)
+        return -1;
+
+    ring->mask = size - 1;
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->cond, NULL);
+    return 0;
+}
+
+static void json__ring_destroy(struct json__ring *ring)
+{
+    if (ring->slots == NULL)
+        return;
+
+    pthread_cond_destroy(&ring->cond);
+    pthread_mutex_destroy(&ring->lock);
+    json__free(ring->slots);
+}
+
+static int json__ring_ready(struct json__ring *ring, int for_push)
+{
+    unsigned int head = JSON__ATOMIC_LOAD_SC(&ring->head);
+    unsigned int tail = JSON__ATOMIC_LOAD_SC(&ring->tail);
+
+    return for_push ? tail - head <= ring->mask : tail != head;
+}
+
+// Blocks until the ring has room (or an item) or the pipeline stops
+static void json__ring_wait(struct json__ring *ring, int for_push, const int *stop)
+{
+    // The other side is usually busy for a moment only, spin before sleeping
+    for (int i = 0; i < 1000; i++) {
+        if (json__ring_ready(ring, for_push) || JSON__ATOMIC_LOAD(stop))
+            return;
+    }
+
+    // Both sides store then load with sequential consistency: either this
+    // thread sees the update, or the other side sees `waiting` and signals
+    pthread_mutex_lock(&ring->lock);
+    JSON__ATOMIC_STORE_SC(&ring->waiting, ring->waiting + 1);
+    while (!json__ring_ready(ring, for_push) && !JSON__ATOMIC_LOAD(stop))
+        pthread_cond_wait(&ring->cond, &ring->lock);
+    JSON__ATOMIC_STORE_SC(&ring->waiting, ring->waiting - 1);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+static void json__ring_wake(struct json__ring *ring)
+{
+    if (JSON__ATOMIC_LOAD_SC(&ring->waiting) > 0) {
+        pthread_mutex_lock(&ring->lock);
+        pthread_cond_broadcast(&ring->cond);
+        pthread_mutex_unlock(&ring->lock);
+    }
+}
+
+static int json__ring_push(struct json__ring *ring, void *item, const int *stop)
+{
+    while (!json__ring_ready(ring, 1)) {
+        if (JSON__ATOMIC_LOAD(stop))
+            return -1;
+        json__ring_wait(ring, 1, stop);
+    }
+
+    ring->slots[ring->tail & ring->mask] = item;
+    JSON__ATOMIC_STORE_SC(&ring->tail, ring->tail + 1);
+    json__ring_wake(ring);
+    return 0;
+}
+
+static int json__ring_pop(struct json__ring *ring, void **item, const int *stop)
+{
+    while (!json__ring_ready(ring, 0)) {
+        if (JSON__ATOMIC_LOAD(stop))
+            return -1;
+        json__ring_wait(ring, 0, stop);
+    }
+
+    *item = ring->slots[ring->head & ring->mask];
+    JSON__ATOMIC_STORE_SC(&ring->head, ring->head + 1);
+    json__ring_wake(ring);
+    return 0;
+}
+
+static void json__pipeline_stop(struct json__pipeline *pipeline)
+{
+    struct json__ring *rings[3];
+
+    rings[0] = &pipeline->free;
+    rings[1] = &pipeline->filled;
+    rings[2] = &pipeline->values;
+
+    JSON__ATOMIC_STORE_SC(&pipeline->stop, 1);
+    for (int i = 0; i < 3; i++) {
+        pthread_mutex_lock(&rings[i]->lock);
+        pthread_cond_broadcast(&rings[i]->cond);
+        pthread_mutex_unlock(&rings[i]->lock);
+    }
+}
+
+static void *json__pipeline_reader(void *arg)
+{
+    struct json__pipeline *pipeline = (struct json__pipeline *) arg;
+    void *item;
+
+    while (json__ring_pop(&pipeline->free, &item, &pipeline->stop) == 0) {
+        struct json__pipeline_buffer *buffer = (struct json__pipeline_buffer *) item;
+
+        buffer->length = pipeline->read(pipeline->source, buffer->data, pipeline->buffer_size);
+        if (buffer->length < 0)
+            buffer->length = -1;
+        if (json__ring_push(&pipeline->filled, buffer, &pipeline->stop) != 0 || buffer->length <= 0)
+            break;
+    }
+
+    return NULL;
+}
+
+// Where the parser is within the top-level value it is splitting off
+struct json__pipeline_scan
+{
+    int in_value;
+    int depth;
+    int in_string;
+    int escape;
+    int scalar; // Numbers and literals end at whitespace or the next value
+    char *carry; // Start of a value continued from previous buffers
+    int carry_length;
+    int carry_capacity;
+};
+
+static int json__pipeline_carry(struct json__pipeline_scan *scan, const char *data, int length)
+{
+    if (scan->carry_length + length > scan->carry_capacity) {
+        int capacity = scan->carry_capacity > 0 ? scan->carry_capacity : 256;
+        char *carry;
+
+        while (capacity < scan->carry_length + length)
+            capacity *= 2;
+        if ((carry = (char *) json_realloc(scan->carry, capacity)) == NULL)
+            return -1;
+        scan->carry = carry;
+        scan->carry_capacity = capacity;
+    }
+
+    memcpy(scan->carry + scan->carry_length, data, (size_t) length);
+    scan->carry_length += length;
+    return 0;
+}
+
+// Decodes a finished value and hands it on, `data` is NULL if it was carried over
+static int json__pipeline_emit(struct json__pipeline *pipeline, struct json__pipeline_scan *scan,
+                               struct json_parser_ctx *ctx, const char *data, int length)
+{
+    struct json_value *value;
+    enum json_error error;
+
+    if (scan->carry_length > 0) {
+        if (json__pipeline_carry(scan, data, length) != 0)
+            return -1;
+        data = scan->carry;
+        length = scan->carry_length;
+        scan->carry_length = 0;
+    }
+
+    scan->in_value = 0;
+    if ((value = json__ctx_decode(ctx, data, length, &error)) == NULL)
+        return -1;
+
+    if (json__ring_push(&pipeline->values, value, &pipeline->stop) != 0) {
+        json_free(value);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int json__pipeline_split(struct json__pipeline *pipeline, struct json__pipeline_scan *scan,
+                                 struct json_parser_ctx *ctx, const char *data, int length)
+{
+    int start = 0;
+
+    for (int i = 0; i < length; i++) {
+        char c = data[i];
+
+        if (!scan->in_value) {
+            if (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+                continue;
+
+            start = i;
+            scan->in_value = 1;
+            scan->depth = 0;
+            scan->scalar = 0;
+            if (c == '"') {
+                scan->in_string = 1;
+            } else if (c == '{' || c == '[') {
+                scan->depth = 1;
+            } else {
+                scan->scalar = 1;
+            }
+            continue;
+        }
+
+        if (scan->in_string) {
+            if (scan->escape) {
+                scan->escape = 0;
+            } else if (c == '\\') {
+                scan->escape = 1;
+            } else if (c == '"') {
+                scan->in_string = 0;
+                if (scan->depth == 0 && json__pipeline_emit(pipeline, scan, ctx, data + start, i + 1 - start) != 0)
+                    return -1;
+            }
+        } else if (scan->scalar) {
+            if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '"' || c == '{' || c == '[') {
+                if (json__pipeline_emit(pipeline, scan, ctx, data + start, i - start) != 0)
+                    return -1;
+                i--; // Whatever ended the scalar may start the next value
+            }
+        } else if (c == '"') {
+            scan->in_string = 1;
+        } else if (c == '{' || c == '[') {
+            scan->depth++;
+        } else if ((c == '}' || c == ']') && --scan->depth == 0) {
+            if (json__pipeline_emit(pipeline, scan, ctx, data + start, i + 1 - start) != 0)
+                return -1;
+        }
+    }
+
+    return scan->in_value ? json__pipeline_carry(scan, data + start, length - start) : 0;
+}
+
+static void *json__pipeline_parser(void *arg)
+{
+    struct json__pipeline *pipeline = (struct json__pipeline *) arg;
+    struct json__pipeline_scan scan;
+    struct json_parser_ctx ctx;
+    int status = 0;
+    void *item;
+
+    memset(&scan, 0, sizeof(scan));
+    memset(&ctx, 0, sizeof(ctx));
+
+    while (status == 0 && json__ring_pop(&pipeline->filled, &item, &pipeline->stop) == 0) {
+        struct json__pipeline_buffer *buffer = (struct json__pipeline_buffer *) item;
+
+        if (buffer->length < 0) {
+            status = -1;
+            break;
+        }
+
+        if (buffer->length == 0) {
+            // A trailing scalar ends with the input, anything else is truncated
+            if (scan.in_value && (!scan.scalar || json__pipeline_emit(pipeline, &scan, &ctx, "", 0) != 0))
+                status = -1;
+            break;
+        }
+
+        status = json__pipeline_split(pipeline, &scan, &ctx, buffer->data, buffer->length);
+        // Cannot block, the ring holds every buffer
+        json__ring_push(&pipeline->free, buffer, &pipeline->stop);
+    }
+
+    pipeline->status = status;
+    json__ring_push(&pipeline->values, NULL, &pipeline->stop);
+    json__parser_ctx_release(&ctx);
+    json__free(scan.carry);
+    return NULL;
+}
+
+JSON_API int json_pipeline_run(json_read_fn read, void *source, json_consume_fn consume, void *data,
+                               const struct json_pipeline_options *opts)
+{
+    struct json_pipeline_options defaults;
+    struct json__pipeline pipeline;
+    struct json__pipeline_buffer *buffers = NULL;
+    char *memory = NULL;
+    pthread_t reader, parser;
+    int started = 0;
+    int result = -1;
+    void *item;
+
+    if (opts == NULL) {
+        memset(&defaults, 0, sizeof(defaults));
+        opts = &defaults;
+    }
+
+    memset(&pipeline, 0, sizeof(pipeline));
+    pipeline.read = read;
+    pipeline.source = source;
+    pipeline.buffer_size = opts->buffer_size > 0 ? opts->buffer_size : 64 * 1024;
+
+    {
+        int count = opts->buffers > 0 ? opts->buffers : 4;
+
+        if (json__ring_init(&pipeline.free, count) != 0 || json__ring_init(&pipeline.filled, count) != 0 ||
+            json__ring_init(&pipeline.values, opts->depth > 0 ? opts->depth : 64) != 0)
+            goto cleanup;
+
+        buffers = (struct json__pipeline_buffer *) json_alloc(sizeof(struct json__pipeline_buffer) * count);
+        memory = (char *) json_alloc((size_t) pipeline.buffer_size * count);
+        if (buffers == NULL || memory == NULL)
+            goto cleanup;
+
+        for (int i = 0; i < count; i++) {
+            buffers[i].data = memory + (size_t) pipeline.buffer_size * i;
+            json__ring_push(&pipeline.free, &buffers[i], &pipeline.stop);
+        }
+    }
+
+    if (pthread_create(&reader, NULL, json__pipeline_reader, &pipeline) != 0)
+        goto cleanup;
+    started = 1;
+    if (pthread_create(&parser, NULL, json__pipeline_parser, &pipeline) != 0) {
+        json__pipeline_stop(&pipeline);
+        goto cleanup;
+    }
+    started = 2;
+
+    result = 0;
+    while (json__ring_pop(&pipeline.values, &item, &pipeline.stop) == 0 && item != NULL) {
+        if ((result = consume(data, (struct json_value *) item)) != 0)
+            break;
+    }
+
+    if (result == 0)
+        result = pipeline.status;
+    json__pipeline_stop(&pipeline);
+
+cleanup:
+    if (started > 0)
+        pthread_join(reader, NULL);
+    if (started > 1)
+        pthread_join(parser, NULL);
+
+    // Documents decoded after the consumer stopped
+    while (pipeline.values.slots != NULL && pipeline.values.head != pipeline.values.tail) {
+        item = pipeline.values.slots[pipeline.values.head++ & pipeline.values.mask];
+        if (item != NULL)
+            json_free((struct json_value *) item);
+    }
+
+    json__ring_destroy(&pipeline.free);
+    json__ring_destroy(&pipeline.filled);
+    json__ring_destroy(&pipeline.values);
+    json__free(buffers);
+    json__free(memory);
+    return result;
+}
+#endif
+
+JSON_API int json_decode_batch(const char *const *bufs, const int *lens, int n, struct json_value **out,
+                               const struct json_batch_options *opts)
+{
+    struct json_batch_options defaults;
+    struct json__batch batch;
+    int chunks;
+
+    if (n <= 0)
+        return 0;
+
+    if (opts == NULL) {
+        memset(&defaults, 0, sizeof(defaults));
+        opts = &defaults;
+    }
+
+    batch.bufs = bufs;
+    batch.lens = lens;
+    batch.out = out;
+    batch.errors = opts->errors;
+    batch.grain = opts->grain > 0 ? opts->grain : JSON_BATCH_GRAIN;
+    batch.workers = opts->threads;
+    batch.next_worker = 0;
+    batch.failures = 0;
+
+    if (batch.workers <= 0) {
+#if defined(JSON_THREADS)
+        if (opts->executor == json_pool_run)
+            batch.workers = ((struct json_pool *) opts->executor_data)->size + 1;
+        else
+            batch.workers = json__cpu_count();
+#else
+        batch.workers = 1;
+#endif
+    }
+
+    // No point in workers that would not get a single chunk
+    chunks = n / batch.grain + (n % batch.grain != 0);
+    if (batch.workers > chunks)
+        batch.workers = chunks;
+
+    batch.ranges = (struct json__batch_range *) json_alloc(sizeof(struct json__batch_range) * batch.workers);
+    if (batch.ranges == NULL)
+        return -1;
+
+    for (int i = 0; i < batch.workers; i++) {
+        int begin = (int) ((long long) n * i / batch.workers);
+        int end = (int) ((long long) n * (i + 1) / batch.workers);
+
+        batch.ranges[i].range = JSON__BATCH_RANGE(begin, end);
+    }
+
+    if (opts->executor != NULL)
+        opts->executor(opts->executor_data, json__batch_worker, &batch, batch.workers);
+#if defined(JSON_THREADS)
+    else if (batch.workers > 1)
+        json__threads_run(json__batch_worker, &batch, batch.workers);
+#endif
+    else
+        json__batch_worker(&batch);
+
+    json__free(batch.ranges);
+    return batch.failures;
+}
+
+static char *json__encode_number_array(struct json_value *value)
+{
+    // "%.17g" never needs more than 24 characters, plus one for the separator
+    int buffer_size = 3 + value->array.length * 25;
+    int length = 1;
+    char *encoded_array = (char *) json__alloc_as(JSON_STATS_ENCODER, buffer_size);
+
+    if (encoded_array == NULL)
+        return NULL;
+
+    encoded_array[0] = '[';
+    for (int i = 0; i < value->array.length; i++) {
+        if (i > 0)
+            encoded_array[length++] = ',';
+        length += snprintf(encoded_array + length, buffer_size - length, "%.17g", value->array.numbers[i]);
+    }
+
+    encoded_array[length++] = ']';
+    encoded_array[length] = 0;
+    return encoded_array;
+}
+
+static char *json__encode_array(struct json_value *value)
+{
+    int length;
+    int buffer_size;
+    char *encoded_array;
+    if (value == NULL) {
+        return NULL;
+    }
+
+    if (value->type == JSON_TYPE_NUMBER_ARRAY)
+        return json__encode_number_array(value);
+
+    buffer_size = 512;
+    encoded_array = (char *) json__alloc_as(JSON_STATS_ENCODER, buffer_size);
+    if (encoded_array == NULL) {
+        return NULL;
+    }
+
+    length = 1;
+    encoded_array[0] = '[';
+
+    for (int i = 0; i < value->array.length; i++) {
+        int needed;
+        int encoded_item_len;
+        char *encoded_item = json_encode(value->array.items[i]);
+        if (encoded_item == NULL) {
+            json__free_as(JSON_STATS_ENCODER, encoded_array);
+            return NULL;
+        }
+
+        encoded_item_len = json__strlen(encoded_item);
+
+        // Room for the closing bracket and terminator after the last item
+        needed = length + encoded_item_len + (i > 0 ? 1 : 0) + 2;
+        if (needed > buffer_size) {
+            char *new_encoded_array;
+            buffer_size = needed * 2;
+            new_encoded_array = (char *) json__realloc_as(JSON_STATS_ENCODER, encoded_array, buffer_size);
+            if (new_encoded_array == NULL) {
+                json__free_as(JSON_STATS_ENCODER, encoded_array);
+                json__free_as(JSON_STATS_ENCODER, encoded_item);
+                return NULL;
+            }
+            encoded_array = new_encoded_array;
+        }
+
+        if (i > 0) {
+            encoded_array[length++] = ',';
+        }
+
+        for (int j = 0; j < encoded_item_len; j++)
+            encoded_array[length + j] = encoded_item[j];
+
+        length += encoded_item_len;
+
+        json__free_as(JSON_STATS_ENCODER, encoded_item);
+    }
+
+    encoded_array[length++] = ']';
+    encoded_array[length] = '\0';
+
+    return encoded_array;
+}
+
+static char *json__encode_bytes(const char *str, int length);
+
+static char *json__encode_object(struct json_value *object)
+{
+    int length;
+    int buffer_size = 256;
+    char *encoded_object = (char *) json__alloc_as(JSON_STATS_ENCODER, buffer_size);
+    if (encoded_object == NULL) {
+        return NULL;
+    }
+
+    encoded_object[0] = '{';
+    length = 1;
+
+    for (int i = 0; i < object->object.n_items; i++) {
+        char *new_buffer;
+        // Keys may hold any bytes, so they are escaped like string values
+        char *key = json__encode_bytes(object->object.items[i]->key, object->object.items[i]->key_length);
+        char *value = key != NULL ? json_encode(object->object.items[i]->value) : NULL;
+        int key_length, value_length, needed;
+
+        if (value == NULL) {
+            json__free_as(JSON_STATS_ENCODER, key);
+            json__free_as(JSON_STATS_ENCODER, encoded_object);
+            return NULL;
+        }
+
+        key_length = json__strlen(key);
+        value_length = json__strlen(value);
+
+        // Colon, then a comma or the closing brace and terminator
+        needed = length + key_length + value_length + 1 + (i < object->object.n_items - 1 ? 1 : 2);
+
+        if (needed > buffer_size) {
+            buffer_size = needed * 2;
+            new_buffer = (char *) json__realloc_as(JSON_STATS_ENCODER, encoded_object, buffer_size);
+            if (new_buffer == NULL) {
+                json__free_as(JSON_STATS_ENCODER, encoded_object);
+                json__free_as(JSON_STATS_ENCODER, key);
+                json__free_as(JSON_STATS_ENCODER, value);
+                return NULL;
+            }
+            encoded_object = new_buffer;
+        }
+
+        for (int j = 0; j < key_length; j++)
+            encoded_object[length++] = key[j];
+
+        encoded_object[length++] = ':';
+        for (int j = 0; j < value_length; j++)
+            encoded_object[length++] = value[j];
+
+        json__free_as(JSON_STATS_ENCODER, key);
+        json__free_as(JSON_STATS_ENCODER, value);
+
+        if (i < object->object.n_items - 1) {
+            encoded_object[length++] = ',';
+        }
+    }
+
+    encoded_object[length++] = '}';
+    encoded_object[length] = '\0';
+
+    return encoded_object;
+}
+
+// Quotes and escapes `length` bytes, used for string values and object keys alike
+static char *json__encode_bytes(const char *str, int length)
+{
+    int buffer_size = length * 6 + 3; // Maximum possible size (all chars escaped + quotes)
+    char *buffer = (char *) json__alloc_as(JSON_STATS_ENCODER, buffer_size);
+    int pos = 0;
+
+    if (!buffer)
+        return NULL;
+
+    buffer[pos++] = '"';
+
+    for (int i = 0; i < length; i++) {
+        unsigned char c = (unsigned char) str[i];
+
+        if (c == '"' || c == '\\' || c == '/') {
+            buffer[pos++] = '\\';
+            buffer[pos++] = c;
+        } else if (c == '\b') {
+            buffer[pos++] = '\\';
+            buffer[pos++] = 'b';
+        } else if (c == '\f') {
+            buffer[pos++] = '\\';
+            buffer[pos++] = 'f';
+        } else if (c == '\n') {
+            buffer[pos++] = '\\';
+            buffer[pos++] = 'n';
+        } else if (c == '\r') {
+            buffer[pos++] = '\\';
+            buffer[pos++] = 'r';
+        } else if (c == '\t') {
+            buffer[pos++] = '\\';
+            buffer[pos++] = 't';
+        } else if (c < 32) {
+            // Control characters must be escaped as \uXXXX
+            buffer[pos++] = '\\';
+            buffer[pos++] = 'u';
+            buffer[pos++] = '0';
+            buffer[pos++] = '0';
+            buffer[pos++] = "0123456789ABCDEF"[(c >> 4) & 0xF];
+            buffer[pos++] = "0123456789ABCDEF"[c & 0xF];
+        } else if (c < 128) {
+            // ASCII characters
+            buffer[pos++] = c;
+        } else {
+            // UTF-8 encoded characters
+            // Check if this is a multi-byte sequence
+            const unsigned char *bytes = (const unsigned char *) &str[i];
+            if ((c & 0xE0) == 0xC0) {
+                // Two-byte sequence
+                if (i + 1 >= length || (bytes[1] & 0xC0) != 0x80) {
+                    // Invalid UTF-8 sequence, escape as replacement character
+                    buffer[pos++] = '\\';
+                    buffer[pos++] = 'u';
+                    buffer[pos++] = 'F';
+                    buffer[pos++] = 'F';
+                    buffer[pos++] = 'F';
+                    buffer[pos++] = 'D';
+                } else {
+                    // Valid two-byte sequence, keep as is
+                    buffer[pos++] = c;
+                    buffer[pos++] = str[++i];
+                }
+            } else if ((c & 0xF0) == 0xE0) {
+                // Three-byte sequence
+                if (i + 2 >= length || (bytes[1] & 0xC0) != 0x80 || (bytes[2] & 0xC0) != 0x80) {
+                    // Invalid UTF-8 sequence
+                    buffer[pos++] = '\\';
+                    buffer[pos++] = 'u';
+                    buffer[pos++] = 'F';
+                    buffer[pos++] = 'F';
+                    buffer[pos++] = 'F';
+                    buffer[pos++] = 'D';
+                } else {
+                    // Valid three-byte sequence, keep as is
+                    buffer[pos++] = c;
+                    buffer[pos++] = str[++i];
+                    buffer[pos++] = str[++i];
+                }
+            } else if ((c & 0xF8) == 0xF0) {
+                // Four-byte sequence
+                if (i + 3 >= length || (bytes[1] & 0xC0) != 0x80 || (bytes[2] & 0xC0) != 0x80
+                    || (bytes[3] & 0xC0) != 0x80) {
+                    // Invalid UTF-8 sequence
+                    buffer[pos++] = '\\';
+                    buffer[pos++] = 'u';
+                    buffer[pos++] = 'F';
+                    buffer[pos++] = 'F';
+                    buffer[pos++] = 'F';
+                    buffer[pos++] = 'D';
+                } else {
+                    // Valid four-byte sequence, keep as is
+                    buffer[pos++] = c;
+                    buffer[pos++] = str[++i];
+                    buffer[pos++] = str[++i];
+                    buffer[pos++] = str[++i];
+                }
+            } else {
+                // Invalid UTF-8 start byte
+                buffer[pos++] = '\\';
+                buffer[pos++] = 'u';
+                buffer[pos++] = 'F';
+                buffer[pos++] = 'F';
+                buffer[pos++] = 'F';
+                buffer[pos++] = 'D';
+            }
+        }
+    }
+
+    buffer[pos++] = '"';
+    buffer[pos] = '\0';
+
+    // Reallocate to actual size
+    char *result = (char *) json__realloc_as(JSON_STATS_ENCODER, buffer, pos + 1);
+    return result ? result : buffer;
+}
+
+static char *json__encode_string(struct json_value *value)
+{
+    return json__encode_bytes(value->string.value, value->string.length);
+}
+
+JSON_API char *json_encode(struct json_value *value)
+{
+    switch (value->type) {
+    case JSON_TYPE_STRING:
+        return json__encode_string(value);
+    case JSON_TYPE_NUMBER: {
+        char *ptr;
+        char buffer[32];
+        int length = snprintf(buffer, sizeof(buffer), "%.17g", value->number);
+
+        if ((ptr = (char *) json__alloc_as(JSON_STATS_ENCODER, length + 1)) == NULL)
+            return NULL;
+
+        for (int i = 0; i < length; i++)
+            ptr[i] = buffer[i];
+
+        ptr[length] = 0;
+        return ptr;
+    }
+    case JSON_TYPE_BOOLEAN: {
+        char *ptr;
+        const char *boolean_str = value->number != 0.0 ? "true" : "false";
+        int length = json__strlen(boolean_str);
+
+        if ((ptr = (char *) json__alloc_as(JSON_STATS_ENCODER, length + 1)) == NULL)
+            return NULL;
+
+        for (int i = 0; i < length; i++)
+            ptr[i] = boolean_str[i];
+
+        ptr[length] = 0;
+        return ptr;
+    }
+    case JSON_TYPE_NULL: {
+        char *ptr;
+        const char *null_str = "null";
+        int length = json__strlen(null_str);
+
+        if ((ptr = (char *) json__alloc_as(JSON_STATS_ENCODER, length + 1)) == NULL)
+            return NULL;
+
+        for (int i = 0; i < length; i++)
+            ptr[i] = null_str[i];
+
+        ptr[length] = 0;
+        return ptr;
+    }
+    case JSON_TYPE_ARRAY:
+    case JSON_TYPE_NUMBER_ARRAY:
+        return json__encode_array(value);
+    case JSON_TYPE_OBJECT:
+        return json__encode_object(value);
+    default:
+        return NULL;
+    }
+}
+
+JSON_API void json_object_init(struct json_value *object)
+{
+    object->object.n_items = 0;
+    object->object.capacity = 0;
+    object->object.items = NULL;
+#if defined(JSON_HASH_CACHE)
+    object->object.hash = 0;
+#endif
+#if defined(JSON_INDEX)
+    object->object.index = NULL;
+#endif
+}
+
+JSON_API struct json_value *json_object_new(void)
+{
+    struct json_value *object = json__value_alloc();
+    if (!object) {
+        return NULL;
+    }
+
+    object->type = JSON_TYPE_OBJECT;
+    json_object_init(object);
+    JSON__STATS_NODE(JSON_TYPE_OBJECT);
+
+    return object;
+}
+
+JSON_API void json_object_free(struct json_value *object)
+{
+    for (int i = 0; i < object->object.n_items; i++) {
+        json_free(object->object.items[i]->value);
+        json__free_as(JSON_STATS_KEY, object->object.items[i]->key);
+        json__free_as(JSON_STATS_KEY, object->object.items[i]);
+    }
+
+    json__free_as(JSON_STATS_ITEMS, object->object.items);
+#if defined(JSON_INDEX)
+    json__free(object->object.index);
+#endif
+    json__free_as(JSON_STATS_NODE, object);
+}
+
+static int json__object_grow(struct json_value *object)
+{
+    if (object->object.n_items >= object->object.capacity * JSON_OBJECT_CAPACITY_THRESHOLD) {
+        void *items;
+        int capacity;
+
+        if (object->object.capacity)
+            capacity = object->object.capacity * JSON_OBJECT_CAPACITY_MULTIPLIER;
+        else
+            capacity = JSON_OBJECT_INITIAL_CAPACITY;
+
+        items = json__realloc_as(JSON_STATS_ITEMS, object->object.items, capacity * sizeof(*object->object.items));
+        if (items == NULL)
+            return -1;
+
+        object->object.items = (struct json_object_entry **) items;
+        object->object.capacity = capacity;
+        JSON__STATS_GROWTH();
+    }
+
+    return 0;
+}
+
+static int json__object_find(const struct json_value *object, const char *key, int key_length)
+{
+    for (int i = 0; i < object->object.n_items; i++) {
+        const struct json_object_entry *entry = object->object.items[i];
+        if (entry->key_length == key_length && memcmp(entry->key, key, key_length) == 0) {
+            JSON__STATS_KEY_COMPARISONS(i + 1);
+            return i;
+        }
+    }
+
+    JSON__STATS_KEY_COMPARISONS(object->object.n_items);
+    return -1;
+}
+
+#if defined(JSON_INDEX)
+// Open-addressed table of member positions plus one, 0 marks a free slot;
+// the slots follow the structure in the same allocation
+struct json__object_index
+{
+    int mask;
+};
+
+static struct json__object_index *json__object_index_build(const struct json_value *object)
+{
+    struct json__object_index *index;
+    int size = 1, *slots;
+
+    while (size < object->object.n_items * 2)
+        size <<= 1;
+
+    if ((index = (struct json__object_index *) json_alloc(sizeof(*index) + size * sizeof(int))) == NULL)
+        return NULL;
+
+    index->mask = size - 1;
+    slots = (int *) (index + 1);
+    memset(slots, 0, size * sizeof(int));
+
+    for (int i = 0; i < object->object.n_items; i++) {
+        const struct json_object_entry *entry = object->object.items[i];
+        int slot = (int) (json__hash_bytes(entry->key, (size_t) entry->key_length, JSON_HASH_SEED) & index->mask);
+
+        while (slots[slot] != 0)
+            slot = (slot + 1) & index->mask;
+        slots[slot] = i + 1;
+    }
+
+    return index;
+}
+
+// Readers race to build the index; the first to publish it wins and the
+// others discard theirs, so lookups never lock
+static struct json__object_index *json__object_index_get(const struct json_value *object)
+{
+    struct json_value *shared = (struct json_value *) object;
+    struct json__object_index *index = (struct json__object_index *) JSON__ATOMIC_LOAD_PTR(&shared->object.index);
+
+    // A frozen object has its index already, or is never to be written to
+    if (index != NULL || shared->frozen || (index = json__object_index_build(object)) == NULL)
+        return index;
+
+    if (!JSON__ATOMIC_CAS_PTR(&shared->object.index, (struct json__object_index *) NULL, index)) {
+        json__free(index);
+        index = (struct json__object_index *) JSON__ATOMIC_LOAD_PTR(&shared->object.index);
+    }
+
+    return index;
+}
+#endif
+
+// Finds a member for a read, through the object's index when it has enough members
+static int json__object_lookup(const struct json_value *object, const char *key, int key_length)
+{
+#if defined(JSON_INDEX)
+    struct json__object_index *index;
+
+    if (object->object.n_items >= JSON_INDEX_THRESHOLD && (index = json__object_index_get(object)) != NULL) {
+        const int *slots = (const int *) (index + 1);
+        int slot = (int) (json__hash_bytes(key, (size_t) key_length, JSON_HASH_SEED) & index->mask);
+
+        for (; slots[slot] != 0; slot = (slot + 1) & index->mask) {
+            const struct json_object_entry *entry = object->object.items[slots[slot] - 1];
+            JSON__STATS_KEY_COMPARISONS(1);
+            if (entry->key_length == key_length && memcmp(entry->key, key, key_length) == 0)
+                return slots[slot] - 1;
+        }
+
+        return -1;
+    }
+#endif
+
+    return json__object_find(object, key, key_length);
+}
+
+#if defined(JSON_HASH_CACHE) || defined(JSON_INDEX)
+static void json__cache_invalidate(struct json_value *value)
+{
+    value->frozen = 0;
+#if defined(JSON_HASH_CACHE)
+    if (value->type != JSON_TYPE_OBJECT)
+        value->array.hash = 0;
+    else
+        value->object.hash = 0;
+#endif
+#if defined(JSON_INDEX)
+    if (value->type == JSON_TYPE_OBJECT && value->object.index != NULL) {
+        json__free(value->object.index);
+        value->object.index = NULL;
+    }
+#endif
+}
+#endif
+
+static struct json_object_entry *json__object_entry_new(const char *key, int key_length, struct json_value *value)
+{
+    struct json_object_entry *entry;
+
+    if ((entry = (struct json_object_entry *) json__alloc_as(JSON_STATS_KEY, sizeof(*entry))) == NULL)
+        return NULL;
+
+    if ((entry->key = (char *) json__alloc_as(JSON_STATS_KEY, key_length + 1)) == NULL) {
+        json__free_as(JSON_STATS_KEY, entry);
+        return NULL;
+    }
+
+    memcpy(entry->key, key, key_length);
+    entry->key[key_length] = '\0';
+    entry->key_length = key_length;
+    entry->value = value;
+    return entry;
+}
+
+JSON_API int json_object_set_n(struct json_value *object, const char *key, size_t length, struct json_value *value)
+{
+    struct json_object_entry *entry;
+    int index;
+
+    if (JSON__SHARED(object))
+        return -1;
+
+    index = json__object_find(object, key, (int) length);
+    JSON__CACHE_INVALIDATE(object);
+    if (index >= 0) {
+        json_free(object->object.items[index]->value);
+        object->object.items[index]->value = value;
+        return 0;
+    }
+
+    if (json__object_grow(object) != 0 || (entry = json__object_entry_new(key, (int) length, value)) == NULL)
+        return -1;
+
+    object->object.items[object->object.n_items++] = entry;
+    return 0;
+}
+
+JSON_API int json_object_set(struct json_value *object, const char *key, struct json_value *value)
+{
+    return json_object_set_n(object, key, json__strlen(key), value);
+}
+
+JSON_API int json_object_has_n(struct json_value *object, const char *key, size_t length)
+{
+    return json__object_lookup(object, key, (int) length) >= 0;
+}
+
+JSON_API int json_object_has(struct json_value *object, const char *key)
+{
+    return json_object_has_n(object, key, json__strlen(key));
+}
+
+JSON_API struct json_value *json_object_get_n(struct json_value *object, const char *key, size_t length)
+{
+    int index;
+
+    if (object == NULL || object->object.items == NULL)
+        return NULL;
+
+    index = json__object_lookup(object, key, (int) length);
+    return index >= 0 ? object->object.items[index]->value : NULL;
+}
+
+JSON_API struct json_value *json_object_get(struct json_value *object, const char *key)
+{
+    return json_object_get_n(object, key, json__strlen(key));
+}
+
+JSON_API void json_object_remove_n(struct json_value *object, const char *key, size_t length)
+{
+    int index;
+    struct json_object_entry *entry;
+
+    if (JSON__SHARED(object) || (index = json__object_find(object, key, (int) length)) < 0)
+        return;
+
+    JSON__CACHE_INVALIDATE(object);
+    entry = object->object.items[index];
+    object->object.items[index] = object->object.items[--object->object.n_items];
+
+    json_free(entry->value);
+    json__free_as(JSON_STATS_KEY, entry->key);
+    json__free_as(JSON_STATS_KEY, entry);
+}
+
+JSON_API void json_object_remove(struct json_value *object, const char *key)
+{
+    json_object_remove_n(object, key, json__strlen(key));
+}
+
+JSON_API int json_object_reserve(struct json_value *object, int capacity)
+{
+    struct json_object_entry **items;
+
+    if (capacity <= object->object.capacity)
+        return 0;
+
+    items = (struct json_object_entry **) json__realloc_as(JSON_STATS_ITEMS, object->object.items,
+                                                           capacity * sizeof(*items));
+    if (items == NULL)
+        return -1;
+
+    object->object.items = items;
+    object->object.capacity = capacity;
+    return 0;
+}
+
+JSON_API int json_object_iter(const struct json_value *object, int *iter, char **key, struct json_value **value)
+{
+    if (*iter >= object->object.n_items)
+        return 0;
+
+    *key = object->object.items[*iter]->key;
+    *value = object->object.items[(*iter)++]->value;
+
+    return 1;
+}
+
+struct json__remove_key
+{
+    unsigned long long hash;
+    const char *key;
+    int length;
+};
+
+static int json__remove_key_compare(const void *a, const void *b)
+{
+    unsigned long long ha = ((const struct json__remove_key *) a)->hash;
+    unsigned long long hb = ((const struct json__remove_key *) b)->hash;
+
+    return ha < hb ? -1 : ha > hb;
+}
+
+static int json__remove_key_match(const struct json__remove_key *keys, int count, const char *key, int length)
+{
+    int low = 0, high = count;
+    unsigned long long hash = json__hash_bytes(key, (size_t) length, JSON_HASH_SEED);
+
+    // Find the first key with this hash, then check the run of equal hashes
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (keys[middle].hash < hash)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    for (; low < count && keys[low].hash == hash; low++)
+        if (keys[low].length == length && memcmp(keys[low].key, key, length) == 0)
+            return 1;
+
+    return 0;
+}
+
+JSON_API int json_object_remove_many(struct json_value *object, const char *const *keys, int count)
+{
+    struct json__remove_key *sorted;
+    int kept = 0, removed;
+
+    if (JSON__SHARED(object))
+        return -1;
+
+    if (count <= 0 || object->object.n_items == 0)
+        return 0;
+
+    if ((sorted = (struct json__remove_key *) json_alloc(count * sizeof(*sorted))) == NULL)
+        return -1;
+
+    for (int i = 0; i < count; i++) {
+        sorted[i].key = keys[i];
+        sorted[i].length = json__strlen(keys[i]);
+        sorted[i].hash = json__hash_bytes(keys[i], (size_t) sorted[i].length, JSON_HASH_SEED);
+    }
+    qsort(sorted, (size_t) count, sizeof(*sorted), json__remove_key_compare);
+
+    JSON__CACHE_INVALIDATE(object);
+    for (int i = 0; i < object->object.n_items; i++) {
+        struct json_object_entry *entry = object->object.items[i];
+
+        if (json__remove_key_match(sorted, count, entry->key, entry->key_length)) {
+            json_free(entry->value);
+            json__free_as(JSON_STATS_KEY, entry->key);
+            json__free_as(JSON_STATS_KEY, entry);
+        } else {
+            object->object.items[kept++] = entry;
+        }
+    }
+
+    json__free(sorted);
+    removed = object->object.n_items - kept;
+    object->object.n_items = kept;
+    return removed;
+}
+
+JSON_API void json_object_clear(struct json_value *object)
+{
+    if (JSON__SHARED(object))
+        return;
+
+    JSON__CACHE_INVALIDATE(object);
+    for (int i = 0; i < object->object.n_items; i++) {
+        json_free(object->object.items[i]->value);
+        json__free_as(JSON_STATS_KEY, object->object.items[i]->key);
+        json__free_as(JSON_STATS_KEY, object->object.items[i]);
+    }
+
+    object->object.n_items = 0;
+}
+
+JSON_API void json_array_init(struct json_value *array)
+{
+    array->array.length = 0;
+    array->array.capacity = 0;
+    array->array.items = NULL;
+#if defined(JSON_HASH_CACHE)
+    array->array.hash = 0;
+#endif
+}
+
+JSON_API struct json_value *json_array_new(void)
+{
+    struct json_value *value;
+    if ((value = json__value_alloc()) == NULL)
+        return NULL;
+
+    value->type = JSON_TYPE_ARRAY;
+    json_array_init(value);
+    JSON__STATS_NODE(JSON_TYPE_ARRAY);
+
+    return value;
+}
+
+JSON_API struct json_value *json_number_array_new(const double *numbers, int count)
+{
+    struct json_value *array;
+    if ((array = json__value_alloc()) == NULL)
+        return NULL;
+
+    array->type = JSON_TYPE_NUMBER_ARRAY;
+    json_array_init(array);
+
+    if (count > 0) {
+        if ((array->array.numbers = (double *) json__alloc_as(JSON_STATS_ITEMS, count * sizeof(double))) == NULL) {
+            json__free_as(JSON_STATS_NODE, array);
+            return NULL;
+        }
+
+        memcpy(array->array.numbers, numbers, count * sizeof(double));
+        array->array.length = array->array.capacity = count;
+    }
+
+    JSON__STATS_NODE(JSON_TYPE_NUMBER_ARRAY);
+    return array;
+}
+
+JSON_API double *json_number_array_data(struct json_value *array)
+{
+    return array->type == JSON_TYPE_NUMBER_ARRAY ? array->array.numbers : NULL;
+}
+
+// Converts a packed number array into a regular one, anything else is left
+// alone. Reserved capacity is kept, so pushes after the conversion still fit
+static int json__array_unpack(struct json_value *array)
+{
+    struct json_value **items = NULL;
+    int length = array->array.length, capacity = array->array.capacity;
+
+    if (array->type != JSON_TYPE_NUMBER_ARRAY)
+        return 0;
+
+    if (capacity > 0
+        && (items = (struct json_value **) json__alloc_as(JSON_STATS_ITEMS, capacity * sizeof(*items))) == NULL)
+        return -1;
+
+    for (int i = 0; i < length; i++) {
+        if ((items[i] = json_number_new(array->array.numbers[i])) == NULL) {
+            while (i-- > 0)
+                json_free(items[i]);
+            json__free_as(JSON_STATS_ITEMS, items);
+            return -1;
+        }
+    }
+
+    json__free_as(JSON_STATS_ITEMS, array->array.numbers);
+    array->type = JSON_TYPE_ARRAY;
+    array->array.items = items;
+    return 0;
+}
+
+JSON_API void json_array_free(struct json_value *value)
+{
+    // Packed elements have no nodes of their own
+    if (value->type == JSON_TYPE_ARRAY)
+        for (int i = 0; i < value->array.length; i++)
+            json_free(value->array.items[i]);
+    json__free_as(JSON_STATS_ITEMS, value->array.items);
+    json__free_as(JSON_STATS_NODE, value);
+}
+
+JSON_API void json_free(struct json_value *value)
+{
+#if defined(JSON_REFCOUNT)
+    if (JSON__ATOMIC_DEC(&value->refcount) > 0)
+        return;
+#endif
+
+    switch (value->type) {
+    case JSON_TYPE_OBJECT:
+        json_object_free(value);
+        break;
+    case JSON_TYPE_ARRAY:
+    case JSON_TYPE_NUMBER_ARRAY:
+        json_array_free(value);
+        break;
+    case JSON_TYPE_STRING:
+        json_string_free(value);
+        break;
+    default:
+        json__free_as(JSON_STATS_NODE, value);
+    }
+}
+
+#if defined(JSON_REFCOUNT)
+JSON_API struct json_value *json_retain(struct json_value *value)
+{
+    JSON__ATOMIC_INC(&value->refcount);
+    return value;
+}
+
+JSON_API void json_release(struct json_value *value)
+{
+    json_free(value);
+}
+#endif
+
+JSON_API struct json_value *json_deep_copy(struct json_value *value)
+{
+    struct json_value *new_value;
+    struct json_value *element;
+    char *key;
+    int iter;
+
+    iter = 0;
+
+    switch (value->type) {
+    case JSON_TYPE_OBJECT:
+        new_value = json_object_new();
+        while (json_object_iter(value, &iter, &key, &element))
+            json_object_set_n(new_value, key, value->object.items[iter - 1]->key_length, json_deep_copy(element));
+        return new_value;
+
+    case JSON_TYPE_ARRAY:
+        new_value = json_array_new();
+        while (json_array_iter(value, &iter, &element))
+            json_array_push(new_value, json_deep_copy(element));
+        return new_value;
+
+    case JSON_TYPE_NUMBER_ARRAY:
+        return json_number_array_new(value->array.numbers, value->array.length);
+
+    case JSON_TYPE_STRING:
+        return json_string_new(value->string.value);
+
+    default:
+        if ((new_value = json__value_alloc()) != NULL) {
+            json__value_assign(new_value, value);
+            JSON__STATS_NODE(new_value->type);
+        }
+        return new_value;
+    }
+
+    return NULL;
+}
+
+JSON_API void json_array_remove(struct json_value *array, int index)
+{
+    if (JSON__SHARED(array))
+        return;
+
+    JSON__CACHE_INVALIDATE(array);
+    if (array->type == JSON_TYPE_NUMBER_ARRAY) {
+        memmove(array->array.numbers + index, array->array.numbers + index + 1,
+                (array->array.length - index - 1) * sizeof(double));
+        array->array.length--;
+        return;
+    }
+
+    json_free(array->array.items[index]);
+
+    for (int i = index; i < array->array.length - 1; i++)
+        array->array.items[i] = array->array.items[i + 1];
+    array->array.length--;
+}
+
+JSON_API inline int json_array_length(struct json_value *array)
+{
+    return array->array.length;
+}
+
+static int json__array_grow(struct json_value *array)
+{
+    int index = array->array.length;
+    int capacity = array->array.capacity;
+    int capacity_threshold = capacity * JSON_ARRAY_CAPACITY_THRESHOLD;
+
+    if (index >= capacity_threshold) {
+        int capacity;
+        if (array->array.capacity > 0)
+            capacity = array->array.capacity * JSON_ARRAY_CAPACITY_MULTIPLIER;
+        else
+            capacity = JSON_ARRAY_INITIAL_CAPACITY;
+
+        void *items;
+        int size = capacity * JSON__ARRAY_ITEM_SIZE(array);
+        if ((items = json__realloc_as(JSON_STATS_ITEMS, array->array.items, size)) == NULL)
+            return -1;
+
+        array->array.items = (struct json_value **) items;
+        array->array.capacity = capacity;
+        JSON__STATS_GROWTH();
+    }
+
+    return 0;
+}
+
+JSON_API
+int json_array_push(struct json_value *array, struct json_value *value)
+{
+    if (array == NULL || JSON__SHARED(array)) {
+        return -1;
+    }
+
+    // The array adopts the node, so a packed one needs nodes for all its elements
+    if (json__array_unpack(array) != 0 || json__array_grow(array) != 0)
+        return -1;
+
+    JSON__CACHE_INVALIDATE(array);
+    array->array.items[array->array.length++] = value;
+    return 0;
+}
+
+JSON_API int json_number_array_push(struct json_value *array, double number)
+{
+    struct json_value *value;
+
+    if (JSON__SHARED(array))
+        return -1;
+
+    if (array->type != JSON_TYPE_NUMBER_ARRAY) {
+        if ((value = json_number_new(number)) == NULL)
+            return -1;
+        if (json_array_push(array, value) != 0) {
+            json_free(value);
+            return -1;
+        }
+        return 0;
+    }
+
+    if (json__array_grow(array) != 0)
+        return -1;
+
+    JSON__CACHE_INVALIDATE(array);
+    array->array.numbers[array->array.length++] = number;
+    return 0;
+}
+
+JSON_API int json_number_array_get(const struct json_value *array, int index, double *number)
+{
+    if (index < 0 || index >= array->array.length)
+        return -1;
+
+    if (array->type == JSON_TYPE_NUMBER_ARRAY) {
+        *number = array->array.numbers[index];
+        return 0;
+    }
+
+    if (array->array.items[index]->type != JSON_TYPE_NUMBER)
+        return -1;
+
+    *number = array->array.items[index]->number;
+    return 0;
+}
+
+JSON_API int json_array_set(struct json_value *array, int index, struct json_value *value)
+{
+    int packed = array->type == JSON_TYPE_NUMBER_ARRAY;
+
+    if (JSON__SHARED(array) || index < 0 || index >= array->array.length || json__array_unpack(array) != 0)
+        return -1;
+
+    JSON__CACHE_INVALIDATE(array);
+    // The node the conversion just made for this slot is referenced nowhere else
+    if (packed)
+        json_free(array->array.items[index]);
+    array->array.items[index] = value;
+    return 0;
+}
+
+JSON_API int json_array_replace(struct json_value *array, int index, struct json_value *value)
+{
+    struct json_value *previous;
+
+    if (JSON__SHARED(array) || index < 0 || index >= array->array.length || json__array_unpack(array) != 0)
+        return -1;
+
+    JSON__CACHE_INVALIDATE(array);
+    previous = array->array.items[index];
+    array->array.items[index] = value;
+    if (previous != value)
+        json_free(previous);
+    return 0;
+}
+
+JSON_API int json_array_iter(struct json_value *array, int *index, struct json_value **value)
+{
+    if (*index >= array->array.length || json__array_unpack(array) != 0)
+        return 0;
+
+    *value = array->array.items[(*index)++];
+    return 1;
+}
+
+JSON_API void json_array_clear(struct json_value *array)
+{
+    if (JSON__SHARED(array))
+        return;
+
+    JSON__CACHE_INVALIDATE(array);
+    if (array->type == JSON_TYPE_ARRAY)
+        for (int i = 0; i < array->array.length; i++)
+            json_free(array->array.items[i]);
+
+    array->array.length = 0;
+}
+
+JSON_API int json_array_reserve(struct json_value *array, int capacity)
+{
+    void *items;
+
+    if (capacity <= array->array.capacity)
+        return 0;
+
+    items = json__realloc_as(JSON_STATS_ITEMS, array->array.items, capacity * JSON__ARRAY_ITEM_SIZE(array));
+    if (items == NULL)
+        return -1;
+
+    array->array.items = (struct json_value **) items;
+    array->array.capacity = capacity;
+    return 0;
+}
+
+JSON_API int json_array_shrink_to_fit(struct json_value *array)
+{
+    void *items;
+
+    if (array->array.length == array->array.capacity)
+        return 0;
+
+    if (array->array.length == 0) {
+        json__free_as(JSON_STATS_ITEMS, array->array.items);
+        array->array.items = NULL;
+        array->array.capacity = 0;
+        return 0;
+    }
+
+    items = json__realloc_as(JSON_STATS_ITEMS, array->array.items, array->array.length * JSON__ARRAY_ITEM_SIZE(array));
+    if (items == NULL)
+        return -1;
+
+    array->array.items = (struct json_value **) items;
+    array->array.capacity = array->array.length;
+    return 0;
+}
+
+JSON_API void json_array_swap_remove(struct json_value *array, int index)
+{
+    if (JSON__SHARED(array))
+        return;
+
+    JSON__CACHE_INVALIDATE(array);
+    if (array->type == JSON_TYPE_NUMBER_ARRAY) {
+        array->array.numbers[index] = array->array.numbers[--array->array.length];
+        return;
+    }
+
+    json_free(array->array.items[index]);
+
+    array->array.items[index] = array->array.items[--array->array.length];
+}
+
+JSON_API int json_array_splice(struct json_value *array, int start, int count, struct json_value **items, int n)
+{
+    int length = array->array.length;
+
+    if (JSON__SHARED(array) || start < 0 || count < 0 || n < 0 || start > length || count > length - start
+        || json__array_unpack(array) != 0)
+        return -1;
+
+    if (length - count + n > array->array.capacity) {
+        int capacity = array->array.capacity > 0 ? array->array.capacity : JSON_ARRAY_INITIAL_CAPACITY;
+
+        while (capacity < length - count + n)
+            capacity *= JSON_ARRAY_CAPACITY_MULTIPLIER;
+
+        if (json_array_reserve(array, capacity) != 0)
+            return -1;
+    }
+
+    JSON__CACHE_INVALIDATE(array);
+    for (int i = start; i < start + count; i++)
+        json_free(array->array.items[i]);
+
+    memmove(array->array.items + start + n, array->array.items + start + count,
+            (length - start - count) * sizeof(struct json_value *));
+    if (n > 0)
+        memcpy(array->array.items + start, items, n * sizeof(struct json_value *));
+
+    array->array.length = length - count + n;
+    return 0;
+}
+
+JSON_API struct json_value *json_string_new(const char *string)
+{
+    struct json_value *value;
+    if ((value = json__value_alloc()) == NULL)
+        return NULL;
+
+    value->type = JSON_TYPE_STRING;
+    value->string.length = json__strlen(string);
+    if ((value->string.value = (char *) json__alloc_as(JSON_STATS_STRING, value->string.length + 1)) == NULL) {
+        json__free_as(JSON_STATS_NODE, value);
+        return NULL;
+    }
+
+    for (int i = 0; i < value->string.length; i++)
+        value->string.value[i] = string[i];
+
+    value->string.value[value->string.length] = 0;
+    JSON__STATS_NODE(JSON_TYPE_STRING);
+    return value;
+}
+
+JSON_API struct json_value *json_number_new(double value)
+{
+    struct json_value *number;
+    if ((number = json__value_alloc()) == NULL)
+        return NULL;
+
+    number->type = JSON_TYPE_NUMBER;
+    number->number = value;
+    JSON__STATS_NODE(JSON_TYPE_NUMBER);
+
+    return number;
+}
+
+JSON_API struct json_value *json_boolean_new(int value)
+{
+    struct json_value *boolean;
+    if ((boolean = json__value_alloc()) == NULL)
+        return NULL;
+
+    boolean->type = JSON_TYPE_BOOLEAN;
+    boolean->number = value;
+    JSON__STATS_NODE(JSON_TYPE_BOOLEAN);
+
+    return boolean;
+}
+
+JSON_API void json_string_free(struct json_value *string)
+{
+    json__free_as(JSON_STATS_STRING, string->string.value);
+    json__free_as(JSON_STATS_NODE, string);
+}
+
+static inline void json__print_indent(int indent)
+{
+    for (int i = 0; i < indent; i++) {
+        putchar(' ');
+    }
+}
+
+static void json__print_internal(struct json_value *value, int indent)
+{
+    if (value == NULL) {
+        printf("null");
+        return;
+    }
+
+    switch (value->type) {
+    case JSON_TYPE_STRING:
+        printf("\"%s\"", value->string.value);
+        break;
+    case JSON_TYPE_NUMBER:
+        printf("%.17g", value->number);
+        break;
+    case JSON_TYPE_BOOLEAN:
+        printf("%s", value->number == 0.0 ? "false" : "true");
+        break;
+    case JSON_TYPE_NULL:
+        printf("null");
+        break;
+    case JSON_TYPE_ARRAY:
+        printf("[\n");
+        for (int i = 0; i < value->array.length; i++) {
+            json__print_indent(indent + 2);
+            json__print_internal(value->array.items[i], indent + 2);
+            if (i < value->array.length - 1) {
+                printf(",\n");
+            } else {
+                printf("\n");
+            }
+        }
+        json__print_indent(indent);
+        printf("]");
+        break;
+    case JSON_TYPE_NUMBER_ARRAY:
+        printf("[\n");
+        for (int i = 0; i < value->array.length; i++) {
+            json__print_indent(indent + 2);
+            printf("%.17g%s\n", value->array.numbers[i], i < value->array.length - 1 ? "," : "");
+        }
+        json__print_indent(indent);
+        printf("]");
+        break;
+    case JSON_TYPE_OBJECT:
+        printf("{\n");
+        for (int i = 0; i < value->object.n_items; i++) {
+            json__print_indent(indent + 2);
+            printf("\"%s\": ", value->object.items[i]->key);
+            json__print_internal(value->object.items[i]->value, indent + 2);
+            if (i < value->object.n_items - 1) {
+                printf(",\n");
+            } else {
+                printf("\n");
+            }
+        }
+        json__print_indent(indent);
+        printf("}");
+        break;
+    default:
+        break;
+    }
+}
+
+JSON_API void json_print(struct json_value *value)
+{
+    json__print_internal(value, 0);
+}
+
+JSON_API void json_println(struct json_value *value)
+{
+    json_print(value);
+    putchar('\n');
+}
+
+// Puts `entry` at `index` and moves the member there to the end, which is
+// the exact inverse of `json__object_detach`. Capacity must be available
+static void json__object_place(struct json_value *object, int index, struct json_object_entry *entry)
+{
+    JSON__CACHE_INVALIDATE(object);
+    object->object.items[object->object.n_items++] = object->object.items[index];
+    object->object.items[index] = entry;
+}
+
+static struct json_object_entry *json__object_detach(struct json_value *object, int index)
+{
+    struct json_object_entry *entry = object->object.items[index];
+    JSON__CACHE_INVALIDATE(object);
+    object->object.items[index] = object->object.items[--object->object.n_items];
+    return entry;
+}
+
+// Capacity must be available
+static void json__array_place(struct json_value *array, int index, struct json_value *value)
+{
+    JSON__CACHE_INVALIDATE(array);
+    memmove(array->array.items + index + 1, array->array.items + index,
+            (array->array.length - index) * sizeof(*array->array.items));
+    array->array.items[index] = value;
+    array->array.length++;
+}
+
+static struct json_value *json__array_detach(struct json_value *array, int index)
+{
+    struct json_value *value = array->array.items[index];
+    JSON__CACHE_INVALIDATE(array);
+    memmove(array->array.items + index, array->array.items + index + 1,
+            (array->array.length - index - 1) * sizeof(*array->array.items));
+    array->array.length--;
+    return value;
+}
+
+JSON_API int json_object_set_move(struct json_value *object, const char *key, struct json_value *value,
+                                  struct json_value **previous)
+{
+    int key_length = json__strlen(key);
+    int index = json__object_find(object, key, key_length);
+    struct json_object_entry *entry;
+
+    if (previous != NULL)
+        *previous = NULL;
+
+    if (JSON__SHARED(object))
+        return -1;
+
+    if (index >= 0) {
+        JSON__CACHE_INVALIDATE(object);
+        if (previous != NULL)
+            *previous = object->object.items[index]->value;
+        else
+            json_free(object->object.items[index]->value);
+
+        object->object.items[index]->value = value;
+        return 0;
+    }
+
+    if (json__object_grow(object) != 0 || (entry = json__object_entry_new(key, key_length, value)) == NULL)
+        return -1;
+
+    JSON__CACHE_INVALIDATE(object);
+    object->object.items[object->object.n_items++] = entry;
+    return 0;
+}
+
+JSON_API struct json_value *json_object_take(struct json_value *object, const char *key)
+{
+    struct json_object_entry *entry;
+    struct json_value *value;
+    int index;
+
+    if (JSON__SHARED(object) || (index = json__object_find(object, key, json__strlen(key))) < 0)
+        return NULL;
+
+    entry = json__object_detach(object, index);
+    value = entry->value;
+    json__free_as(JSON_STATS_KEY, entry->key);
+    json__free_as(JSON_STATS_KEY, entry);
+    return value;
+}
+
+JSON_API struct json_value *json_array_take(struct json_value *array, int index)
+{
+    if (JSON__SHARED(array) || index < 0 || index >= array->array.length || json__array_unpack(array) != 0)
+        return NULL;
+
+    return json__array_detach(array, index);
+}
+
+JSON_API int json_array_append_all(struct json_value *dst, struct json_value *src)
+{
+    int length = dst->array.length + src->array.length;
+
+    // Elements cannot be moved into the array already owning them
+    if (dst == src || JSON__SHARED(dst) || JSON__SHARED(src))
+        return -1;
+
+    if (src->array.length == 0)
+        return 0;
+
+    // An empty destination takes the whole buffer over
+    if (dst->array.length == 0) {
+        json__free_as(JSON_STATS_ITEMS, dst->array.items);
+        JSON__CACHE_INVALIDATE(dst);
+        dst->type = src->type;
+        dst->array.items = src->array.items;
+        dst->array.length = src->array.length;
+        dst->array.capacity = src->array.capacity;
+        json_array_init(src);
+        return 0;
+    }
+
+    // Packed and regular elements do not mix
+    if (dst->type != src->type && (json__array_unpack(dst) != 0 || json__array_unpack(src) != 0))
+        return -1;
+
+    if (length > dst->array.capacity) {
+        int capacity = dst->array.capacity * JSON_ARRAY_CAPACITY_MULTIPLIER;
+        if (json_array_reserve(dst, capacity > length ? capacity : length) != 0)
+            return -1;
+    }
+
+    JSON__CACHE_INVALIDATE(dst);
+    memcpy((char *) dst->array.items + dst->array.length * JSON__ARRAY_ITEM_SIZE(dst), src->array.items,
+           src->array.length * JSON__ARRAY_ITEM_SIZE(src));
+    dst->array.length = length;
+
+    json__free_as(JSON_STATS_ITEMS, src->array.items);
+    json_array_init(src);
+    return 0;
+}
+
+static inline unsigned long long json__hash_mix(unsigned long long h)
+{
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+static unsigned long long json__hash_number(double number, unsigned long long seed)
+{
+    unsigned long long bits;
+
+    number = number == 0.0 ? 0.0 : number; // -0 == 0
+    memcpy(&bits, &number, sizeof(bits));
+    return json__hash_mix(seed ^ ((unsigned long long) JSON_TYPE_NUMBER << 56) ^ bits);
+}
+
+static unsigned long long json__hash_value(const struct json_value *value, unsigned long long seed)
+{
+    // Packed arrays hash like the regular arrays they stand for
+    int type = value->type == JSON_TYPE_NUMBER_ARRAY ? JSON_TYPE_ARRAY : value->type;
+    unsigned long long h = seed ^ ((unsigned long long) type << 56);
+#if defined(JSON_HASH_CACHE)
+    unsigned long long cached;
+#endif
+
+    switch (value->type) {
+    case JSON_TYPE_BOOLEAN:
+        return json__hash_mix(h ^ (value->number != 0.0));
+
+    case JSON_TYPE_NUMBER:
+        return json__hash_number(value->number, seed);
+
+    case JSON_TYPE_STRING:
+        return json__hash_bytes(value->string.value, value->string.length, h);
+
+    case JSON_TYPE_ARRAY:
+    case JSON_TYPE_NUMBER_ARRAY:
+#if defined(JSON_HASH_CACHE)
+        // Only frozen trees are sure to hold current hashes, an unfrozen one
+        // may have had a descendant modified in place
+        if (seed == JSON_HASH_SEED && value->frozen && (cached = JSON__ATOMIC_LOAD_HASH(&value->array.hash)) != 0)
+            return cached;
+#endif
+        h = json__hash_mix(h ^ value->array.length);
+        for (int i = 0; i < value->array.length; i++) {
+            if (value->type == JSON_TYPE_NUMBER_ARRAY)
+                h = json__hash_mix(h ^ json__hash_number(value->array.numbers[i], seed));
+            else
+                h = json__hash_mix(h ^ json__hash_value(value->array.items[i], seed));
+        }
+
+        h += h == 0; // 0 marks an unknown cached hash
+        return h;
+
+    case JSON_TYPE_OBJECT: {
+        // Members are summed so that their order does not matter
+        unsigned long long sum = 0;
+
+#if defined(JSON_HASH_CACHE)
+        if (seed == JSON_HASH_SEED && value->frozen && (cached = JSON__ATOMIC_LOAD_HASH(&value->object.hash)) != 0)
+            return cached;
+#endif
+        for (int i = 0; i < value->object.n_items; i++) {
+            const struct json_object_entry *entry = value->object.items[i];
+            unsigned long long key_hash = json__hash_bytes(entry->key, entry->key_length, seed);
+            sum += json__hash_mix(key_hash ^ json__hash_mix(json__hash_value(value->object.items[i]->value, seed)));
+        }
+
+        h = json__hash_mix(h ^ sum ^ value->object.n_items);
+        h += h == 0;
+        return h;
+    }
+
+    default:
+        return json__hash_mix(h);
+    }
+}
+
+static int json__equal(const struct json_value *a, const struct json_value *b);
+
+// Compares element `index` of two arrays, either of which may be packed
+static int json__array_element_equal(const struct json_value *a, const struct json_value *b, int index)
+{
+    const struct json_value *item;
+
+    if (a->type == JSON_TYPE_ARRAY && b->type == JSON_TYPE_ARRAY)
+        return json__equal(a->array.items[index], b->array.items[index]);
+
+    if (a->type == JSON_TYPE_NUMBER_ARRAY && b->type == JSON_TYPE_NUMBER_ARRAY)
+        return a->array.numbers[index] == b->array.numbers[index];
+
+    if (a->type == JSON_TYPE_NUMBER_ARRAY) {
+        const struct json_value *packed = a;
+        a = b;
+        b = packed;
+    }
+
+    item = a->array.items[index];
+    return item->type == JSON_TYPE_NUMBER && item->number == b->array.numbers[index];
+}
+
+static int json__equal(const struct json_value *a, const struct json_value *b)
+{
+    if (a == b)
+        return 1;
+
+    if (a->type != b->type && !(json_is_array(a) && json_is_array(b)))
+        return 0;
+
+#if defined(JSON_HASH_CACHE)
+    // Differing cached hashes settle it without descending. Only those of
+    // frozen trees are sure to be current, an unfrozen tree may have had a
+    // descendant modified in place
+    if (a->frozen && b->frozen) {
+        unsigned long long ha = 0, hb = 0;
+
+        if (json_is_array(a)) {
+            ha = JSON__ATOMIC_LOAD_HASH(&a->array.hash);
+            hb = JSON__ATOMIC_LOAD_HASH(&b->array.hash);
+        } else if (a->type == JSON_TYPE_OBJECT) {
+            ha = JSON__ATOMIC_LOAD_HASH(&a->object.hash);
+            hb = JSON__ATOMIC_LOAD_HASH(&b->object.hash);
+        }
+
+        if (ha != 0 && hb != 0 && ha != hb)
+            return 0;
+    }
+#endif
+
+    switch (a->type) {
+    case JSON_TYPE_BOOLEAN:
+        return (a->number != 0.0) == (b->number != 0.0);
+
+    case JSON_TYPE_NUMBER:
+        return a->number == b->number;
+
+    case JSON_TYPE_STRING:
+        return a->string.length == b->string.length
+               && memcmp(a->string.value, b->string.value, a->string.length) == 0;
+
+    case JSON_TYPE_ARRAY:
+    case JSON_TYPE_NUMBER_ARRAY:
+        if (a->array.length != b->array.length)
+            return 0;
+
+        for (int i = 0; i < a->array.length; i++)
+            if (!json__array_element_equal(a, b, i))
+                return 0;
+        return 1;
+
+    case JSON_TYPE_OBJECT:
+        if (a->object.n_items != b->object.n_items)
+            return 0;
+
+        for (int i = 0; i < a->object.n_items; i++) {
+            const struct json_object_entry *entry = a->object.items[i];
+            int index = json__object_lookup(b, entry->key, entry->key_length);
+            if (index < 0 || !json__equal(a->object.items[i]->value, b->object.items[index]->value))
+                return 0;
+        }
+        return 1;
+
+    default:
+        return 1;
+    }
+}
+
+JSON_API unsigned long long json_hash(const struct json_value *value)
+{
+    return json__hash_value(value, JSON_HASH_SEED);
+}
+
+JSON_API unsigned long long json_hash_seeded(const struct json_value *value, unsigned long long seed)
+{
+    return json__hash_value(value, seed);
+}
+
+JSON_API int json_equal(const struct json_value *a, const struct json_value *b)
+{
+    return json__equal(a, b);
+}
+
+#if defined(JSON_HASH_CACHE)
+JSON_API void json_hash_invalidate(struct json_value *value)
+{
+    if (value->type == JSON_TYPE_NUMBER_ARRAY) {
+        value->array.hash = 0;
+    } else if (value->type == JSON_TYPE_ARRAY) {
+        value->array.hash = 0;
+        for (int i = 0; i < value->array.length; i++)
+            json_hash_invalidate(value->array.items[i]);
+    } else if (value->type == JSON_TYPE_OBJECT) {
+        value->object.hash = 0;
+        for (int i = 0; i < value->object.n_items; i++)
+            json_hash_invalidate(value->object.items[i]->value);
+    }
+}
+#endif
+
+static int json__freeze(struct json_value *value)
+{
+#if defined(JSON_HASH_CACHE)
+    unsigned long long h;
+#endif
+
+    switch (value->type) {
+    case JSON_TYPE_NUMBER_ARRAY:
+        if (json__array_unpack(value) != 0)
+            return -1;
+        break;
+
+    case JSON_TYPE_ARRAY:
+        for (int i = 0; i < value->array.length; i++)
+            if (json__freeze(value->array.items[i]) != 0)
+                return -1;
+        break;
+
+    case JSON_TYPE_OBJECT:
+        for (int i = 0; i < value->object.n_items; i++)
+            if (json__freeze(value->object.items[i]->value) != 0)
+                return -1;
+#if defined(JSON_INDEX)
+        if (value->object.n_items >= JSON_INDEX_THRESHOLD && !value->frozen && json__object_index_get(value) == NULL)
+            return -1;
+#endif
+        break;
+
+    default:
+        return 0;
+    }
+
+#if defined(JSON_HASH_CACHE) || defined(JSON_INDEX)
+# if defined(JSON_HASH_CACHE)
+    // The children are frozen with their hashes by now, so this only combines
+    // them; the node's own mark is dropped so a refreeze does not reuse its hash
+    value->frozen = 0;
+    h = json_hash(value);
+    if (value->type == JSON_TYPE_OBJECT)
+        JSON__ATOMIC_STORE_HASH(&value->object.hash, h);
+    else
+        JSON__ATOMIC_STORE_HASH(&value->array.hash, h);
+# endif
+    value->frozen = 1;
+#endif
+    return 0;
+}
+
+JSON_API int json_freeze(struct json_value *value)
+{
+    return json__freeze(value);
+}
+
+#if defined(JSON_REFCOUNT)
+struct json__cache_entry
+{
+    unsigned long long hash;
+    char *input; // Copy of the input, compared on every hit
+    int length;
+    struct json_value *value;
+    struct json__cache_entry *chain; // Next entry in the same bucket
+    struct json__cache_entry *newer;
+    struct json__cache_entry *older;
+};
+
+struct json__cache_shard
+{
+#if defined(JSON_THREADS)
+    pthread_mutex_t lock;
+#endif
+    struct json__cache_entry **buckets;
+    int bucket_mask;
+    int entries;
+    struct json__cache_entry *newest;
+    struct json__cache_entry *oldest;
+    size_t bytes;
+    size_t capacity;
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;
+};
+
+struct json_cache
+{
+    struct json__cache_shard shards[JSON_CACHE_SHARDS];
+};
+
+static void json__cache_lock(struct json__cache_shard *shard)
+{
+#if defined(JSON_THREADS)
+    pthread_mutex_lock(&shard->lock);
+#else
+    (void) shard;
+#endif
+}
+
+static void json__cache_unlock(struct json__cache_shard *shard)
+{
+#if defined(JSON_THREADS)
+    pthread_mutex_unlock(&shard->lock);
+#else
+    (void) shard;
+#endif
+}
+
+static void json__cache_unlink(struct json__cache_shard *shard, struct json__cache_entry *entry)
+{
+    if (entry->newer != NULL)
+        entry->newer->older = entry->older;
+    else
+        shard->newest = entry->older;
+
+    if (entry->older != NULL)
+        entry->older->newer = entry->newer;
+    else
+        shard->oldest = entry->newer;
+}
+
+static void json__cache_push(struct json__cache_shard *shard, struct json__cache_entry *entry)
+{
+    entry->newer = NULL;
+    entry->older = shard->newest;
+    if (shard->newest != NULL)
+        shard->newest->newer = entry;
+    else
+        shard->oldest = entry;
+    shard->newest = entry;
+}
+
+static struct json__cache_entry *json__cache_find(struct json__cache_shard *shard, unsigned long long hash,
+                                                  const char *json, int length)
+{
+    struct json__cache_entry *entry = shard->buckets[hash & shard->bucket_mask];
+
+    for (; entry != NULL; entry = entry->chain) {
+        if (entry->hash == hash && entry->length == length && memcmp(entry->input, json, (size_t) length) == 0)
+            return entry;
+    }
+
+    return NULL;
+}
+
+// Doubles the bucket array, keeps the old one if memory runs out
+static void json__cache_grow(struct json__cache_shard *shard)
+{
+    int mask = shard->bucket_mask * 2 + 1;
+    struct json__cache_entry **buckets;
+
+    buckets = (struct json__cache_entry **) json_alloc(sizeof(struct json__cache_entry *) * (mask + 1));
+    if (buckets == NULL)
+        return;
+
+    memset(buckets, 0, sizeof(struct json__cache_entry *) * (mask + 1));
+    for (int i = 0; i <= shard->bucket_mask; i++) {
+        struct json__cache_entry *entry = shard->buckets[i], *next;
+
+        for (; entry != NULL; entry = next) {
+            next = entry->chain;
+            entry->chain = buckets[entry->hash & mask];
+            buckets[entry->hash & mask] = entry;
+        }
+    }
+
+    json__free(shard->buckets);
+    shard->buckets = buckets;
+    shard->bucket_mask = mask;
+}
+
+static void json__cache_evict(struct json__cache_shard *shard, struct json__cache_entry *entry)
+{
+    struct json__cache_entry **link = &shard->buckets[entry->hash & shard->bucket_mask];
+
+    while (*link != entry)
+        link = &(*link)->chain;
+    *link = entry->chain;
+
+    json__cache_unlink(shard, entry);
+    shard->entries--;
+    shard->bytes -= (size_t) entry->length;
+    json_release(entry->value);
+    json__free(entry->input);
+    json__free(entry);
+}
+
+JSON_API struct json_cache *json_cache_new(size_t capacity)
+{
+    struct json_cache *cache = (struct json_cache *) json_alloc(sizeof(struct json_cache));
+
+    if (cache == NULL)
+        return NULL;
+
+    memset(cache, 0, sizeof(*cache));
+    for (int i = 0; i < JSON_CACHE_SHARDS; i++) {
+        struct json__cache_shard *shard = &cache->shards[i];
+
+        shard->bucket_mask = 15;
+        shard->capacity = capacity / JSON_CACHE_SHARDS;
+        shard->buckets = (struct json__cache_entry **) json_alloc(sizeof(struct json__cache_entry *) * 16);
+        if (shard->buckets == NULL) {
+            json_cache_free(cache);
+            return NULL;
+        }
+        memset(shard->buckets, 0, sizeof(struct json__cache_entry *) * 16);
+#if defined(JSON_THREADS)
+        pthread_mutex_init(&shard->lock, NULL);
+#endif
+    }
+
+    return cache;
+}
+
+JSON_API void json_cache_free(struct json_cache *cache)
+{
+    if (cache == NULL)
+        return;
+
+    for (int i = 0; i < JSON_CACHE_SHARDS; i++) {
+        struct json__cache_shard *shard = &cache->shards[i];
+
+        // A shard without buckets was never initialized
+        if (shard->buckets == NULL)
+            break;
+
+        while (shard->oldest != NULL)
+            json__cache_evict(shard, shard->oldest);
+        json__free(shard->buckets);
+#if defined(JSON_THREADS)
+        pthread_mutex_destroy(&shard->lock);
+#endif
+    }
+
+    json__free(cache);
+}
+
+JSON_API struct json_value *json_cache_decode(struct json_cache *cache, const char *json, int length)
+{
+    unsigned long long hash = json__hash_bytes(json, (size_t) length, JSON_HASH_SEED);
+    struct json__cache_shard *shard = &cache->shards[(hash >> 32) & (JSON_CACHE_SHARDS - 1)];
+    struct json__cache_entry *entry;
+    struct json_value *value;
+
+    json__cache_lock(shard);
+    if ((entry = json__cache_find(shard, hash, json, length)) != NULL) {
+        shard->hits++;
+        json__cache_unlink(shard, entry);
+        json__cache_push(shard, entry);
+        value = json_retain(entry->value);
+        json__cache_unlock(shard);
+        return value;
+    }
+    shard->misses++;
+    json__cache_unlock(shard);
+
+    // Decode without holding the lock, other lookups in the shard go on meanwhile
+    if ((value = json_decode_with_length(json, length)) == NULL)
+        return NULL;
+
+    if ((size_t) length > shard->capacity || json_freeze(value) != 0)
+        return value;
+
+    if ((entry = (struct json__cache_entry *) json_alloc(sizeof(struct json__cache_entry))) == NULL)
+        return value;
+
+    if ((entry->input = (char *) json_alloc((size_t) length + 1)) == NULL) {
+        json__free(entry);
+        return value;
+    }
+
+    memcpy(entry->input, json, (size_t) length);
+    entry->input[length] = '\0';
+    entry->hash = hash;
+    entry->length = length;
+    entry->value = value;
+
+    json__cache_lock(shard);
+    {
+        struct json__cache_entry *other = json__cache_find(shard, hash, json, length);
+
+        // Another thread decoded the same input first, share its tree
+        if (other != NULL) {
+            struct json_value *shared = json_retain(other->value);
+
+            json__cache_unlock(shard);
+            json_release(value);
+            json__free(entry->input);
+            json__free(entry);
+            return shared;
+        }
+    }
+
+    while (shard->oldest != NULL && shard->bytes + (size_t) length > shard->capacity) {
+        json__cache_evict(shard, shard->oldest);
+        shard->evictions++;
+    }
+
+    if (shard->entries > shard->bucket_mask)
+        json__cache_grow(shard);
+
+    entry->chain = shard->buckets[hash & shard->bucket_mask];
+    shard->buckets[hash & shard->bucket_mask] = entry;
+    json__cache_push(shard, entry);
+    shard->entries++;
+    shard->bytes += (size_t) length;
+    json_retain(value);
+    json__cache_unlock(shard);
+
+    return value;
+}
+
+JSON_API void json_cache_stats(struct json_cache *cache, struct json_cache_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    for (int i = 0; i < JSON_CACHE_SHARDS; i++) {
+        struct json__cache_shard *shard = &cache->shards[i];
+
+        json__cache_lock(shard);
+        stats->hits += shard->hits;
+        stats->misses += shard->misses;
+        stats->evictions += shard->evictions;
+        stats->bytes += shard->bytes;
+        stats->entries += shard->entries;
+        json__cache_unlock(shard);
+    }
+}
+#endif
+
+// Decodes `~0` and `~1` in a reference token, returns the decoded length or -1
+static int json__pointer_unescape(const char *token, int length, char *buffer)
+{
+    int n = 0;
+
+    for (int i = 0; i < length; i++) {
+        if (token[i] != '~') {
+            buffer[n++] = token[i];
+        } else if (i + 1 < length && (token[i + 1] == '0' || token[i + 1] == '1')) {
+            buffer[n++] = token[++i] == '0' ? '~' : '/';
+        } else {
+            return -1;
+        }
+    }
+
+    return n;
+}
+
+// Parses an array index token, `-` refers to the end of the array
+static int json__pointer_index(const char *token, int length, int count)
+{
+    int index = 0;
+
+    if (length == 1 && token[0] == '-')
+        return count;
+
+    if (length == 0 || (length > 1 && token[0] == '0'))
+        return -1;
+
+    for (int i = 0; i < length; i++) {
+        if (token[i] < '0' || token[i] > '9')
+            return -1;
+
+        index = index * 10 + (token[i] - '0');
+        if (index > count)
+            return -1;
+    }
+
+    return index;
+}
+
+static int json__pointer_member(const struct json_value *object, const char *token, int length)
+{
+    char small[128];
+    char *key;
+    int index = -1, key_length;
+
+    if (memchr(token, '~', length) == NULL)
+        return json__object_lookup(object, token, length);
+
+    if ((key = length < (int) sizeof(small) ? small : (char *) json_alloc(length + 1)) == NULL)
+        return -1;
+
+    if ((key_length = json__pointer_unescape(token, length, key)) >= 0)
+        index = json__object_lookup(object, key, key_length);
+
+    if (key != small)
+        json__free(key);
+    return index;
+}
+
+// Containers along the way lose their cached hash when `invalidate` is set
+static struct json_value *json__pointer_get(struct json_value *root, const char *path, int length, int invalidate)
+{
+    struct json_value *value = root;
+    int start = 0;
+
+    if (length > 0 && path[0] != '/')
+        return NULL;
+
+    while (value != NULL && start < length) {
+        int end = start + 1, index;
+        while (end < length && path[end] != '/')
+            end++;
+
+        if (invalidate && (json_is_array(value) || value->type == JSON_TYPE_OBJECT))
+            JSON__CACHE_INVALIDATE(value);
+
+        if (json__array_unpack(value) != 0)
+            return NULL;
+
+        if (value->type == JSON_TYPE_ARRAY) {
+            index = json__pointer_index(path + start + 1, end - start - 1, value->array.length);
+            value = index >= 0 && index < value->array.length ? value->array.items[index] : NULL;
+        } else if (value->type == JSON_TYPE_OBJECT) {
+            index = json__pointer_member(value, path + start + 1, end - start - 1);
+            value = index >= 0 ? value->object.items[index]->value : NULL;
+        } else {
+            value = NULL;
+        }
+
+        start = end;
+    }
+
+    return value;
+}
+
+// Resolves the container holding the last reference token of `path`
+static struct json_value *json__pointer_parent(struct json_value *root, const char *path, int length,
+                                               const char **token, int *token_length)
+{
+    struct json_value *parent;
+    int slash = length - 1;
+
+    while (slash >= 0 && path[slash] != '/')
+        slash--;
+
+    if (slash < 0)
+        return NULL;
+
+    *token = path + slash + 1;
+    *token_length = length - slash - 1;
+    parent = json__pointer_get(root, path, slash, 1);
+
+    // The parent is modified through its element nodes
+    if (parent != NULL && json__array_unpack(parent) != 0)
+        return NULL;
+    return parent;
+}
+
+enum
+{
+    JSON__PATCH_UNDO_INSERT,  // Undo by detaching, `owned` frees the value
+    JSON__PATCH_UNDO_REPLACE, // Undo by restoring `value`, `owned` frees the replacement
+    JSON__PATCH_UNDO_REMOVE,  // Undo by reinserting, `owned` frees the value on commit
+    JSON__PATCH_UNDO_ROOT     // Undo by swapping the root contents back from `value`
+};
+
+struct json__patch_undo
+{
+    int action;
+    int owned;
+    int index;
+    struct json_value *container;
+    struct json_value *value;
+    struct json_object_entry *entry;
+};
+
+struct json__patch_log
+{
+    struct json__patch_undo *entries;
+    int length;
+    int capacity;
+};
+
+// Reserving before an operation mutates anything guarantees it can be logged
+static int json__patch_log_reserve(struct json__patch_log *log, int count)
+{
+    if (log->length + count > log->capacity) {
+        int capacity = log->capacity ? log->capacity * 2 : 16;
+        void *entries;
+
+        if ((entries = json_realloc(log->entries, capacity * sizeof(*log->entries))) == NULL)
+            return -1;
+
+        log->entries = (struct json__patch_undo *) entries;
+        log->capacity = capacity;
+    }
+
+    return 0;
+}
+
+static int json__patch_log(struct json__patch_log *log, int action, struct json_value *container, int index,
+                           struct json_value *value, struct json_object_entry *entry, int owned)
+{
+    struct json__patch_undo *undo = &log->entries[log->length++];
+
+    undo->action = action;
+    undo->owned = owned;
+    undo->index = index;
+    undo->container = container;
+    undo->value = value;
+    undo->entry = entry;
+    return 0;
+}
+
+static void json__patch_undo(struct json__patch_undo *undo)
+{
+    struct json_value *container = undo->container, *value = NULL, holder;
+
+    switch (undo->action) {
+    case JSON__PATCH_UNDO_INSERT:
+        if (container->type == JSON_TYPE_ARRAY) {
+            value = json__array_detach(container, undo->index);
+        } else {
+            struct json_object_entry *entry = json__object_detach(container, undo->index);
+            value = entry->value;
+            json__free_as(JSON_STATS_KEY, entry->key);
+            json__free_as(JSON_STATS_KEY, entry);
+        }
+        break;
+
+    case JSON__PATCH_UNDO_REPLACE:
+        JSON__CACHE_INVALIDATE(container);
+        if (container->type == JSON_TYPE_ARRAY) {
+            value = container->array.items[undo->index];
+            container->array.items[undo->index] = undo->value;
+        } else {
+            value = container->object.items[undo->index]->value;
+            container->object.items[undo->index]->value = undo->value;
+        }
+        break;
+
+    case JSON__PATCH_UNDO_REMOVE:
+        // The slot freed by the removal is still allocated
+        if (container->type == JSON_TYPE_ARRAY)
+            json__array_place(container, undo->index, undo->value);
+        else
+            json__object_place(container, undo->index, undo->entry);
+        return;
+
+    case JSON__PATCH_UNDO_ROOT:
+        holder = *container;
+        json__value_assign(container, undo->value);
+        json__value_assign(undo->value, &holder);
+        json_free(undo->value);
+        return;
+    }
+
+    if (undo->owned)
+        json_free(value);
+}
+
+static void json__patch_commit(struct json__patch_undo *undo)
+{
+    switch (undo->action) {
+    case JSON__PATCH_UNDO_REPLACE:
+    case JSON__PATCH_UNDO_ROOT:
+        json_free(undo->value);
+        break;
+
+    case JSON__PATCH_UNDO_REMOVE:
+        if (undo->entry != NULL) {
+            json__free_as(JSON_STATS_KEY, undo->entry->key);
+            json__free_as(JSON_STATS_KEY, undo->entry);
+        }
+        if (undo->owned)
+            json_free(undo->value);
+        break;
+
+    default:
+        break;
+    }
+}
+
+// Replaces the contents of the root node, `value` must be exclusively owned
+static int json__patch_root(struct json_value *doc, struct json_value *value, struct json__patch_log *log)
+{
+    struct json_value *holder;
+
+    if ((holder = json__value_alloc()) == NULL)
+        return -1;
+
+    json__value_assign(holder, doc);
+    json__value_assign(doc, value);
+    json__free_as(JSON_STATS_NODE, value);
+    return json__patch_log(log, JSON__PATCH_UNDO_ROOT, doc, 0, holder, NULL, 1);
+}
+
+static int json__patch_add(struct json_value *doc, const char *path, int length, struct json_value *value, int owned,
+                           struct json__patch_log *log)
+{
+    struct json_value *parent;
+    const char *token;
+    int token_length, index;
+
+    if (length == 0)
+        return json__patch_root(doc, value, log);
+
+    if ((parent = json__pointer_parent(doc, path, length, &token, &token_length)) == NULL)
+        return -1;
+
+    if (parent->type == JSON_TYPE_ARRAY) {
+        if ((index = json__pointer_index(token, token_length, parent->array.length)) < 0
+            || json__array_grow(parent) != 0)
+            return -1;
+
+        json__array_place(parent, index, value);
+        return json__patch_log(log, JSON__PATCH_UNDO_INSERT, parent, index, value, NULL, owned);
+    }
+
+    if (parent->type != JSON_TYPE_OBJECT)
+        return -1;
+
+    if ((index = json__pointer_member(parent, token, token_length)) >= 0) {
+        struct json_value *previous = parent->object.items[index]->value;
+        JSON__CACHE_INVALIDATE(parent);
+        parent->object.items[index]->value = value;
+        return json__patch_log(log, JSON__PATCH_UNDO_REPLACE, parent, index, previous, NULL, owned);
+    } else {
+        struct json_object_entry *entry;
+        char *key;
+        int key_length;
+
+        if ((key = (char *) json__alloc_as(JSON_STATS_KEY, token_length + 1)) == NULL)
+            return -1;
+
+        if ((key_length = json__pointer_unescape(token, token_length, key)) < 0
+            || (entry = json__object_entry_new(key, key_length, value)) == NULL) {
+            json__free_as(JSON_STATS_KEY, key);
+            return -1;
+        }
+
+        json__free_as(JSON_STATS_KEY, key);
+        if (json__object_grow(parent) != 0) {
+            json__free_as(JSON_STATS_KEY, entry->key);
+            json__free_as(JSON_STATS_KEY, entry);
+            return -1;
+        }
+
+        json__object_place(parent, parent->object.n_items, entry);
+        return json__patch_log(log, JSON__PATCH_UNDO_INSERT, parent, parent->object.n_items - 1, value, NULL, owned);
+    }
+}
+
+// Detaches the value at `path`, when `removed` is set the caller takes it over
+static int json__patch_remove(struct json_value *doc, const char *path, int length, struct json_value **removed,
+                              struct json__patch_log *log)
+{
+    struct json_value *parent, *value;
+    struct json_object_entry *entry = NULL;
+    const char *token;
+    int token_length, index;
+
+    if ((parent = json__pointer_parent(doc, path, length, &token, &token_length)) == NULL)
+        return -1;
 
-static int json__strlen(const char *str)
+    if (parent->type == JSON_TYPE_ARRAY) {
+        index = json__pointer_index(token, token_length, parent->array.length);
+        if (index < 0 || index >= parent->array.length)
+            return -1;
+
+        value = json__array_detach(parent, index);
+    } else if (parent->type == JSON_TYPE_OBJECT) {
+        if ((index = json__pointer_member(parent, token, token_length)) < 0)
+            return -1;
+
+        entry = json__object_detach(parent, index);
+        value = entry->value;
+    } else {
+        return -1;
+    }
+
+    if (removed != NULL)
+        *removed = value;
+    return json__patch_log(log, JSON__PATCH_UNDO_REMOVE, parent, index, value, entry, removed == NULL);
+}
+
+static int json__patch_replace(struct json_value *doc, const char *path, int length, struct json_value *value,
+                               struct json__patch_log *log)
 {
-    int len = 0;
-    while (*str++)
-        len++;
-    return len;
+    struct json_value *parent, **slot;
+    const char *token;
+    int token_length, index;
+
+    if (length == 0)
+        return json__patch_root(doc, value, log);
+
+    if ((parent = json__pointer_parent(doc, path, length, &token, &token_length)) == NULL)
+        return -1;
+
+    if (parent->type == JSON_TYPE_ARRAY) {
+        index = json__pointer_index(token, token_length, parent->array.length);
+        if (index < 0 || index >= parent->array.length)
+            return -1;
+
+        slot = &parent->array.items[index];
+    } else if (parent->type == JSON_TYPE_OBJECT) {
+        if ((index = json__pointer_member(parent, token, token_length)) < 0)
+            return -1;
+
+        slot = &parent->object.items[index]->value;
+    } else {
+        return -1;
+    }
+
+    json__patch_log(log, JSON__PATCH_UNDO_REPLACE, parent, index, *slot, NULL, 1);
+    JSON__CACHE_INVALIDATE(parent);
+    *slot = value;
+    return 0;
 }
 
-static int json__streq(const char *s1, const char *s2)
+static int json__patch_operation(struct json_value *doc, struct json_value *operation, struct json__patch_log *log)
 {
-    if (json__strlen(s1) != json__strlen(s2))
-        return 0;
+    struct json_value *op, *path, *from, *value, *copy;
+    const char *name;
 
-    while (*s1 && *s1 == *s2) {
-        s1++;
-        s2++;
+    if (!json_is_object(operation) || json__patch_log_reserve(log, 2) != 0)
+        return -1;
+
+    op = json_object_get(operation, "op");
+    path = json_object_get(operation, "path");
+    from = json_object_get(operation, "from");
+    value = json_object_get(operation, "value");
+
+    if (!json_is_string(op) || !json_is_string(path))
+        return -1;
+
+    name = op->string.value;
+
+    if (json__streq(name, "remove")) {
+        if (path->string.length == 0)
+            return -1;
+
+        return json__patch_remove(doc, path->string.value, path->string.length, NULL, log);
     }
 
-    if (*s1 == 0 && *s2 == 0)
-        return 1;
+    if (json__streq(name, "test")) {
+        struct json_value *target = json__pointer_get(doc, path->string.value, path->string.length, 0);
+        return value != NULL && target != NULL && json__equal(target, value) ? 0 : -1;
+    }
+
+    if (json__streq(name, "move")) {
+        struct json_value *moved;
+
+        if (!json_is_string(from) || json__pointer_get(doc, from->string.value, from->string.length, 0) == NULL)
+            return -1;
+
+        if (json__streq(from->string.value, path->string.value))
+            return 0;
+
+        // A value cannot be moved into one of its own children
+        if (path->string.length > from->string.length
+            && strncmp(path->string.value, from->string.value, from->string.length) == 0
+            && path->string.value[from->string.length] == '/')
+            return -1;
+
+        // Moving to the root discards everything else, including the source
+        if (path->string.length > 0) {
+            if (json__patch_remove(doc, from->string.value, from->string.length, &moved, log) != 0)
+                return -1;
+
+            return json__patch_add(doc, path->string.value, path->string.length, moved, 0, log);
+        }
+    }
+
+    if (json__streq(name, "copy") || json__streq(name, "move")) {
+        if (!json_is_string(from))
+            return -1;
+
+        value = json__pointer_get(doc, from->string.value, from->string.length, 0);
+    } else if (!json__streq(name, "add") && !json__streq(name, "replace")) {
+        return -1;
+    }
+
+    if (value == NULL || (copy = json_deep_copy(value)) == NULL)
+        return -1;
+
+    if ((json__streq(name, "replace") ? json__patch_replace(doc, path->string.value, path->string.length, copy, log)
+                                      : json__patch_add(doc, path->string.value, path->string.length, copy, 1, log))
+        != 0) {
+        json_free(copy);
+        return -1;
+    }
 
     return 0;
 }
 
-static int json__streqn(const char *s1, const char *s2, int limit)
+JSON_API int json_patch_apply(struct json_value *doc, struct json_value *patch)
 {
-    while (*s1 && *s2 && *s1 == *s2 && limit-- > 1) {
-        s1++;
-        s2++;
+    struct json__patch_log log;
+    int rc = 0;
+
+    if (doc == NULL || !json_is_array(patch) || json__array_unpack(patch) != 0)
+        return -1;
+
+    log.entries = NULL;
+    log.length = 0;
+    log.capacity = 0;
+
+    for (int i = 0; rc == 0 && i < patch->array.length; i++)
+        rc = json__patch_operation(doc, patch->array.items[i], &log);
+
+    if (rc != 0) {
+        for (int i = log.length - 1; i >= 0; i--)
+            json__patch_undo(&log.entries[i]);
+    } else {
+        for (int i = 0; i < log.length; i++)
+            json__patch_commit(&log.entries[i]);
     }
 
-    return *s1 == *s2 ? 1 : 0;
+    json__free(log.entries);
+    return rc;
 }
 
-static void json__parse_whitespace(struct json_parser *parser)
+struct json__diff
 {
-    const char *ptr = parser->input;
-    int pos = parser->position;
-    int len = parser->length;
+    struct json_value *ops;
+    char *path;
+    int length;
+    int capacity;
+};
 
-    while (pos < len && (ptr[pos] == ' ' || ptr[pos] == '\t' || ptr[pos] == '\n' || ptr[pos] == '\r'))
-        pos++;
+// Appends an escaped reference token to the current path
+static int json__diff_push(struct json__diff *diff, const char *token, int length)
+{
+    if (diff->length + length * 2 + 2 > diff->capacity) {
+        int capacity = (diff->length + length * 2 + 2) * 2;
+        char *path;
 
-    parser->position = pos;
+        if ((path = (char *) json_realloc(diff->path, capacity)) == NULL)
+            return -1;
+
+        diff->path = path;
+        diff->capacity = capacity;
+    }
+
+    diff->path[diff->length++] = '/';
+    for (int i = 0; i < length; i++) {
+        if (token[i] == '~' || token[i] == '/') {
+            diff->path[diff->length++] = '~';
+            diff->path[diff->length++] = token[i] == '~' ? '0' : '1';
+        } else {
+            diff->path[diff->length++] = token[i];
+        }
+    }
+
+    diff->path[diff->length] = '\0';
+    return 0;
 }
 
-static int json__decode_string(struct json_parser *parser, struct json_value *value)
+static int json__diff_push_index(struct json__diff *diff, int index)
 {
-    int start = parser->position + 1;
-    int end = start;
-    int buffer_size = 16;
-    int buffer_length = 0;
-    char *buffer = (char *) json_alloc(buffer_size);
+    char buffer[16];
+    return json__diff_push(diff, buffer, snprintf(buffer, sizeof(buffer), "%d", index));
+}
 
-    if (buffer == NULL) {
-        JSON_PARSER_ERROR(parser, JSON_ERROR_MEMORY, "Memory allocation failed");
+static int json__diff_emit(struct json__diff *diff, const char *op, struct json_value *value)
+{
+    struct json_value *operation, *copy = NULL;
+
+    if ((operation = json_object_new()) == NULL)
+        return -1;
+
+    if (json_object_set(operation, "op", json_string_new(op)) != 0
+        || json_object_set(operation, "path", json_string_new(diff->path)) != 0
+        || (value != NULL
+            && ((copy = json_deep_copy(value)) == NULL || json_object_set(operation, "value", copy) != 0))
+        || json_array_push(diff->ops, operation) != 0) {
+        json_free(operation);
         return -1;
     }
 
-    while (end < parser->length && parser->input[end] != '"') {
-        if (parser->input[end] == '\\') {
-            end++;
-            if (end >= parser->length) {
-                json__free(buffer);
-                JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX, "Unterminated escape sequence");
-                return -1;
-            }
+    return 0;
+}
 
-            if (parser->input[end] == 'u') {
-                // Handle \uXXXX Unicode escape sequences
-                end++;
-                if (end + 3 >= parser->length) {
-                    json__free(buffer);
-                    JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX, "Incomplete Unicode escape sequence");
-                    return -1;
-                }
+static int json__diff_value(struct json__diff *diff, struct json_value *a, struct json_value *b)
+{
+    int length = diff->length, rc = 0;
 
-                // Parse 4 hex digits
-                unsigned int code_point = 0;
-                for (int i = 0; i < 4; i++) {
-                    char c = parser->input[end + i];
-                    code_point <<= 4;
+    // Packed arrays are only unpacked when their elements need to be diffed
+    if (json_is_array(a) && json_is_array(b) && (a->type != b->type || a->type == JSON_TYPE_NUMBER_ARRAY)) {
+        if (json__equal(a, b))
+            return 0;
+        if (json__array_unpack(a) != 0 || json__array_unpack(b) != 0)
+            return -1;
+    }
 
-                    if (c >= '0' && c <= '9') {
-                        code_point |= (c - '0');
-                    } else if (c >= 'a' && c <= 'f') {
-                        code_point |= (c - 'a' + 10);
-                    } else if (c >= 'A' && c <= 'F') {
-                        code_point |= (c - 'A' + 10);
-                    } else {
-                        json__free(buffer);
-                        JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX, "Invalid hex digit in Unicode escape");
-                        return -1;
-                    }
-                }
+    if (a->type != b->type || (a->type != JSON_TYPE_ARRAY && a->type != JSON_TYPE_OBJECT))
+        return json__equal(a, b) ? 0 : json__diff_emit(diff, "replace", b);
 
-                // Check for surrogate pair
-                if (code_point >= 0xD800 && code_point <= 0xDBFF) {
-                    // High surrogate - need to get the low surrogate
-                    end += 4; // Move past the first \uXXXX
+    if (a->type == JSON_TYPE_OBJECT) {
+        for (int i = 0; rc == 0 && i < a->object.n_items; i++) {
+            const char *key = a->object.items[i]->key;
+            int key_length = a->object.items[i]->key_length;
+            int index = json__object_lookup(b, key, key_length);
 
-                    // Check for the sequence \uYYYY where YYYY is the low surrogate
-                    if (end + 1 >= parser->length || parser->input[end] != '\\' || parser->input[end + 1] != 'u') {
-                        json__free(buffer);
-                        JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX, "Expected low surrogate after high surrogate");
-                        return -1;
-                    }
+            if ((rc = json__diff_push(diff, key, key_length)) == 0)
+                rc = index < 0 ? json__diff_emit(diff, "remove", NULL)
+                               : json__diff_value(diff, a->object.items[i]->value, b->object.items[index]->value);
 
-                    end += 2; // Move past \u
-                    if (end + 3 >= parser->length) {
-                        json__free(buffer);
-                        JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX,
-                                          "Incomplete Unicode escape sequence for low surrogate");
-                        return -1;
-                    }
+            diff->length = length;
+            diff->path[length] = '\0';
+        }
 
-                    // Parse 4 hex digits for low surrogate
-                    unsigned int low_surrogate = 0;
-                    for (int i = 0; i < 4; i++) {
-                        char c = parser->input[end + i];
-                        low_surrogate <<= 4;
+        for (int i = 0; rc == 0 && i < b->object.n_items; i++) {
+            const char *key = b->object.items[i]->key;
+            int key_length = b->object.items[i]->key_length;
 
-                        if (c >= '0' && c <= '9') {
-                            low_surrogate |= (c - '0');
-                        } else if (c >= 'a' && c <= 'f') {
-                            low_surrogate |= (c - 'a' + 10);
-                        } else if (c >= 'A' && c <= 'F') {
-                            low_surrogate |= (c - 'A' + 10);
-                        } else {
-                            json__free(buffer);
-                            JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX, "Invalid hex digit in low surrogate");
-                            return -1;
-                        }
-                    }
+            if (json__object_lookup(a, key, key_length) >= 0)
+                continue;
 
-                    // Validate low surrogate range
-                    if (low_surrogate < 0xDC00 || low_surrogate > 0xDFFF) {
-                        json__free(buffer);
-                        JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX, "Invalid low surrogate value");
-                        return -1;
-                    }
+            if ((rc = json__diff_push(diff, key, key_length)) == 0)
+                rc = json__diff_emit(diff, "add", b->object.items[i]->value);
 
-                    // Combine surrogate pair to get actual code point
-                    code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low_surrogate - 0xDC00);
-                    end += 4; // Move past the second \uXXXX
-                } else {
-                    end += 4; // Move past \uXXXX for non-surrogate case
-                }
+            diff->length = length;
+            diff->path[length] = '\0';
+        }
 
-                // Encode code point as UTF-8
-                if (code_point < 0x80) {
-                    // 1-byte character
-                    if (buffer_length + 1 >= buffer_size) {
-                        buffer_size *= 2;
-                        char *new_buffer = (char *) json_realloc(buffer, buffer_size);
-                        if (new_buffer == NULL) {
-                            json__free(buffer);
-                            JSON_PARSER_ERROR(parser, JSON_ERROR_MEMORY, "Memory allocation failed");
-                            return -1;
-                        }
-                        buffer = new_buffer;
-                    }
-                    buffer[buffer_length++] = (char) code_point;
-                } else if (code_point < 0x800) {
-                    // 2-byte character
-                    if (buffer_length + 2 >= buffer_size) {
-                        buffer_size *= 2;
-                        char *new_buffer = (char *) json_realloc(buffer, buffer_size);
-                        if (new_buffer == NULL) {
-                            json__free(buffer);
-                            JSON_PARSER_ERROR(parser, JSON_ERROR_MEMORY, "Memory allocation failed");
-                            return -1;
-                        }
-                        buffer = new_buffer;
-                    }
-                    buffer[buffer_length++] = (char) (0xC0 | (code_point >> 6));
-                    buffer[buffer_length++] = (char) (0x80 | (code_point & 0x3F));
-                } else if (code_point < 0x10000) {
-                    // 3-byte character
-                    if (buffer_length + 3 >= buffer_size) {
-                        buffer_size *= 2;
-                        char *new_buffer = (char *) json_realloc(buffer, buffer_size);
-                        if (new_buffer == NULL) {
-                            json__free(buffer);
-                            JSON_PARSER_ERROR(parser, JSON_ERROR_MEMORY, "Memory allocation failed");
-                            return -1;
-                        }
-                        buffer = new_buffer;
-                    }
-                    buffer[buffer_length++] = (char) (0xE0 | (code_point >> 12));
-                    buffer[buffer_length++] = (char) (0x80 | ((code_point >> 6) & 0x3F));
-                    buffer[buffer_length++] = (char) (0x80 | (code_point & 0x3F));
-                } else {
-                    // 4-byte character
-                    if (buffer_length + 4 >= buffer_size) {
-                        buffer_size *= 2;
-                        char *new_buffer = (char *) json_realloc(buffer, buffer_size);
-                        if (new_buffer == NULL) {
-                            json__free(buffer);
-                            JSON_PARSER_ERROR(parser, JSON_ERROR_MEMORY, "Memory allocation failed");
-                            return -1;
-                        }
-                        buffer = new_buffer;
-                    }
-                    buffer[buffer_length++] = (char) (0xF0 | (code_point >> 18));
-                    buffer[buffer_length++] = (char) (0x80 | ((code_point >> 12) & 0x3F));
-                    buffer[buffer_length++] = (char) (0x80 | ((code_point >> 6) & 0x3F));
-                    buffer[buffer_length++] = (char) (0x80 | (code_point & 0x3F));
-                }
+        return rc;
+    } else {
+        int na = a->array.length, nb = b->array.length, prefix = 0, suffix = 0, common;
+        unsigned long long *ha, *hb;
 
-                continue; // Skip the increment at the end of the loop
-            } else {
-                // Handle standard escape sequences
-                char escaped_char;
-                switch (parser->input[end]) {
-                case '"':
-                    escaped_char = '"';
-                    break;
-                case '\\':
-                    escaped_char = '\\';
-                    break;
-                case '/':
-                    escaped_char = '/';
-                    break;
-                case 'b':
-                    escaped_char = '\b';
-                    break;
-                case 'f':
-                    escaped_char = '\f';
-                    break;
-                case 'n':
-                    escaped_char = '\n';
-                    break;
-                case 'r':
-                    escaped_char = '\r';
-                    break;
-                case 't':
-                    escaped_char = '\t';
-                    break;
-                default:
-                    json__free(buffer);
-                    JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX, "Invalid escape character");
-                    return -1;
-                }
+        ha = (unsigned long long *) json_alloc(sizeof(*ha) * (na + nb + 1));
+        if (ha == NULL)
+            return -1;
 
-                if (buffer_length + 1 >= buffer_size) {
-                    buffer_size *= 2;
-                    char *new_buffer = (char *) json_realloc(buffer, buffer_size);
-                    if (new_buffer == NULL) {
-                        json__free(buffer);
-                        JSON_PARSER_ERROR(parser, JSON_ERROR_MEMORY, "Memory allocation failed");
-                        return -1;
-                    }
-                    buffer = new_buffer;
-                }
+        hb = ha + na;
+        for (int i = 0; i < na; i++)
+            ha[i] = json__hash_value(a->array.items[i], JSON_HASH_SEED);
+        for (int i = 0; i < nb; i++)
+            hb[i] = json__hash_value(b->array.items[i], JSON_HASH_SEED);
 
-                buffer[buffer_length++] = escaped_char;
-            }
-        } else {
-            if (buffer_length + 1 >= buffer_size) {
-                buffer_size *= 2;
-                char *new_buffer = (char *) json_realloc(buffer, buffer_size);
-                if (new_buffer == NULL) {
-                    json__free(buffer);
-                    JSON_PARSER_ERROR(parser, JSON_ERROR_MEMORY, "Memory allocation failed");
-                    return -1;
-                }
-                buffer = new_buffer;
-            }
+        // Unchanged elements at either end never appear in the patch
+        while (prefix < na && prefix < nb && ha[prefix] == hb[prefix]
+               && json__equal(a->array.items[prefix], b->array.items[prefix]))
+            prefix++;
+
+        while (suffix < na - prefix && suffix < nb - prefix && ha[na - suffix - 1] == hb[nb - suffix - 1]
+               && json__equal(a->array.items[na - suffix - 1], b->array.items[nb - suffix - 1]))
+            suffix++;
+
+        na -= prefix + suffix;
+        nb -= prefix + suffix;
+        common = na < nb ? na : nb;
 
-            buffer[buffer_length++] = parser->input[end];
+        for (int i = 0; rc == 0 && i < common; i++) {
+            if (ha[prefix + i] == hb[prefix + i] && json__equal(a->array.items[prefix + i], b->array.items[prefix + i]))
+                continue;
+
+            if ((rc = json__diff_push_index(diff, prefix + i)) == 0)
+                rc = json__diff_value(diff, a->array.items[prefix + i], b->array.items[prefix + i]);
+
+            diff->length = length;
+            diff->path[length] = '\0';
         }
-        end++;
-    }
 
-    if (end == parser->length) {
-        json__free(buffer);
-        JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX, "Unterminated string");
-        return -1;
-    }
+        for (int i = na - 1; rc == 0 && i >= common; i--) {
+            if ((rc = json__diff_push_index(diff, prefix + i)) == 0)
+                rc = json__diff_emit(diff, "remove", NULL);
 
-    buffer[buffer_length] = 0;
+            diff->length = length;
+            diff->path[length] = '\0';
+        }
 
-    value->type = JSON_TYPE_STRING;
-    value->string.value = buffer;
-    value->string.length = buffer_length;
+        for (int i = common; rc == 0 && i < nb; i++) {
+            if ((rc = json__diff_push_index(diff, prefix + i)) == 0)
+                rc = json__diff_emit(diff, "add", b->array.items[prefix + i]);
 
-    parser->position = end + 1;
-    return 0;
+            diff->length = length;
+            diff->path[length] = '\0';
+        }
+
+        json__free(ha);
+        return rc;
+    }
 }
 
-static void json__parser_consume_digits(struct json_parser *parser)
+JSON_API struct json_value *json_diff(struct json_value *a, struct json_value *b)
 {
-    while (parser->position < parser->length && parser->input[parser->position] >= '0'
-           && parser->input[parser->position] <= '9') {
-        parser->position++;
+    struct json__diff diff;
+
+    if ((diff.ops = json_array_new()) == NULL)
+        return NULL;
+
+    diff.length = 0;
+    diff.capacity = 64;
+    if ((diff.path = (char *) json_alloc(diff.capacity)) == NULL) {
+        json_free(diff.ops);
+        return NULL;
+    }
+
+    diff.path[0] = '\0';
+    if (json__diff_value(&diff, a, b) != 0) {
+        json_free(diff.ops);
+        diff.ops = NULL;
     }
+
+    json__free(diff.path);
+    return diff.ops;
 }
 
-static int json__decode_number(struct json_parser *parser, struct json_value *value)
+// Removes null members recursively, as a merge into an empty object would
+static void json__merge_patch_strip(struct json_value *object)
 {
-    int start = parser->position;
-    char *endptr;
+    int i = 0;
 
-    if (parser->position < parser->length && parser->input[parser->position] == '-')
-        parser->position++;
+    while (i < object->object.n_items) {
+        struct json_value *value = object->object.items[i]->value;
 
-    if (parser->position < parser->length && parser->input[parser->position] == '0') {
-        parser->position++;
-    } else if (parser->position < parser->length && parser->input[parser->position] >= '1'
-               && parser->input[parser->position] <= '9') {
-        json__parser_consume_digits(parser);
-    } else {
-        JSON_PARSER_ERROR(parser, JSON_ERROR_INVALID_NUMBER, "Invalid number");
-        return -1;
+        if (value->type == JSON_TYPE_NULL) {
+            struct json_object_entry *entry = json__object_detach(object, i);
+            json_free(entry->value);
+            json__free_as(JSON_STATS_KEY, entry->key);
+            json__free_as(JSON_STATS_KEY, entry);
+            continue;
+        }
+
+        if (value->type == JSON_TYPE_OBJECT)
+            json__merge_patch_strip(value);
+        i++;
     }
+}
 
-    if (parser->position < parser->length && parser->input[parser->position] == '.') {
-        parser->position++;
-        if (parser->position < parser->length && parser->input[parser->position] >= '0'
-            && parser->input[parser->position] <= '9') {
-            json__parser_consume_digits(parser);
+// Both arguments are objects, every member of `patch` is consumed
+static int json__merge_patch_members(struct json_value *target, struct json_value *patch)
+{
+    int rc = 0;
+
+    for (int i = 0; i < patch->object.n_items; i++) {
+        struct json_object_entry *entry = patch->object.items[i];
+        struct json_value *value = entry->value;
+        int index = json__object_find(target, entry->key, entry->key_length);
+
+        if (value->type == JSON_TYPE_NULL) {
+            if (index >= 0) {
+                struct json_object_entry *removed = json__object_detach(target, index);
+                json_free(removed->value);
+                json__free_as(JSON_STATS_KEY, removed->key);
+                json__free_as(JSON_STATS_KEY, removed);
+            }
+            json_free(value);
+        } else if (index >= 0) {
+            struct json_value **slot = &target->object.items[index]->value;
+
+            JSON__CACHE_INVALIDATE(target);
+            if (value->type == JSON_TYPE_OBJECT && (*slot)->type == JSON_TYPE_OBJECT) {
+                if (json__merge_patch_members(*slot, value) != 0)
+                    rc = -1;
+            } else {
+                if (value->type == JSON_TYPE_OBJECT)
+                    json__merge_patch_strip(value);
+                json_free(*slot);
+                *slot = value;
+            }
+        } else if (json__object_grow(target) == 0) {
+            if (value->type == JSON_TYPE_OBJECT)
+                json__merge_patch_strip(value);
+
+            // The whole entry moves over, key included
+            json__object_place(target, target->object.n_items, entry);
+            continue;
         } else {
-            JSON_PARSER_ERROR(parser, JSON_ERROR_INVALID_NUMBER, "Invalid number");
-            return -1;
+            json_free(value);
+            rc = -1;
         }
+
+        json__free_as(JSON_STATS_KEY, entry->key);
+        json__free_as(JSON_STATS_KEY, entry);
     }
 
-    if (parser->position < parser->length
-        && (parser->input[parser->position] == 'e' || parser->input[parser->position] == 'E')) {
-        parser->position++;
-        if (parser->position < parser->length
-            && (parser->input[parser->position] == '-' || parser->input[parser->position] == '+')) {
-            parser->position++;
-        }
-        if (parser->position < parser->length && parser->input[parser->position] >= '0'
-            && parser->input[parser->position] <= '9') {
-            json__parser_consume_digits(parser);
-        } else {
-            JSON_PARSER_ERROR(parser, JSON_ERROR_INVALID_NUMBER, "Invalid number");
-            return -1;
+    // Every member has been consumed, the emptied object is released as usual
+    patch->object.n_items = 0;
+    json_free(patch);
+    return rc;
+}
+
+#if defined(JSON_REFCOUNT)
+// Whether merging `patch` would modify a node some other owner still holds
+static int json__merge_patch_shared(const struct json_value *patch)
+{
+    if (JSON__ATOMIC_LOAD(&patch->refcount) > 1)
+        return 1;
+
+    if (patch->type == JSON_TYPE_OBJECT) {
+        for (int i = 0; i < patch->object.n_items; i++) {
+            const struct json_value *value = patch->object.items[i]->value;
+            if (value->type == JSON_TYPE_OBJECT && json__merge_patch_shared(value))
+                return 1;
         }
     }
 
-    if (start == parser->position) {
-        JSON_PARSER_ERROR(parser, JSON_ERROR_INVALID_NUMBER, "Invalid number");
-        return -1;
-    }
+    return 0;
+}
+#endif
 
-    value->type = JSON_TYPE_NUMBER;
-    endptr = NULL;
-    value->number = strtod(parser->input + start, &endptr);
+JSON_API int json_merge_patch(struct json_value *target, struct json_value *patch)
+{
+    struct json_value holder;
 
-    if (endptr != parser->input + parser->position) {
-        JSON_PARSER_ERROR(parser, JSON_ERROR_INVALID_NUMBER, "Invalid number");
-        return -1;
+#if defined(JSON_REFCOUNT)
+    // Patches are consumed in place, so one that is shared is merged from a private copy
+    if (json__merge_patch_shared(patch)) {
+        struct json_value *copy = json_deep_copy(patch);
+
+        json_free(patch);
+        if ((patch = copy) == NULL)
+            return -1;
     }
+#endif
+
+    if (patch->type == JSON_TYPE_OBJECT && target->type == JSON_TYPE_OBJECT)
+        return json__merge_patch_members(target, patch);
 
+    if (patch->type == JSON_TYPE_OBJECT)
+        json__merge_patch_strip(patch);
+
+    // Swap the contents so `target` keeps its address
+    holder = *target;
+    json__value_assign(target, patch);
+    json__value_assign(patch, &holder);
+    json_free(patch);
     return 0;
 }
 
-static int json__decode_array(struct json_parser *parser, struct json_value *array)
+#if defined(JSON_REFCOUNT)
+// Copies a node without its children, which are retained instead
+static struct json_value *json__value_shallow_copy(struct json_value *value)
 {
-    if (parser->length - parser->position < 1) {
-        JSON_PARSER_ERROR(parser, JSON_ERROR_EOF, "Unexpected end of input");
-        return -1;
-    }
+    struct json_value *copy;
 
-    if (parser->input[parser->position] != '[') {
-        JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX, "Expected '['");
-        return -1;
-    }
+    if (value->type == JSON_TYPE_STRING)
+        return json_string_new(value->string.value);
 
-    array->type = JSON_TYPE_ARRAY;
-    json_array_init(array);
+    if (value->type == JSON_TYPE_NUMBER_ARRAY)
+        return json_number_array_new(value->array.numbers, value->array.length);
 
-    if (parser->position + 1 < parser->length && parser->input[parser->position + 1] == ']') {
-        parser->position += 2;
-        return 0;
-    }
+    if ((copy = json__value_alloc()) == NULL)
+        return NULL;
 
-    parser->position += 1; // Skip '['
-    while (parser->position < parser->length && parser->input[parser->position] != ']') {
-        json__parse_whitespace(parser);
+    if (value->type == JSON_TYPE_ARRAY) {
+        copy->type = JSON_TYPE_ARRAY;
+        json_array_init(copy);
+        if (value->array.length > 0) {
+            copy->array.items = (struct json_value **) json__alloc_as(JSON_STATS_ITEMS,
+                                                                      value->array.length * sizeof(*copy->array.items));
+            if (copy->array.items == NULL) {
+                json__free_as(JSON_STATS_NODE, copy);
+                return NULL;
+            }
 
-        struct json_value *item;
-        if ((item = json_alloc(sizeof(struct json_value))) == NULL) {
-            JSON_PARSER_ERROR(parser, JSON_ERROR_MEMORY, "Memory allocation failed");
-            json_array_free(array);
-            return -1;
+            copy->array.capacity = value->array.length;
+            for (int i = 0; i < value->array.length; i++)
+                copy->array.items[copy->array.length++] = json_retain(value->array.items[i]);
         }
+    } else if (value->type == JSON_TYPE_OBJECT) {
+        copy->type = JSON_TYPE_OBJECT;
+        json_object_init(copy);
+        if (value->object.n_items > 0) {
+            copy->object.items = (struct json_object_entry **) json__alloc_as(
+                JSON_STATS_ITEMS, value->object.n_items * sizeof(*copy->object.items));
+            if (copy->object.items == NULL) {
+                json__free_as(JSON_STATS_NODE, copy);
+                return NULL;
+            }
 
-        if (json__decode_value(parser, item) != 0) {
-            json__free(item);
-            json_array_free(array);
-            return -1;
-        }
+            copy->object.capacity = value->object.n_items;
+            for (int i = 0; i < value->object.n_items; i++) {
+                struct json_object_entry *entry = value->object.items[i];
+                struct json_object_entry *copied = json__object_entry_new(entry->key, entry->key_length, entry->value);
 
-        json_array_push(array, item);
-        json__parse_whitespace(parser);
+                if (copied == NULL) {
+                    json_object_free(copy);
+                    return NULL;
+                }
 
-        if (parser->position < parser->length && parser->input[parser->position] == ',') // Skip ','
-            parser->position++;
+                json_retain(copied->value);
+                copy->object.items[copy->object.n_items++] = copied;
+            }
+        }
+    } else {
+        json__value_assign(copy, value);
     }
 
-    if (parser->position >= parser->length || parser->input[parser->position] != ']') {
-        JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX, "Expected closing ']' for array");
-        json_array_free(array);
-        return -1;
-    }
+    JSON__STATS_NODE(copy->type);
+    return copy;
+}
 
-    if (parser->position < parser->length) // Skip ']'
-        parser->position++;
-    return 0;
+JSON_API struct json_value *json_clone_cow(struct json_value *doc)
+{
+    return json_retain(doc);
 }
 
-static int json__decode_object(struct json_parser *parser, struct json_value *object)
+JSON_API struct json_value *json_make_mut(struct json_value **slot)
 {
-    object->type = JSON_TYPE_OBJECT;
-    json_object_init(object);
+    struct json_value *copy;
 
-    parser->position++;
-    json__parse_whitespace(parser);
+    if (JSON__ATOMIC_LOAD(&(*slot)->refcount) == 1)
+        return *slot;
 
-    while (parser->position < parser->length && parser->input[parser->position] != '}') {
-        struct json_value key, *value;
-        json__parse_whitespace(parser);
+    if ((copy = json__value_shallow_copy(*slot)) == NULL)
+        return NULL;
 
-        if (parser->input[parser->position] != '"') {
-            JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX, "Expected string key");
-            return -1;
-        }
+    json_release(*slot);
+    *slot = copy;
+    return copy;
+}
 
-        if (json__decode_string(parser, &key) != 0) {
-            JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX, "Failed to parse string key");
-            return -1;
-        }
+JSON_API struct json_value *json_object_get_mut(struct json_value *object, const char *key)
+{
+    int index = json__object_find(object, key, json__strlen(key));
 
-        json__parse_whitespace(parser);
-        if (parser->position >= parser->length || parser->input[parser->position] != ':') {
-            json__free(key.string.value);
-            JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX, "Expected ':' after string key");
-            return -1;
-        }
-        parser->position++; // Skip the colon
+    if (index < 0)
+        return NULL;
 
-        value = (struct json_value *) json_alloc(sizeof(struct json_value));
-        if (value == NULL) {
-            json__free(key.string.value);
-            JSON_PARSER_ERROR(parser, JSON_ERROR_MEMORY, "Failed to allocate memory for JSON item");
-            return -1;
-        }
+    JSON__CACHE_INVALIDATE(object);
+    return json_make_mut(&object->object.items[index]->value);
+}
 
-        json__parse_whitespace(parser);
-        if (json__decode_value(parser, value) != 0) {
-            json__free(value);
-            json__free(key.string.value);
-            JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX, "Failed to parse JSON value");
-            return -1;
-        }
+JSON_API struct json_value *json_array_get_mut(struct json_value *array, int index)
+{
+    if (index < 0 || index >= array->array.length || json__array_unpack(array) != 0)
+        return NULL;
 
-        if (json_object_set(object, key.string.value, value) != 0) {
-            json__free(value);
-            json__free(key.string.value);
-            JSON_PARSER_ERROR(parser, JSON_ERROR_MEMORY, "Failed to set key-value pair in object");
-            return -1;
+    JSON__CACHE_INVALIDATE(array);
+    return json_make_mut(&array->array.items[index]);
+}
+
+JSON_API struct json_value *json_pointer_get_mut(struct json_value **root, const char *path)
+{
+    struct json_value *value = json_make_mut(root);
+    int length = json__strlen(path), start = 0;
+
+    if (length > 0 && path[0] != '/')
+        return NULL;
+
+    while (value != NULL && start < length) {
+        int end = start + 1, index;
+        while (end < length && path[end] != '/')
+            end++;
+
+        if (json_is_array(value)) {
+            index = json__pointer_index(path + start + 1, end - start - 1, value->array.length);
+            value = json_array_get_mut(value, index);
+        } else if (value->type == JSON_TYPE_OBJECT) {
+            index = json__pointer_member(value, path + start + 1, end - start - 1);
+            if (index >= 0) {
+                JSON__CACHE_INVALIDATE(value);
+                value = json_make_mut(&value->object.items[index]->value);
+            } else {
+                value = NULL;
+            }
+        } else {
+            value = NULL;
         }
 
-        json__free(key.string.value);
-        json__parse_whitespace(parser);
-        if (parser->position < parser->length && parser->input[parser->position] == ',')
-            parser->position++; // Skip comma or closing brace
+        start = end;
     }
 
-    if (parser->position >= parser->length || parser->input[parser->position] != '}') {
-        JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX, "Expected '}' after JSON object");
-        return -1;
+    return value;
+}
+#endif
+
+#if defined(JSON_PERSISTENT)
+
+# define JSON__PERSISTENT_BITS 5
+# define JSON__PERSISTENT_WIDTH (1 << JSON__PERSISTENT_BITS)
+# define JSON__PERSISTENT_MASK (JSON__PERSISTENT_WIDTH - 1)
+
+// A key-value pair of a persistent object, shared between versions
+struct json__pmap_leaf
+{
+    int refcount;
+    int key_length;
+    unsigned long long hash;
+    struct json_pvalue *value;
+    char *key;
+};
+
+// A trie node of a persistent object. Bitmap nodes hold one slot per set bit of
+// `bitmap`, in bit order. Once all 64 hash bits are consumed a collision node
+// (bitmap 0) holds a plain list of leaves sharing the same hash.
+struct json__pmap_node
+{
+    int refcount;
+    int count;
+    unsigned int bitmap;
+    unsigned int leafmap;
+    void **slots;
+};
+
+// A trie node of a persistent array, level 0 nodes hold the elements
+struct json__pvec_node
+{
+    int refcount;
+    void *slots[JSON__PERSISTENT_WIDTH];
+};
+
+static int json__popcount(unsigned int bits)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcount(bits);
+#else
+    int count = 0;
+    for (; bits != 0; bits &= bits - 1)
+        count++;
+    return count;
+#endif
+}
+
+static struct json_pvalue *json__pvalue_new(int type)
+{
+    struct json_pvalue *value = (struct json_pvalue *) json_alloc(sizeof(struct json_pvalue));
+
+    if (value == NULL)
+        return NULL;
+
+    memset(value, 0, sizeof(*value));
+    value->type = type;
+    value->refcount = 1;
+    return value;
+}
+
+static void json__pmap_leaf_release(struct json__pmap_leaf *leaf)
+{
+    if (JSON__ATOMIC_DEC(&leaf->refcount) > 0)
+        return;
+
+    json_pvalue_release(leaf->value);
+    json__free(leaf);
+}
+
+// Takes ownership of `value`, releasing it on failure
+static struct json__pmap_leaf *json__pmap_leaf_new(const char *key, int key_length, struct json_pvalue *value)
+{
+    struct json__pmap_leaf *leaf = (struct json__pmap_leaf *) json_alloc(sizeof(struct json__pmap_leaf) + key_length + 1);
+
+    if (leaf == NULL) {
+        json_pvalue_release(value);
+        return NULL;
     }
 
-    parser->position++; // Skip the closing brace
+    leaf->refcount = 1;
+    leaf->key_length = key_length;
+    leaf->hash = json__hash_bytes(key, (size_t) key_length, JSON_HASH_SEED);
+    leaf->value = value;
+    leaf->key = (char *) (leaf + 1);
+    memcpy(leaf->key, key, key_length);
+    leaf->key[key_length] = 0;
+    return leaf;
+}
+
+static int json__pmap_leaf_match(const struct json__pmap_leaf *leaf, unsigned long long hash, const char *key, int key_length)
+{
+    return leaf->hash == hash && leaf->key_length == key_length && memcmp(leaf->key, key, key_length) == 0;
+}
+
+static int json__pmap_is_leaf(const struct json__pmap_node *node, int index)
+{
+    // Collision nodes only hold leaves, bitmap nodes flag them per fragment
+    unsigned int bits = node->bitmap;
+
+    if (bits == 0)
+        return 1;
+
+    while (index-- > 0)
+        bits &= bits - 1;
+
+    return (node->leafmap & bits & -bits) != 0;
+}
+
+static void json__pmap_node_release(struct json__pmap_node *node)
+{
+    if (node == NULL || JSON__ATOMIC_DEC(&node->refcount) > 0)
+        return;
+
+    for (int i = 0; i < node->count; i++) {
+        if (json__pmap_is_leaf(node, i))
+            json__pmap_leaf_release((struct json__pmap_leaf *) node->slots[i]);
+        else
+            json__pmap_node_release((struct json__pmap_node *) node->slots[i]);
+    }
+
+    json__free(node);
+}
+
+static void json__pmap_slot_retain(const struct json__pmap_node *node, int index)
+{
+    if (json__pmap_is_leaf(node, index))
+        JSON__ATOMIC_INC(&((struct json__pmap_leaf *) node->slots[index])->refcount);
+    else
+        JSON__ATOMIC_INC(&((struct json__pmap_node *) node->slots[index])->refcount);
+}
+
+static struct json__pmap_node *json__pmap_node_new(int count, unsigned int bitmap, unsigned int leafmap)
+{
+    struct json__pmap_node *node = (struct json__pmap_node *) json_alloc(sizeof(struct json__pmap_node) + count * sizeof(void *));
+
+    if (node == NULL)
+        return NULL;
 
-    return 0;
+    node->refcount = 1;
+    node->count = count;
+    node->bitmap = bitmap;
+    node->leafmap = leafmap;
+    node->slots = (void **) (node + 1);
+    return node;
 }
 
-static int json__decode_value(struct json_parser *parser, struct json_value *value)
+// Copies `node` with slot `index` left empty for the caller to fill; the old
+// occupant is not carried over. Every other slot is shared with `node`.
+static struct json__pmap_node *json__pmap_node_copy(const struct json__pmap_node *node, int index)
 {
-    int rc;
-    char c = parser->input[parser->position];
+    struct json__pmap_node *copy = json__pmap_node_new(node->count, node->bitmap, node->leafmap);
 
-    if (c == '"') {
-        rc = json__decode_string(parser, value);
-    } else if (c == '[') {
-        rc = json__decode_array(parser, value);
-    } else if (c == '{') {
-        rc = json__decode_object(parser, value);
-    } else if (json__streqn(parser->input + parser->position, "true", 4)) {
-        value->type = JSON_TYPE_BOOLEAN;
-        value->number = 1;
-        parser->position += 4;
-        return 0;
-    } else if (json__streqn(parser->input + parser->position, "false", 4)) {
-        value->type = JSON_TYPE_BOOLEAN;
-        value->number = 0;
-        parser->position += 5;
-        return 0;
-    } else if (json__streqn(parser->input + parser->position, "null", 4)) {
-        value->type = JSON_TYPE_NULL;
-        parser->position += 4;
-        return 0;
-    } else {
-        rc = json__decode_number(parser, value);
-    }
+    if (copy == NULL)
+        return NULL;
 
-#if defined(JSON_ERROR)
-    if (rc != 0 && parser->error.code == JSON_ERROR_NONE) {
-        JSON_PARSER_ERROR(parser, JSON_ERROR_SYNTAX, "Expected value");
+    for (int i = 0; i < node->count; i++) {
+        if (i != index)
+            json__pmap_slot_retain(node, i);
+        copy->slots[i] = i != index ? node->slots[i] : NULL;
     }
-#endif
 
-    return rc;
+    return copy;
 }
 
-struct json_value *json_decode_with_length(const char *json, int length)
+// Copies `node` with an empty slot inserted at `index` (`remove` 0) or with
+// slot `index` dropped (`remove` 1). The bitmaps are left to the caller.
+static struct json__pmap_node *json__pmap_node_resize(const struct json__pmap_node *node, int index, int remove)
 {
-    struct json_parser parser;
-    struct json_value *value = NULL;
-
-    parser.input = json;
-    parser.length = length;
-    parser.position = 0;
-
-#if defined(JSON_ERROR)
-    parser.error.code = JSON_ERROR_NONE;
-    parser.error.message = NULL;
-#endif
+    int count = node->count + (remove ? -1 : 1);
+    struct json__pmap_node *copy = json__pmap_node_new(count, node->bitmap, node->leafmap);
 
-    if ((value = json_alloc(sizeof(struct json_value))) == NULL)
+    if (copy == NULL)
         return NULL;
 
-    if (json__decode_value(&parser, value) != 0) {
-#if defined(JSON_ERROR) && !defined(JSON_ERROR_HANDLER)
-        if (parser.error.code != JSON_ERROR_NONE) {
-            fprintf(stderr, "JSON(\033[1merror\033[m): %s:%d %s at\n", parser.error.func, parser.error.line,
-                    parser.error.message);
-        }
-#elif defined(JSON_ERROR) && defined(JSON_ERROR_HANDLER)
-        if (parser.error.code != JSON_ERROR_NONE) {
-            JSON_ERROR_HANDLER(parser.error.code, parser.error.message);
+    for (int i = 0, j = 0; i < node->count; i++) {
+        if (i == index) {
+            if (remove)
+                continue;
+            copy->slots[j++] = NULL;
         }
-#endif
-        json__free(value);
-        return NULL;
+
+        json__pmap_slot_retain(node, i);
+        copy->slots[j++] = node->slots[i];
     }
 
-    return value;
-}
+    if (!remove && index == node->count)
+        copy->slots[count - 1] = NULL;
 
-struct json_value *json_decode(const char *json)
-{
-    return json_decode_with_length(json, json__strlen(json));
+    return copy;
 }
 
-static char *json__encode_array(struct json_value *value)
+// Returns a new node holding everything in `node` plus `leaf`, replacing any leaf with
+// the same key. `node` may be NULL. Takes ownership of `leaf`, releasing it on failure.
+static struct json__pmap_node *json__pmap_assoc(const struct json__pmap_node *node, int shift, struct json__pmap_leaf *leaf, int *added)
 {
-    int length;
-    int buffer_size;
-    char *encoded_array;
-    if (value == NULL) {
-        return NULL;
+    struct json__pmap_node *copy, *child;
+    unsigned int bit;
+    int index;
+
+    if (node == NULL) {
+        bit = shift < 64 ? 1u << ((leaf->hash >> shift) & JSON__PERSISTENT_MASK) : 0;
+        if ((copy = json__pmap_node_new(1, bit, bit)) == NULL) {
+            json__pmap_leaf_release(leaf);
+            return NULL;
+        }
+
+        copy->slots[0] = leaf;
+        *added = 1;
+        return copy;
     }
 
-    buffer_size = 512;
-    encoded_array = (char *) json_alloc(buffer_size);
-    if (encoded_array == NULL) {
-        return NULL;
+    if (node->bitmap == 0) {
+        for (index = 0; index < node->count; index++) {
+            struct json__pmap_leaf *other = (struct json__pmap_leaf *) node->slots[index];
+            if (json__pmap_leaf_match(other, leaf->hash, leaf->key, leaf->key_length))
+                break;
+        }
+
+        *added = index == node->count;
+        copy = *added ? json__pmap_node_resize(node, index, 0) : json__pmap_node_copy(node, index);
+        if (copy == NULL) {
+            json__pmap_leaf_release(leaf);
+            return NULL;
+        }
+
+        copy->slots[index] = leaf;
+        return copy;
     }
 
-    length = 1;
-    encoded_array[0] = '[';
+    bit = 1u << ((leaf->hash >> shift) & JSON__PERSISTENT_MASK);
+    index = json__popcount(node->bitmap & (bit - 1));
 
-    for (int i = 0; i < value->array.length; i++) {
-        int needed;
-        int encoded_item_len;
-        char *encoded_item = json_encode(value->array.items[i]);
-        if (encoded_item == NULL) {
-            json__free(encoded_array);
+    if ((node->bitmap & bit) == 0) {
+        if ((copy = json__pmap_node_resize(node, index, 0)) == NULL) {
+            json__pmap_leaf_release(leaf);
             return NULL;
         }
 
-        encoded_item_len = json__strlen(encoded_item);
+        copy->bitmap |= bit;
+        copy->leafmap |= bit;
+        copy->slots[index] = leaf;
+        *added = 1;
+        return copy;
+    }
 
-        needed = length + encoded_item_len + (i > 0 ? 1 : 0) + 1;
-        if (needed > buffer_size) {
-            char *new_encoded_array = (char *) json_realloc(encoded_array, (buffer_size = needed * 2));
-            if (new_encoded_array == NULL) {
-                json__free(encoded_array);
-                json__free(encoded_item);
+    if (node->leafmap & bit) {
+        struct json__pmap_leaf *other = (struct json__pmap_leaf *) node->slots[index];
+
+        if (json__pmap_leaf_match(other, leaf->hash, leaf->key, leaf->key_length)) {
+            if ((copy = json__pmap_node_copy(node, index)) == NULL) {
+                json__pmap_leaf_release(leaf);
                 return NULL;
             }
-            encoded_array = new_encoded_array;
+
+            copy->slots[index] = leaf;
+            *added = 0;
+            return copy;
         }
 
-        if (i > 0) {
-            encoded_array[length++] = ',';
+        // Push both leaves one level down
+        JSON__ATOMIC_INC(&other->refcount);
+        if ((copy = json__pmap_assoc(NULL, shift + JSON__PERSISTENT_BITS, other, added)) == NULL) {
+            json__pmap_leaf_release(leaf);
+            return NULL;
         }
 
-        for (int i = 0; i < encoded_item_len; i++)
-            encoded_array[length + i] = encoded_item[i];
+        child = json__pmap_assoc(copy, shift + JSON__PERSISTENT_BITS, leaf, added);
+        json__pmap_node_release(copy);
+    } else {
+        child = json__pmap_assoc((struct json__pmap_node *) node->slots[index], shift + JSON__PERSISTENT_BITS, leaf, added);
+    }
 
-        length += encoded_item_len;
+    if (child == NULL)
+        return NULL;
 
-        json__free(encoded_item);
+    if ((copy = json__pmap_node_copy(node, index)) == NULL) {
+        json__pmap_node_release(child);
+        return NULL;
     }
 
-    encoded_array[length++] = ']';
-    encoded_array[length] = '\0';
-
-    return encoded_array;
+    copy->leafmap &= ~bit;
+    copy->slots[index] = child;
+    return copy;
 }
 
-static char *json__encode_object(struct json_value *object)
+// Returns a new node without the leaf matching `key`, or NULL when nothing is left.
+// `status` is set to 1 if the key was removed, 0 if it was absent and -1 on failure.
+static struct json__pmap_node *json__pmap_dissoc(struct json__pmap_node *node, int shift, unsigned long long hash,
+                                                 const char *key, int key_length, int *status)
 {
-    int length;
-    int buffer_size = 256;
-    char *encoded_object = (char *) json_alloc(buffer_size);
-    if (encoded_object == NULL) {
-        return NULL;
+    struct json__pmap_node *copy, *child;
+    unsigned int bit = 0;
+    int index;
+
+    *status = 0;
+    if (node->bitmap == 0) {
+        for (index = 0; index < node->count; index++)
+            if (json__pmap_leaf_match((struct json__pmap_leaf *) node->slots[index], hash, key, key_length))
+                break;
+
+        if (index == node->count)
+            return node;
+    } else {
+        bit = 1u << ((hash >> shift) & JSON__PERSISTENT_MASK);
+        index = json__popcount(node->bitmap & (bit - 1));
+
+        if ((node->bitmap & bit) == 0)
+            return node;
+
+        if ((node->leafmap & bit) == 0) {
+            child = json__pmap_dissoc((struct json__pmap_node *) node->slots[index], shift + JSON__PERSISTENT_BITS,
+                                      hash, key, key_length, status);
+            if (*status <= 0)
+                return node;
+
+            if (child != NULL) {
+                if ((copy = json__pmap_node_copy(node, index)) == NULL) {
+                    json__pmap_node_release(child);
+                    *status = -1;
+                    return node;
+                }
+
+                copy->slots[index] = child;
+                return copy;
+            }
+        } else if (!json__pmap_leaf_match((struct json__pmap_leaf *) node->slots[index], hash, key, key_length)) {
+            return node;
+        }
     }
 
-    encoded_object[0] = '{';
-    length = 1;
+    // Drop the slot, the node disappears along with its last one
+    *status = 1;
+    if (node->count == 1)
+        return NULL;
 
-    for (int i = 0; i < object->object.n_items; i++) {
-        char *new_buffer;
-        char *key = object->object.items[i]->key;
-        char *value = json_encode(object->object.items[i]->value);
+    if ((copy = json__pmap_node_resize(node, index, 1)) == NULL) {
+        *status = -1;
+        return node;
+    }
+
+    copy->bitmap &= ~bit;
+    copy->leafmap &= ~bit;
+    return copy;
+}
 
-        int key_length = json__strlen(key);
-        int value_length = json__strlen(value);
+static struct json__pmap_leaf *json__pmap_find(const struct json__pmap_node *node, const char *key, int key_length)
+{
+    unsigned long long hash = json__hash_bytes(key, (size_t) key_length, JSON_HASH_SEED);
 
-        int needed = length + key_length + value_length + 4 + (i < object->object.n_items - 1 ? 1 : 0);
+    for (int shift = 0; node != NULL; shift += JSON__PERSISTENT_BITS) {
+        unsigned int bit;
+        int index;
 
-        if (needed > buffer_size) {
-            buffer_size = needed * 2;
-            new_buffer = (char *) json_realloc(encoded_object, buffer_size);
-            if (new_buffer == NULL) {
-                json__free(encoded_object);
-                json__free(value);
-                return NULL;
+        if (node->bitmap == 0) {
+            for (index = 0; index < node->count; index++) {
+                struct json__pmap_leaf *leaf = (struct json__pmap_leaf *) node->slots[index];
+                if (json__pmap_leaf_match(leaf, hash, key, key_length))
+                    return leaf;
             }
-            encoded_object = new_buffer;
+            return NULL;
         }
 
-        encoded_object[length++] = '"';
-        for (int j = 0; j < key_length; j++)
-            encoded_object[length++] = key[j];
+        bit = 1u << ((hash >> shift) & JSON__PERSISTENT_MASK);
+        if ((node->bitmap & bit) == 0)
+            return NULL;
 
-        encoded_object[length++] = '"';
-        encoded_object[length++] = ':';
-        for (int j = 0; j < value_length; j++)
-            encoded_object[length++] = value[j];
+        index = json__popcount(node->bitmap & (bit - 1));
+        if (node->leafmap & bit) {
+            struct json__pmap_leaf *leaf = (struct json__pmap_leaf *) node->slots[index];
+            return json__pmap_leaf_match(leaf, hash, key, key_length) ? leaf : NULL;
+        }
 
-        json__free(value);
+        node = (const struct json__pmap_node *) node->slots[index];
+    }
 
-        if (i < object->object.n_items - 1) {
-            encoded_object[length++] = ',';
+    return NULL;
+}
+
+static int json__pmap_foreach(const struct json__pmap_node *node,
+                              int (*callback)(const char *key, struct json_pvalue *value, void *context),
+                              void *context)
+{
+    int result = 0;
+
+    for (int i = 0; node != NULL && i < node->count && result == 0; i++) {
+        if (json__pmap_is_leaf(node, i)) {
+            struct json__pmap_leaf *leaf = (struct json__pmap_leaf *) node->slots[i];
+            result = callback(leaf->key, leaf->value, context);
+        } else {
+            result = json__pmap_foreach((const struct json__pmap_node *) node->slots[i], callback, context);
         }
     }
 
-    encoded_object[length++] = '}';
-    encoded_object[length] = '\0';
-
-    return encoded_object;
+    return result;
 }
 
-static char *json__encode_string(struct json_value *value)
+static struct json__pvec_node *json__pvec_node_new(void)
 {
-    const char *str = value->string.value;
-    int length = value->string.length;
-    int buffer_size = length * 6 + 3; // Maximum possible size (all chars escaped + quotes)
-    char *buffer = (char *) json_alloc(buffer_size);
-    int pos = 0;
+    struct json__pvec_node *node = (struct json__pvec_node *) json_alloc(sizeof(struct json__pvec_node));
 
-    if (!buffer)
+    if (node == NULL)
         return NULL;
 
-    buffer[pos++] = '"';
+    memset(node, 0, sizeof(*node));
+    node->refcount = 1;
+    return node;
+}
 
-    for (int i = 0; i < length; i++) {
-        unsigned char c = (unsigned char) str[i];
+// `shift` is the level of `node`: 0 for nodes holding elements
+static void json__pvec_node_release(struct json__pvec_node *node, int shift)
+{
+    if (node == NULL || JSON__ATOMIC_DEC(&node->refcount) > 0)
+        return;
 
-        if (c == '"' || c == '\\' || c == '/') {
-            buffer[pos++] = '\\';
-            buffer[pos++] = c;
-        } else if (c == '\b') {
-            buffer[pos++] = '\\';
-            buffer[pos++] = 'b';
-        } else if (c == '\f') {
-            buffer[pos++] = '\\';
-            buffer[pos++] = 'f';
-        } else if (c == '\n') {
-            buffer[pos++] = '\\';
-            buffer[pos++] = 'n';
-        } else if (c == '\r') {
-            buffer[pos++] = '\\';
-            buffer[pos++] = 'r';
-        } else if (c == '\t') {
-            buffer[pos++] = '\\';
-            buffer[pos++] = 't';
-        } else if (c < 32) {
-            // Control characters must be escaped as \uXXXX
-            buffer[pos++] = '\\';
-            buffer[pos++] = 'u';
-            buffer[pos++] = '0';
-            buffer[pos++] = '0';
-            buffer[pos++] = "0123456789ABCDEF"[(c >> 4) & 0xF];
-            buffer[pos++] = "0123456789ABCDEF"[c & 0xF];
-        } else if (c < 128) {
-            // ASCII characters
-            buffer[pos++] = c;
-        } else {
-            // UTF-8 encoded characters
-            // Check if this is a multi-byte sequence
-            const unsigned char *bytes = (const unsigned char *) &str[i];
-            if ((c & 0xE0) == 0xC0) {
-                // Two-byte sequence
-                if (i + 1 >= length || (bytes[i + 1] & 0xC0) != 0x80) {
-                    // Invalid UTF-8 sequence, escape as replacement character
-                    buffer[pos++] = '\\';
-                    buffer[pos++] = 'u';
-                    buffer[pos++] = 'F';
-                    buffer[pos++] = 'F';
-                    buffer[pos++] = 'F';
-                    buffer[pos++] = 'D';
-                } else {
-                    // Valid two-byte sequence, keep as is
-                    buffer[pos++] = c;
-                    buffer[pos++] = str[++i];
-                }
-            } else if ((c & 0xF0) == 0xE0) {
-                // Three-byte sequence
-                if (i + 2 >= length || (bytes[i + 1] & 0xC0) != 0x80 || (bytes[i + 2] & 0xC0) != 0x80) {
-                    // Invalid UTF-8 sequence
-                    buffer[pos++] = '\\';
-                    buffer[pos++] = 'u';
-                    buffer[pos++] = 'F';
-                    buffer[pos++] = 'F';
-                    buffer[pos++] = 'F';
-                    buffer[pos++] = 'D';
-                } else {
-                    // Valid three-byte sequence, keep as is
-                    buffer[pos++] = c;
-                    buffer[pos++] = str[++i];
-                    buffer[pos++] = str[++i];
-                }
-            } else if ((c & 0xF8) == 0xF0) {
-                // Four-byte sequence
-                if (i + 3 >= length || (bytes[i + 1] & 0xC0) != 0x80 || (bytes[i + 2] & 0xC0) != 0x80
-                    || (bytes[i + 3] & 0xC0) != 0x80) {
-                    // Invalid UTF-8 sequence
-                    buffer[pos++] = '\\';
-                    buffer[pos++] = 'u';
-                    buffer[pos++] = 'F';
-                    buffer[pos++] = 'F';
-                    buffer[pos++] = 'F';
-                    buffer[pos++] = 'D';
-                } else {
-                    // Valid four-byte sequence, keep as is
-                    buffer[pos++] = c;
-                    buffer[pos++] = str[++i];
-                    buffer[pos++] = str[++i];
-                    buffer[pos++] = str[++i];
-                }
-            } else {
-                // Invalid UTF-8 start byte
-                buffer[pos++] = '\\';
-                buffer[pos++] = 'u';
-                buffer[pos++] = 'F';
-                buffer[pos++] = 'F';
-                buffer[pos++] = 'F';
-                buffer[pos++] = 'D';
-            }
-        }
+    for (int i = 0; i < JSON__PERSISTENT_WIDTH; i++) {
+        if (shift == 0)
+            json_pvalue_release((struct json_pvalue *) node->slots[i]);
+        else
+            json__pvec_node_release((struct json__pvec_node *) node->slots[i], shift - JSON__PERSISTENT_BITS);
+    }
+
+    json__free(node);
+}
+
+// Copies `node` with slot `index` left empty, or a fresh node if `node` is NULL
+static struct json__pvec_node *json__pvec_node_copy(const struct json__pvec_node *node, int shift, int index)
+{
+    struct json__pvec_node *copy = json__pvec_node_new();
+
+    if (copy == NULL || node == NULL)
+        return copy;
+
+    for (int i = 0; i < JSON__PERSISTENT_WIDTH; i++) {
+        if (i == index || node->slots[i] == NULL)
+            continue;
+
+        if (shift == 0)
+            JSON__ATOMIC_INC(&((struct json_pvalue *) node->slots[i])->refcount);
+        else
+            JSON__ATOMIC_INC(&((struct json__pvec_node *) node->slots[i])->refcount);
+        copy->slots[i] = node->slots[i];
     }
 
-    buffer[pos++] = '"';
-    buffer[pos] = '\0';
+    return copy;
+}
+
+static int json__pvec_tail_offset(int count)
+{
+    return count < JSON__PERSISTENT_WIDTH ? 0 : ((count - 1) >> JSON__PERSISTENT_BITS) << JSON__PERSISTENT_BITS;
+}
 
-    // Reallocate to actual size
-    char *result = (char *) json_realloc(buffer, pos + 1);
-    return result ? result : buffer;
+// Wraps `leaf` in single-child nodes up to level `shift`, takes ownership of `leaf`
+static struct json__pvec_node *json__pvec_path(int shift, struct json__pvec_node *leaf)
+{
+    struct json__pvec_node *node, *child;
+
+    if (shift == 0)
+        return leaf;
+
+    if ((child = json__pvec_path(shift - JSON__PERSISTENT_BITS, leaf)) == NULL)
+        return NULL;
+
+    if ((node = json__pvec_node_new()) == NULL) {
+        json__pvec_node_release(child, shift - JSON__PERSISTENT_BITS);
+        return NULL;
+    }
+
+    node->slots[0] = child;
+    return node;
 }
 
-JSON_API char *json_encode(struct json_value *value)
+// Returns a copy of `parent` with the full tail `leaf` appended as the leaf covering
+// element `index`. Takes ownership of `leaf`, releasing it on failure.
+static struct json__pvec_node *json__pvec_push_tail(const struct json__pvec_node *parent, int shift, int index,
+                                                    struct json__pvec_node *leaf)
 {
-    switch (value->type) {
-    case JSON_TYPE_STRING:
-        return json__encode_string(value);
-    case JSON_TYPE_NUMBER: {
-        char *ptr;
-        char buffer[32];
-        int length = snprintf(buffer, sizeof(buffer), "%.17g", value->number);
+    int slot = (index >> shift) & JSON__PERSISTENT_MASK;
+    struct json__pvec_node *copy, *child;
 
-        if ((ptr = json_alloc(length + 1)) == NULL)
-            return NULL;
+    if (shift == JSON__PERSISTENT_BITS)
+        child = leaf;
+    else if (parent != NULL && parent->slots[slot] != NULL)
+        child = json__pvec_push_tail((const struct json__pvec_node *) parent->slots[slot], shift - JSON__PERSISTENT_BITS, index, leaf);
+    else
+        child = json__pvec_path(shift - JSON__PERSISTENT_BITS, leaf);
 
-        for (int i = 0; i < length; i++)
-            ptr[i] = buffer[i];
+    if (child == NULL)
+        return NULL;
 
-        ptr[length] = 0;
-        return ptr;
+    if ((copy = json__pvec_node_copy(parent, shift, slot)) == NULL) {
+        json__pvec_node_release(child, shift - JSON__PERSISTENT_BITS);
+        return NULL;
     }
-    case JSON_TYPE_BOOLEAN: {
-        char *ptr;
-        const char *boolean_str = value->number != 0.0 ? "true" : "false";
-        int length = json__strlen(boolean_str);
 
-        if ((ptr = json_alloc(length + 1)) == NULL)
+    copy->slots[slot] = child;
+    return copy;
+}
+
+// Returns a copy of `node` with element `index` replaced, takes ownership of `value`
+static struct json__pvec_node *json__pvec_assoc(const struct json__pvec_node *node, int shift, int index, struct json_pvalue *value)
+{
+    int slot = (index >> shift) & JSON__PERSISTENT_MASK;
+    struct json__pvec_node *copy;
+    void *child = value;
+
+    if (shift > 0) {
+        child = json__pvec_assoc((const struct json__pvec_node *) node->slots[slot], shift - JSON__PERSISTENT_BITS, index, value);
+        if (child == NULL)
             return NULL;
+    }
 
-        for (int i = 0; i < length; i++)
-            ptr[i] = boolean_str[i];
+    if ((copy = json__pvec_node_copy(node, shift, slot)) == NULL) {
+        if (shift == 0)
+            json_pvalue_release(value);
+        else
+            json__pvec_node_release((struct json__pvec_node *) child, shift - JSON__PERSISTENT_BITS);
+        return NULL;
+    }
 
-        ptr[length] = 0;
-        return ptr;
+    copy->slots[slot] = child;
+    return copy;
+}
+
+JSON_API struct json_pvalue *json_pvalue_object_new(void)
+{
+    return json__pvalue_new(JSON_TYPE_OBJECT);
+}
+
+JSON_API struct json_pvalue *json_pvalue_array_new(void)
+{
+    struct json_pvalue *array = json__pvalue_new(JSON_TYPE_ARRAY);
+
+    if (array != NULL)
+        array->vector.shift = JSON__PERSISTENT_BITS;
+    return array;
+}
+
+JSON_API struct json_pvalue *json_pvalue_string_new(const char *string)
+{
+    int length = json__strlen(string);
+    struct json_pvalue *value = (struct json_pvalue *) json_alloc(sizeof(struct json_pvalue) + length + 1);
+
+    if (value == NULL)
+        return NULL;
+
+    // The string data lives in the same block, right after the value
+    memset(value, 0, sizeof(*value));
+    value->type = JSON_TYPE_STRING;
+    value->refcount = 1;
+    value->count = length;
+    value->string = (char *) (value + 1);
+    memcpy(value->string, string, length + 1);
+    return value;
+}
+
+JSON_API struct json_pvalue *json_pvalue_number_new(double number)
+{
+    struct json_pvalue *value = json__pvalue_new(JSON_TYPE_NUMBER);
+
+    if (value != NULL)
+        value->number = number;
+    return value;
+}
+
+JSON_API struct json_pvalue *json_pvalue_boolean_new(int boolean)
+{
+    struct json_pvalue *value = json__pvalue_new(JSON_TYPE_BOOLEAN);
+
+    if (value != NULL)
+        value->number = boolean != 0;
+    return value;
+}
+
+JSON_API struct json_pvalue *json_pvalue_null_new(void)
+{
+    return json__pvalue_new(JSON_TYPE_NULL);
+}
+
+JSON_API struct json_pvalue *json_pvalue_retain(struct json_pvalue *value)
+{
+    JSON__ATOMIC_INC(&value->refcount);
+    return value;
+}
+
+JSON_API void json_pvalue_release(struct json_pvalue *value)
+{
+    if (value == NULL || JSON__ATOMIC_DEC(&value->refcount) > 0)
+        return;
+
+    if (value->type == JSON_TYPE_OBJECT) {
+        json__pmap_node_release(value->map);
+    } else if (value->type == JSON_TYPE_ARRAY) {
+        json__pvec_node_release(value->vector.root, value->vector.shift);
+        json__pvec_node_release(value->vector.tail, 0);
     }
-    case JSON_TYPE_NULL: {
-        char *ptr;
-        const char *null_str = "null";
-        int length = json__strlen(null_str);
 
-        if ((ptr = json_alloc(length + 1)) == NULL)
-            return NULL;
+    json__free(value);
+}
 
-        for (int i = 0; i < length; i++)
-            ptr[i] = null_str[i];
+JSON_API struct json_pvalue *json_pvalue_get(const struct json_pvalue *object, const char *key)
+{
+    struct json__pmap_leaf *leaf;
 
-        ptr[length] = 0;
-        return ptr;
+    if (object->type != JSON_TYPE_OBJECT)
+        return NULL;
+
+    leaf = json__pmap_find(object->map, key, json__strlen(key));
+    return leaf != NULL ? leaf->value : NULL;
+}
+
+JSON_API struct json_pvalue *json_pvalue_at(const struct json_pvalue *array, int index)
+{
+    const struct json__pvec_node *node;
+
+    if (array->type != JSON_TYPE_ARRAY || index < 0 || index >= array->count)
+        return NULL;
+
+    if (index >= json__pvec_tail_offset(array->count))
+        return (struct json_pvalue *) array->vector.tail->slots[index & JSON__PERSISTENT_MASK];
+
+    node = array->vector.root;
+    for (int shift = array->vector.shift; shift > 0; shift -= JSON__PERSISTENT_BITS)
+        node = (const struct json__pvec_node *) node->slots[(index >> shift) & JSON__PERSISTENT_MASK];
+
+    return (struct json_pvalue *) node->slots[index & JSON__PERSISTENT_MASK];
+}
+
+JSON_API struct json_pvalue *json_pvalue_set(const struct json_pvalue *object, const char *key, struct json_pvalue *value)
+{
+    struct json_pvalue *version;
+    struct json__pmap_leaf *leaf;
+    int added;
+
+    if (object->type != JSON_TYPE_OBJECT || (version = json__pvalue_new(JSON_TYPE_OBJECT)) == NULL) {
+        json_pvalue_release(value);
+        return NULL;
     }
-    case JSON_TYPE_ARRAY:
-        return json__encode_array(value);
-    case JSON_TYPE_OBJECT:
-        return json__encode_object(value);
-    default:
+
+    if ((leaf = json__pmap_leaf_new(key, json__strlen(key), value)) == NULL
+        || (version->map = json__pmap_assoc(object->map, 0, leaf, &added)) == NULL) {
+        json__free(version);
         return NULL;
     }
+
+    version->count = object->count + added;
+    return version;
 }
 
-JSON_API void json_object_init(struct json_value *object)
+JSON_API struct json_pvalue *json_pvalue_remove(const struct json_pvalue *object, const char *key)
 {
-    object->object.n_items = 0;
-    object->object.capacity = 0;
-    object->object.items = NULL;
+    struct json_pvalue *version;
+    struct json__pmap_node *map;
+    int length = json__strlen(key), status;
+
+    if (object->type != JSON_TYPE_OBJECT)
+        return NULL;
+
+    if (object->map == NULL)
+        return json_pvalue_retain((struct json_pvalue *) object);
+
+    map = json__pmap_dissoc(object->map, 0, json__hash_bytes(key, (size_t) length, JSON_HASH_SEED), key, length, &status);
+    if (status < 0)
+        return NULL;
+
+    // Nothing to remove, the new version is the old one
+    if (status == 0)
+        return json_pvalue_retain((struct json_pvalue *) object);
+
+    if ((version = json__pvalue_new(JSON_TYPE_OBJECT)) == NULL) {
+        json__pmap_node_release(map);
+        return NULL;
+    }
+
+    version->map = map;
+    version->count = object->count - 1;
+    return version;
 }
 
-JSON_API struct json_value *json_object_new(void)
+JSON_API struct json_pvalue *json_pvalue_push(const struct json_pvalue *array, struct json_pvalue *value)
 {
-    struct json_value *object = (struct json_value *) json_alloc(sizeof(struct json_value));
-    if (!object) {
+    struct json_pvalue *version;
+    int count = array->count, shift = array->vector.shift;
+    struct json__pvec_node *root = array->vector.root, *tail;
+
+    if (array->type != JSON_TYPE_ARRAY || (version = json__pvalue_new(JSON_TYPE_ARRAY)) == NULL) {
+        json_pvalue_release(value);
         return NULL;
     }
 
-    object->type = JSON_TYPE_OBJECT;
-    json_object_init(object);
+    if (count - json__pvec_tail_offset(count) < JSON__PERSISTENT_WIDTH) {
+        // Room left in the tail
+        if ((tail = json__pvec_node_copy(array->vector.tail, 0, -1)) == NULL)
+            goto fail;
 
-    return object;
+        if (root != NULL)
+            JSON__ATOMIC_INC(&root->refcount);
+    } else {
+        // The tail is full, move it into the trie and start a new one
+        JSON__ATOMIC_INC(&array->vector.tail->refcount);
+
+        if ((count >> JSON__PERSISTENT_BITS) > (1 << shift)) {
+            struct json__pvec_node *path = json__pvec_path(shift, array->vector.tail);
+
+            if (path == NULL)
+                goto fail;
+
+            if ((root = json__pvec_node_new()) == NULL) {
+                json__pvec_node_release(path, shift);
+                goto fail;
+            }
+
+            JSON__ATOMIC_INC(&array->vector.root->refcount);
+            root->slots[0] = array->vector.root;
+            root->slots[1] = path;
+            shift += JSON__PERSISTENT_BITS;
+        } else if ((root = json__pvec_push_tail(root, shift, count - 1, array->vector.tail)) == NULL) {
+            goto fail;
+        }
+
+        if ((tail = json__pvec_node_new()) == NULL) {
+            json__pvec_node_release(root, shift);
+            goto fail;
+        }
+    }
+
+    tail->slots[count & JSON__PERSISTENT_MASK] = value;
+    version->vector.root = root;
+    version->vector.tail = tail;
+    version->vector.shift = shift;
+    version->count = count + 1;
+    return version;
+
+fail:
+    json_pvalue_release(value);
+    json__free(version);
+    return NULL;
 }
 
-JSON_API void json_object_free(struct json_value *object)
+JSON_API struct json_pvalue *json_pvalue_replace(const struct json_pvalue *array, int index, struct json_pvalue *value)
 {
-    for (int i = 0; i < object->object.n_items; i++) {
-        json_free(object->object.items[i]->value);
-        json__free(object->object.items[i]->key);
-        json__free(object->object.items[i]);
+    struct json_pvalue *version;
+    struct json__pvec_node *root = array->vector.root, *tail = array->vector.tail;
+
+    if (array->type != JSON_TYPE_ARRAY || index < 0 || index >= array->count
+        || (version = json__pvalue_new(JSON_TYPE_ARRAY)) == NULL) {
+        json_pvalue_release(value);
+        return NULL;
+    }
+
+    if (index >= json__pvec_tail_offset(array->count)) {
+        if ((tail = json__pvec_node_copy(tail, 0, index & JSON__PERSISTENT_MASK)) == NULL) {
+            json_pvalue_release(value);
+            json__free(version);
+            return NULL;
+        }
+
+        tail->slots[index & JSON__PERSISTENT_MASK] = value;
+        if (root != NULL)
+            JSON__ATOMIC_INC(&root->refcount);
+    } else {
+        if ((root = json__pvec_assoc(root, array->vector.shift, index, value)) == NULL) {
+            json__free(version);
+            return NULL;
+        }
+
+        JSON__ATOMIC_INC(&tail->refcount);
     }
 
-    json__free(object->object.items);
-    json__free(object);
+    version->vector.root = root;
+    version->vector.tail = tail;
+    version->vector.shift = array->vector.shift;
+    version->count = array->count;
+    return version;
 }
 
-JSON_API int json_object_set(struct json_value *object, const char *key, struct json_value *value)
+JSON_API int json_pvalue_object_foreach(const struct json_pvalue *object,
+                                        int (*callback)(const char *key, struct json_pvalue *value, void *context),
+                                        void *context)
 {
-    if (object->object.n_items >= object->object.capacity * JSON_OBJECT_CAPACITY_THRESHOLD) {
-        void *items;
-        int capacity;
+    if (object->type != JSON_TYPE_OBJECT)
+        return 0;
 
-        if (object->object.capacity)
-            capacity = object->object.capacity * JSON_OBJECT_CAPACITY_MULTIPLIER;
-        else
-            capacity = JSON_OBJECT_INITIAL_CAPACITY;
+    return json__pmap_foreach(object->map, callback, context);
+}
 
-        if ((items = json_realloc(object->object.items, capacity * sizeof(*object->object.items))) == NULL)
-            return -1;
+JSON_API struct json_pvalue *json_pvalue_from(const struct json_value *value)
+{
+    struct json_pvalue *result, *child, *version;
 
-        object->object.items = items;
-        object->object.capacity = capacity;
-    }
+    switch (value->type) {
+    case JSON_TYPE_OBJECT:
+        if ((result = json_pvalue_object_new()) == NULL)
+            return NULL;
 
-    for (int i = 0; i < object->object.n_items; i++) {
-        if (json__streq(object->object.items[i]->key, key)) {
-            json_free(object->object.items[i]->value);
-            object->object.items[i]->value = value;
-            return 0;
+        for (int i = 0; i < value->object.n_items; i++) {
+            if ((child = json_pvalue_from(value->object.items[i]->value)) == NULL
+                || (version = json_pvalue_set(result, value->object.items[i]->key, child)) == NULL) {
+                json_pvalue_release(result);
+                return NULL;
+            }
+
+            json_pvalue_release(result);
+            result = version;
+        }
+        return result;
+    case JSON_TYPE_ARRAY:
+        if ((result = json_pvalue_array_new()) == NULL)
+            return NULL;
+
+        for (int i = 0; i < value->array.length; i++) {
+            if ((child = json_pvalue_from(value->array.items[i])) == NULL
+                || (version = json_pvalue_push(result, child)) == NULL) {
+                json_pvalue_release(result);
+                return NULL;
+            }
+
+            json_pvalue_release(result);
+            result = version;
+        }
+        return result;
+    case JSON_TYPE_NUMBER_ARRAY:
+        if ((result = json_pvalue_array_new()) == NULL)
+            return NULL;
+
+        for (int i = 0; i < value->array.length; i++) {
+            if ((child = json_pvalue_number_new(value->array.numbers[i])) == NULL
+                || (version = json_pvalue_push(result, child)) == NULL) {
+                json_pvalue_release(result);
+                return NULL;
+            }
+
+            json_pvalue_release(result);
+            result = version;
         }
+        return result;
+    case JSON_TYPE_STRING:
+        return json_pvalue_string_new(value->string.value);
+    case JSON_TYPE_NUMBER:
+        return json_pvalue_number_new(value->number);
+    case JSON_TYPE_BOOLEAN:
+        return json_pvalue_boolean_new((int) value->number);
+    default:
+        return json_pvalue_null_new();
     }
+}
 
-    int idx = object->object.n_items++;
-    object->object.items[idx] = json_alloc(sizeof(*object->object.items[idx]));
+static int json__pvalue_to_member(const char *key, struct json_pvalue *value, void *context)
+{
+    struct json_value *member = json_pvalue_to_value(value);
 
-    if (object->object.items[idx] == NULL)
+    if (member == NULL)
         return -1;
 
-    int key_len = json__strlen(key);
-    object->object.items[idx]->key = json_alloc(key_len + 1);
-    strncpy(object->object.items[idx]->key, key, key_len);
-    object->object.items[idx]->key[key_len] = '\0';
-    object->object.items[idx]->value = value;
+    if (json_object_set((struct json_value *) context, key, member) != 0) {
+        json_free(member);
+        return -1;
+    }
 
     return 0;
 }
 
-JSON_API int json_object_has(struct json_value *object, const char *key)
+JSON_API struct json_value *json_pvalue_to_value(const struct json_pvalue *value)
 {
-    for (int i = 0; i < object->object.n_items; i++)
-        if (json__streq(object->object.items[i]->key, key))
-            return 1;
+    struct json_value *result, *element;
 
-    return 0;
+    switch (value->type) {
+    case JSON_TYPE_OBJECT:
+        if ((result = json_object_new()) == NULL)
+            return NULL;
+
+        if (json__pmap_foreach(value->map, json__pvalue_to_member, result) != 0) {
+            json_free(result);
+            return NULL;
+        }
+        return result;
+    case JSON_TYPE_ARRAY:
+        if ((result = json_array_new()) == NULL)
+            return NULL;
+
+        for (int i = 0; i < value->count; i++) {
+            if ((element = json_pvalue_to_value(json_pvalue_at(value, i))) == NULL) {
+                json_free(result);
+                return NULL;
+            }
+
+            if (json_array_push(result, element) != 0) {
+                json_free(element);
+                json_free(result);
+                return NULL;
+            }
+        }
+        return result;
+    case JSON_TYPE_STRING:
+        return json_string_new(value->string);
+    case JSON_TYPE_NUMBER:
+        return json_number_new(value->number);
+    case JSON_TYPE_BOOLEAN:
+        return json_boolean_new((int) value->number);
+    default:
+        if ((result = json__value_alloc()) != NULL)
+            result->type = JSON_TYPE_NULL;
+        return result;
+    }
 }
 
-JSON_API struct json_value *json_object_get(struct json_value *object, const char *key)
+JSON_API char *json_pvalue_encode(const struct json_pvalue *value)
 {
-    if (object == NULL || object->object.items == NULL)
-        return NULL;
+    struct json_value *tree = json_pvalue_to_value(value);
+    char *encoded;
 
-    for (int i = 0; i < object->object.n_items; i++)
-        if (object->object.items[i] != NULL && object->object.items[i]->key != NULL
-            && json__streq(object->object.items[i]->key, key))
-            return object->object.items[i]->value;
+    if (tree == NULL)
+        return NULL;
 
-    return NULL;
+    encoded = json_encode(tree);
+    json_free(tree);
+    return encoded;
 }
+#endif
 
-JSON_API void json_object_remove(struct json_value *object, const char *key)
+#if defined(JSON_SNAPSHOT)
+
+# define JSON__SNAPSHOT_MAGIC "JSONSNAP"
+# define JSON__SNAPSHOT_VERSION 1
+# define JSON__SNAPSHOT_BYTE_ORDER 0x01020304u
+# define JSON__SNAPSHOT_HEADER_SIZE 16
+# define JSON__SNAPSHOT_TRAILER_SIZE 8
+# define JSON__SNAPSHOT_BUFFER_SIZE 65536
+# define JSON__SNAPSHOT_SEED 0x9e3779b97f4a7c15ULL
+
+struct json__snapshot_entry
 {
-    for (int i = 0; i < object->object.n_items; i++) {
-        if (json__streq(object->object.items[i]->key, key)) {
-            switch (object->object.items[i]->value->type) {
-            case JSON_TYPE_ARRAY:
-                json_array_free(object->object.items[i]->value);
-                break;
-            case JSON_TYPE_OBJECT:
-                json_object_free(object->object.items[i]->value);
-                break;
-            case JSON_TYPE_STRING:
-                json_string_free(object->object.items[i]->value);
-                break;
-            default:
-                json__free(object->object.items[i]->value);
-                break;
-            }
+    int64_t key;         // Offset of the null-terminated key, relative to the object
+    int64_t value;       // Offset of the value, relative to the object
+    uint64_t hash;       // Hash of the key bytes
+    uint32_t key_length; // Length of the key (excluding null terminator)
+    uint32_t reserved;
+};
 
-            json__free(object->object.items[i]->key);
-            json__free(object->object.items[i]);
+struct json__snapshot_order
+{
+    uint64_t hash;
+    uint32_t index;
+};
 
-            if (i < object->object.n_items - 1) {
-                object->object.items[i] = object->object.items[object->object.n_items - 1];
-            }
+struct json__snapshot_writer
+{
+    int fd;
+    char *buffer;
+    size_t used;
+    int64_t offset;
+};
+
+static int json__snapshot_flush(struct json__snapshot_writer *writer)
+{
+    size_t done = 0;
 
-            object->object.n_items--;
+    while (done < writer->used) {
+        ssize_t n = write(writer->fd, writer->buffer + done, writer->used - done);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
         }
+        done += (size_t) n;
     }
+
+    writer->used = 0;
+    return 0;
 }
 
-JSON_API int json_object_iter(const struct json_value *object, int *iter, char **key, struct json_value **value)
+static int json__snapshot_put(struct json__snapshot_writer *writer, const void *data, size_t size)
 {
-    if (*iter >= object->object.n_items)
-        return 0;
-
-    *key = object->object.items[*iter]->key;
-    *value = object->object.items[(*iter)++]->value;
+    const char *bytes = (const char *) data;
 
-    return 1;
-}
+    while (size > 0) {
+        size_t chunk = JSON__SNAPSHOT_BUFFER_SIZE - writer->used;
+        if (chunk > size)
+            chunk = size;
 
-JSON_API void json_object_clear(struct json_value *object)
-{
-    char *key;
-    int iter = 0;
-    struct json_value *value;
+        memcpy(writer->buffer + writer->used, bytes, chunk);
+        writer->used += chunk;
+        writer->offset += chunk;
+        bytes += chunk;
+        size -= chunk;
 
-    while (json_object_iter(object, &iter, &key, &value)) {
-        json_object_remove(object, key);
-        iter--;
+        if (writer->used == JSON__SNAPSHOT_BUFFER_SIZE && json__snapshot_flush(writer) != 0)
+            return -1;
     }
-}
 
-JSON_API void json_array_init(struct json_value *array)
-{
-    array->array.length = 0;
-    array->array.capacity = 0;
-    array->array.items = NULL;
+    return 0;
 }
 
-JSON_API struct json_value *json_array_new(void)
+static int json__snapshot_align(struct json__snapshot_writer *writer)
 {
-    struct json_value *value;
-    if ((value = json_alloc(sizeof(struct json_value))) == NULL)
-        return NULL;
-
-    value->type = JSON_TYPE_ARRAY;
-    json_array_init(value);
-
-    return value;
+    static const char padding[8] = {0};
+    return json__snapshot_put(writer, padding, (size_t) ((8 - (writer->offset & 7)) & 7));
 }
 
-JSON_API void json_array_free(struct json_value *value)
+static int json__snapshot_order_compare(const void *a, const void *b)
 {
-    for (int i = 0; i < value->array.length; i++) {
-        switch (value->array.items[i]->type) {
-        case JSON_TYPE_OBJECT:
-            json_object_free(value->array.items[i]);
-            break;
-        case JSON_TYPE_ARRAY:
-            json_array_free(value->array.items[i]);
-            break;
-        case JSON_TYPE_STRING:
-            json_string_free(value->array.items[i]);
-            break;
-        default:
-            json__free(value->array.items[i]);
-            break;
-        }
-    }
-    json__free(value->array.items);
-    json__free(value);
+    uint64_t ha = ((const struct json__snapshot_order *) a)->hash;
+    uint64_t hb = ((const struct json__snapshot_order *) b)->hash;
+    return ha < hb ? -1 : ha > hb ? 1 : 0;
 }
 
-JSON_API void json_free(struct json_value *value)
+// Children are written before their parent so that every container knows
+// the offsets it has to store, returns the offset of the node or -1
+static int64_t json__snapshot_write_value(struct json__snapshot_writer *writer, struct json_value *value)
 {
+    struct json_snapshot_value node;
+    int64_t offset;
+
+    node.type = (uint32_t) value->type;
+    node.length = 0;
+
     switch (value->type) {
-    case JSON_TYPE_OBJECT:
-        json_object_free(value);
-        break;
-    case JSON_TYPE_ARRAY:
-        json_array_free(value);
-        break;
     case JSON_TYPE_STRING:
-        json_string_free(value);
-        break;
-    default:
-        json__free(value);
-    }
-}
+        node.length = (uint32_t) value->string.length;
+        if (json__snapshot_align(writer) != 0)
+            return -1;
 
-JSON_API struct json_value *json_deep_copy(struct json_value *value)
-{
-    struct json_value *new_value;
-    struct json_value *element;
-    char *key;
-    int iter;
+        offset = writer->offset;
+        if (json__snapshot_put(writer, &node, sizeof(node)) != 0
+            || json__snapshot_put(writer, value->string.value, (size_t) value->string.length + 1) != 0)
+            return -1;
+        return offset;
 
-    iter = 0;
+    case JSON_TYPE_NUMBER:
+        if (json__snapshot_align(writer) != 0)
+            return -1;
 
-    switch (value->type) {
-    case JSON_TYPE_OBJECT:
-        new_value = json_object_new();
-        while (json_object_iter(value, &iter, &key, &element))
-            json_object_set(new_value, key, json_deep_copy(element));
-        return new_value;
+        offset = writer->offset;
+        if (json__snapshot_put(writer, &node, sizeof(node)) != 0
+            || json__snapshot_put(writer, &value->number, sizeof(value->number)) != 0)
+            return -1;
+        return offset;
 
     case JSON_TYPE_ARRAY:
-        new_value = json_array_new();
-        while (json_array_iter(value, &iter, &element))
-            json_array_push(new_value, json_deep_copy(element));
-        return new_value;
+    case JSON_TYPE_NUMBER_ARRAY: {
+        int count = value->array.length;
+        int64_t *children = (int64_t *) json_alloc(sizeof(*children) * (count ? count : 1));
 
-    case JSON_TYPE_STRING:
-        return json_string_new(value->string.value);
+        if (children == NULL)
+            return -1;
 
-    default:
-        new_value = json_alloc(sizeof(struct json_value));
-        memcpy(new_value, value, sizeof(*value));
-        return new_value;
-    }
+        for (int i = 0; i < count; i++) {
+            struct json_value number, *item = value->array.items[i];
 
-    return NULL;
-}
+            // Packed elements are written as regular number nodes
+            if (value->type == JSON_TYPE_NUMBER_ARRAY) {
+                number.type = JSON_TYPE_NUMBER;
+                number.number = value->array.numbers[i];
+                item = &number;
+            }
 
-JSON_API void json_array_remove(struct json_value *array, int index)
-{
-    switch (array->array.items[index]->type) {
-    case JSON_TYPE_OBJECT:
-        json_object_free(array->array.items[index]);
-        break;
-    case JSON_TYPE_ARRAY:
-        json_array_free(array->array.items[index]);
-        break;
-    case JSON_TYPE_STRING:
-        json_string_free(array->array.items[index]);
-        break;
-    default:
-        break;
-    }
+            if ((children[i] = json__snapshot_write_value(writer, item)) < 0) {
+                json__free(children);
+                return -1;
+            }
+        }
 
-    for (int i = index; i < array->array.length - 1; i++)
-        array->array.items[i] = array->array.items[i + 1];
-    array->array.length--;
-}
+        node.type = JSON_TYPE_ARRAY;
+        node.length = (uint32_t) count;
+        if (json__snapshot_align(writer) != 0 || json__snapshot_put(writer, &node, sizeof(node)) != 0) {
+            json__free(children);
+            return -1;
+        }
 
-JSON_API inline int json_array_length(struct json_value *array)
-{
-    return array->array.length;
-}
+        offset = writer->offset - (int64_t) sizeof(node);
+        for (int i = 0; i < count; i++) {
+            int64_t relative = children[i] - offset;
+            if (json__snapshot_put(writer, &relative, sizeof(relative)) != 0) {
+                json__free(children);
+                return -1;
+            }
+        }
 
-JSON_API
-int json_array_push(struct json_value *array, struct json_value *value)
-{
-    if (array == NULL) {
-        return -1;
+        json__free(children);
+        return offset;
     }
 
-    int index = array->array.length;
-    int capacity = array->array.capacity;
-    int capacity_threshold = capacity * JSON_ARRAY_CAPACITY_THRESHOLD;
+    case JSON_TYPE_OBJECT: {
+        int count = value->object.n_items;
+        struct json__snapshot_entry *entries;
+        struct json__snapshot_order *order;
 
-    if (index >= capacity_threshold) {
-        int capacity;
-        if (array->array.capacity > 0)
-            capacity = array->array.capacity * JSON_ARRAY_CAPACITY_MULTIPLIER;
-        else
-            capacity = JSON_ARRAY_INITIAL_CAPACITY;
+        entries = (struct json__snapshot_entry *) json_alloc(sizeof(*entries) * (count ? count : 1));
+        order = (struct json__snapshot_order *) json_alloc(sizeof(*order) * (count ? count : 1));
+        if (entries == NULL || order == NULL) {
+            json__free(entries);
+            json__free(order);
+            return -1;
+        }
+
+        for (int i = 0; i < count; i++) {
+            const char *key = value->object.items[i]->key;
+            int key_length = value->object.items[i]->key_length;
+
+            entries[i].key = writer->offset;
+            entries[i].key_length = (uint32_t) key_length;
+            entries[i].hash = json__hash_bytes(key, (size_t) key_length, JSON__SNAPSHOT_SEED);
+            entries[i].reserved = 0;
+            order[i].hash = entries[i].hash;
+            order[i].index = (uint32_t) i;
+
+            if (json__snapshot_put(writer, key, (size_t) key_length + 1) != 0
+                || (entries[i].value = json__snapshot_write_value(writer, value->object.items[i]->value)) < 0) {
+                json__free(entries);
+                json__free(order);
+                return -1;
+            }
+        }
 
-        struct json_value **items;
-        int size = capacity * sizeof(struct json_value *);
-        if ((items = json_realloc(array->array.items, size)) == NULL)
+        qsort(order, (size_t) count, sizeof(*order), json__snapshot_order_compare);
+
+        node.length = (uint32_t) count;
+        if (json__snapshot_align(writer) != 0 || json__snapshot_put(writer, &node, sizeof(node)) != 0) {
+            json__free(entries);
+            json__free(order);
             return -1;
+        }
 
-        array->array.items = items;
-        array->array.capacity = capacity;
+        offset = writer->offset - (int64_t) sizeof(node);
+        for (int i = 0; i < count; i++) {
+            entries[i].key -= offset;
+            entries[i].value -= offset;
+        }
+
+        int rc = json__snapshot_put(writer, entries, sizeof(*entries) * (size_t) count);
+        for (int i = 0; rc == 0 && i < count; i++)
+            rc = json__snapshot_put(writer, &order[i].index, sizeof(order[i].index));
+
+        json__free(entries);
+        json__free(order);
+        return rc == 0 ? offset : -1;
     }
 
-    array->array.items[array->array.length++] = value;
-    return 0;
-}
+    default:
+        if (value->type == JSON_TYPE_BOOLEAN)
+            node.length = value->number != 0.0;
 
-JSON_API int json_array_iter(struct json_value *array, int *index, struct json_value **value)
-{
-    if (*index >= array->array.length)
-        return 0;
+        if (json__snapshot_align(writer) != 0)
+            return -1;
 
-    *value = array->array.items[(*index)++];
-    return 1;
+        offset = writer->offset;
+        if (json__snapshot_put(writer, &node, sizeof(node)) != 0)
+            return -1;
+        return offset;
+    }
 }
 
-JSON_API void json_array_clear(struct json_value *array)
+JSON_API int json_snapshot_write(struct json_value *value, int fd)
 {
-    int iter = 0;
-    struct json_value *value;
+    struct json__snapshot_writer writer;
+    uint32_t version = JSON__SNAPSHOT_VERSION;
+    uint32_t byte_order = JSON__SNAPSHOT_BYTE_ORDER;
+    int64_t root;
+    int rc = -1;
+
+    writer.fd = fd;
+    writer.used = 0;
+    writer.offset = 0;
+    if ((writer.buffer = (char *) json_alloc(JSON__SNAPSHOT_BUFFER_SIZE)) == NULL)
+        return -1;
+
+    if (json__snapshot_put(&writer, JSON__SNAPSHOT_MAGIC, 8) != 0
+        || json__snapshot_put(&writer, &version, sizeof(version)) != 0
+        || json__snapshot_put(&writer, &byte_order, sizeof(byte_order)) != 0)
+        goto out;
 
-    while (json_array_iter(array, &iter, &value))
-        json_array_remove(array, iter--);
+    if ((root = json__snapshot_write_value(&writer, value)) < 0)
+        goto out;
+
+    // The root offset goes last so the image can be streamed
+    if (json__snapshot_align(&writer) == 0 && json__snapshot_put(&writer, &root, sizeof(root)) == 0
+        && json__snapshot_flush(&writer) == 0)
+        rc = 0;
+
+out:
+    json__free(writer.buffer);
+    return rc;
 }
 
-JSON_API struct json_value *json_string_new(const char *string)
+JSON_API struct json_snapshot *json_snapshot_open(const char *path)
 {
-    struct json_value *value;
-    if ((value = json_alloc(sizeof(struct json_value))) == NULL)
+    struct json_snapshot *snapshot;
+    struct stat st;
+    const char *base;
+    uint32_t version, byte_order;
+    int64_t root;
+    size_t size;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
         return NULL;
 
-    value->type = JSON_TYPE_STRING;
-    value->string.length = json__strlen(string);
-    if ((value->string.value = json_alloc(value->string.length + 1)) == NULL) {
-        json__free(value);
+    if (fstat(fd, &st) != 0 || st.st_size < JSON__SNAPSHOT_HEADER_SIZE + JSON__SNAPSHOT_TRAILER_SIZE) {
+        close(fd);
         return NULL;
     }
 
-    for (int i = 0; i < value->string.length; i++)
-        value->string.value[i] = string[i];
+    size = (size_t) st.st_size;
+    base = (const char *) mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
 
-    value->string.value[value->string.length] = 0;
-    return value;
-}
+    if (base == (const char *) MAP_FAILED)
+        return NULL;
 
-JSON_API struct json_value *json_number_new(double value)
-{
-    struct json_value *number;
-    if ((number = json_alloc(sizeof(struct json_value))) == NULL)
+    memcpy(&version, base + 8, sizeof(version));
+    memcpy(&byte_order, base + 12, sizeof(byte_order));
+    memcpy(&root, base + size - JSON__SNAPSHOT_TRAILER_SIZE, sizeof(root));
+
+    if (memcmp(base, JSON__SNAPSHOT_MAGIC, 8) != 0 || version != JSON__SNAPSHOT_VERSION
+        || byte_order != JSON__SNAPSHOT_BYTE_ORDER || root < JSON__SNAPSHOT_HEADER_SIZE || (root & 7) != 0
+        || (size_t) root + sizeof(struct json_snapshot_value) > size - JSON__SNAPSHOT_TRAILER_SIZE) {
+        munmap((void *) base, size);
         return NULL;
+    }
 
-    number->type = JSON_TYPE_NUMBER;
-    number->number = value;
+    if ((snapshot = (struct json_snapshot *) json_alloc(sizeof(*snapshot))) == NULL) {
+        munmap((void *) base, size);
+        return NULL;
+    }
 
-    return number;
+    snapshot->base = base;
+    snapshot->size = size;
+    snapshot->root = (const struct json_snapshot_value *) (base + root);
+    return snapshot;
 }
 
-JSON_API struct json_value *json_boolean_new(int value)
+JSON_API void json_snapshot_close(struct json_snapshot *snapshot)
 {
-    struct json_value *boolean;
-    if ((boolean = json_alloc(sizeof(struct json_value))) == NULL)
-        return NULL;
-
-    boolean->type = JSON_TYPE_BOOLEAN;
-    boolean->number = value;
+    if (snapshot == NULL)
+        return;
 
-    return boolean;
+    munmap((void *) snapshot->base, snapshot->size);
+    json__free(snapshot);
 }
 
-JSON_API void json_string_free(struct json_value *string)
+JSON_API const struct json_snapshot_value *json_snapshot_root(const struct json_snapshot *snapshot)
 {
-    json__free(string->string.value);
-    json__free(string);
+    return snapshot->root;
 }
 
-static inline void json__print_indent(int indent)
+JSON_API const struct json_snapshot_value *json_snapshot_array_get(const struct json_snapshot_value *array, int index)
 {
-    for (int i = 0; i < indent; i++) {
-        putchar(' ');
-    }
+    const int64_t *children = (const int64_t *) (array + 1);
+
+    if (index < 0 || (uint32_t) index >= array->length)
+        return NULL;
+
+    return (const struct json_snapshot_value *) ((const char *) array + children[index]);
 }
 
-static void json__print_internal(struct json_value *value, int indent)
+JSON_API const struct json_snapshot_value *json_snapshot_object_get(const struct json_snapshot_value *object,
+                                                                    const char *key)
 {
-    if (value == NULL) {
-        printf("null");
-        return;
+    const struct json__snapshot_entry *entries = (const struct json__snapshot_entry *) (object + 1);
+    const uint32_t *order = (const uint32_t *) (entries + object->length);
+    uint32_t key_length = (uint32_t) json__strlen(key);
+    uint64_t hash = json__hash_bytes(key, key_length, JSON__SNAPSHOT_SEED);
+    uint32_t low = 0, high = object->length;
+
+    // Find the first entry with a matching hash, then compare the keys
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (entries[order[mid]].hash < hash)
+            low = mid + 1;
+        else
+            high = mid;
     }
 
-    switch (value->type) {
-    case JSON_TYPE_STRING:
-        printf("\"%s\"", value->string.value);
-        break;
-    case JSON_TYPE_NUMBER:
-        printf("%.17g", value->number);
-        break;
-    case JSON_TYPE_BOOLEAN:
-        printf("%s", value->number == 0.0 ? "false" : "true");
-        break;
-    case JSON_TYPE_NULL:
-        printf("null");
-        break;
-    case JSON_TYPE_ARRAY:
-        printf("[\n");
-        for (int i = 0; i < value->array.length; i++) {
-            json__print_indent(indent + 2);
-            json__print_internal(value->array.items[i], indent + 2);
-            if (i < value->array.length - 1) {
-                printf(",\n");
-            } else {
-                printf("\n");
-            }
-        }
-        json__print_indent(indent);
-        printf("]");
-        break;
-    case JSON_TYPE_OBJECT:
-        printf("{\n");
-        for (int i = 0; i < value->object.n_items; i++) {
-            json__print_indent(indent + 2);
-            printf("\"%s\": ", value->object.items[i]->key);
-            json__print_internal(value->object.items[i]->value, indent + 2);
-            if (i < value->object.n_items - 1) {
-                printf(",\n");
-            } else {
-                printf("\n");
-            }
-        }
-        json__print_indent(indent);
-        printf("}");
-        break;
-    default:
-        break;
+    for (; low < object->length && entries[order[low]].hash == hash; low++) {
+        const struct json__snapshot_entry *entry = &entries[order[low]];
+        if (entry->key_length == key_length && memcmp((const char *) object + entry->key, key, key_length) == 0)
+            return (const struct json_snapshot_value *) ((const char *) object + entry->value);
     }
+
+    return NULL;
 }
 
-JSON_API void json_print(struct json_value *value)
+JSON_API int json_snapshot_array_iter(const struct json_snapshot_value *array, int *index,
+                                      const struct json_snapshot_value **value)
 {
-    json__print_internal(value, 0);
+    if ((uint32_t) *index >= array->length)
+        return 0;
+
+    *value = json_snapshot_array_get(array, (*index)++);
+    return 1;
 }
 
-JSON_API void json_println(struct json_value *value)
+JSON_API int json_snapshot_object_iter(const struct json_snapshot_value *object, int *iter, const char **key,
+                                       const struct json_snapshot_value **value)
 {
-    json_print(value);
-    putchar('\n');
+    const struct json__snapshot_entry *entries = (const struct json__snapshot_entry *) (object + 1);
+
+    if ((uint32_t) *iter >= object->length)
+        return 0;
+
+    *key = (const char *) object + entries[*iter].key;
+    *value = (const struct json_snapshot_value *) ((const char *) object + entries[(*iter)++].value);
+    return 1;
 }
 
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,1568 @@
+// json.hpp - C++ interface to json.h.
+// Copyright (c) 2025 Kacper Fiedorowicz. All rights reserved.
+// This software is licensed under the MIT License.
+// See LICENSE for more information.
+
+#ifndef JSON_HPP
+#define JSON_HPP
+
+#if defined(JSON_PMR)
+# if defined(JSON_H)
+#  error "JSON_PMR requires json.hpp to be included before json.h"
+# endif
+# if defined(JSON_ALLOC) || defined(JSON_REALLOC) || defined(JSON_FREE)
+#  error "JSON_PMR cannot be combined with custom JSON_ALLOC, JSON_REALLOC or JSON_FREE"
+# endif
+
+# include <cstddef>
+# include <cstring>
+# include <memory_resource>
+
+namespace json
+{
+
+namespace detail
+{
+
+// Resource that allocations made on this thread are drawn from, NULL for the
+// default resource
+inline thread_local std::pmr::memory_resource *current_resource = nullptr;
+
+// Prepended to every block, as memory resources need the size back on
+// deallocation and a block must return to the resource it came from
+struct alignas(std::max_align_t) pmr_header
+{
+    std::size_t size;
+    std::pmr::memory_resource *resource;
+};
+
+} // namespace detail
+
+/**
+ * @brief Allocates `size` bytes from the current thread's memory resource.
+ *
+ * Backs `json_alloc` when `JSON_PMR` is defined. Returns NULL on failure.
+ */
+inline void *pmr_allocate(std::size_t size) noexcept
+{
+    std::pmr::memory_resource *resource = detail::current_resource;
+    detail::pmr_header *header;
+
+    if (resource == nullptr)
+        resource = std::pmr::get_default_resource();
+
+    try {
+        header = static_cast<detail::pmr_header *>(
+            resource->allocate(sizeof(detail::pmr_header) + size, alignof(detail::pmr_header)));
+    } catch (...) {
+        return nullptr;
+    }
+
+    header->size = size;
+    header->resource = resource;
+    return header + 1;
+}
+
+/**
+ * @brief Releases a block from `pmr_allocate` to the resource it came from.
+ *
+ * Strings returned by `json_encode` must be released with this function when
+ * `JSON_PMR` is defined.
+ */
+inline void pmr_free(void *ptr) noexcept
+{
+    if (ptr == nullptr)
+        return;
+
+    detail::pmr_header *header = static_cast<detail::pmr_header *>(ptr) - 1;
+    header->resource->deallocate(header, sizeof(detail::pmr_header) + header->size, alignof(detail::pmr_header));
+}
+
+/**
+ * @brief Resizes a block, keeping it in the resource it was allocated from.
+ */
+inline void *pmr_reallocate(void *ptr, std::size_t size) noexcept
+{
+    std::pmr::memory_resource *previous = detail::current_resource;
+    detail::pmr_header *header;
+    void *block;
+
+    if (ptr == nullptr)
+        return pmr_allocate(size);
+
+    header = static_cast<detail::pmr_header *>(ptr) - 1;
+    detail::current_resource = header->resource;
+    block = pmr_allocate(size);
+    detail::current_resource = previous;
+
+    if (block == nullptr)
+        return nullptr;
+
+    std::memcpy(block, ptr, header->size < size ? header->size : size);
+    pmr_free(ptr);
+    return block;
+}
+
+} // namespace json
+
+# define JSON_ALLOC(size) json::pmr_allocate(size)
+# define JSON_REALLOC(ptr, size) json::pmr_reallocate(ptr, size)
+# define JSON_FREE(ptr) json::pmr_free(ptr)
+#endif
+
+#include "json.h"
+
+#include <compare>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <limits>
+#include <new>
+#include <optional>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <version>
+
+#if defined(__cpp_lib_expected)
+# include <expected>
+#endif
+
+// Requires C++20. Everything lives in the `json` namespace and operates on
+// the same `struct json_value` trees as the C API; nothing is copied.
+
+namespace json
+{
+
+/**
+ * @brief A key-value pair yielded when iterating over an object.
+ */
+struct member
+{
+    std::string_view key;     /**< The key, using the stored key length. */
+    struct json_value *value; /**< The associated value. */
+};
+
+/**
+ * @brief View over the elements of a JSON array.
+ *
+ * The iterators are pointers into the array's item storage, so the view is a
+ * contiguous range and can be passed to parallel algorithms as is. Packed
+ * number arrays are unpacked once when the view is created, after which no
+ * element access touches the array. That conversion is a write; use
+ * `number_view` to read packed arrays without it.
+ *
+ * The view is invalidated by anything that reallocates the array, such as
+ * `json_array_push`.
+ */
+class array_view : public std::ranges::view_interface<array_view>
+{
+public:
+    using iterator = struct json_value *const *;
+
+    array_view() = default;
+
+    /**
+     * @brief Creates a view over `array`.
+     *
+     * A NULL or non-array value yields an empty view.
+     *
+     * @throws std::bad_alloc if a packed array could not be unpacked.
+     */
+    explicit array_view(struct json_value *array)
+    {
+        if (!json_is_array(array))
+            return;
+
+        if (json__array_unpack(array) != 0)
+            throw std::bad_alloc();
+
+        first_ = array->array.items;
+        last_ = first_ + array->array.length;
+    }
+
+    iterator begin() const
+    {
+        return first_;
+    }
+
+    iterator end() const
+    {
+        return last_;
+    }
+
+private:
+    iterator first_ = nullptr;
+    iterator last_ = nullptr;
+};
+
+/**
+ * @brief View over the elements of a JSON array as `double`s.
+ *
+ * Reads packed number arrays in place and regular arrays through their
+ * element nodes, where elements that are not numbers read as NaN. Nothing is
+ * written, so the view is safe on trees shared between threads. It is a
+ * random access range and is invalidated like `array_view`.
+ */
+class number_view : public std::ranges::view_interface<number_view>
+{
+public:
+    class iterator
+    {
+    public:
+        using iterator_concept = std::random_access_iterator_tag;
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = double;
+        using difference_type = std::ptrdiff_t;
+        using reference = double;
+
+        iterator() = default;
+
+        iterator(const struct json_value *array, difference_type index) : array_(array), index_(index)
+        {
+        }
+
+        double operator*() const
+        {
+            return (*this)[0];
+        }
+
+        double operator[](difference_type offset) const
+        {
+            double number;
+
+            if (json_number_array_get(array_, static_cast<int>(index_ + offset), &number) != 0)
+                return std::numeric_limits<double>::quiet_NaN();
+            return number;
+        }
+
+        iterator &operator++()
+        {
+            ++index_;
+            return *this;
+        }
+
+        iterator operator++(int)
+        {
+            iterator copy = *this;
+            ++index_;
+            return copy;
+        }
+
+        iterator &operator--()
+        {
+            --index_;
+            return *this;
+        }
+
+        iterator operator--(int)
+        {
+            iterator copy = *this;
+            --index_;
+            return copy;
+        }
+
+        iterator &operator+=(difference_type offset)
+        {
+            index_ += offset;
+            return *this;
+        }
+
+        iterator &operator-=(difference_type offset)
+        {
+            index_ -= offset;
+            return *this;
+        }
+
+        friend iterator operator+(iterator it, difference_type offset)
+        {
+            return it += offset;
+        }
+
+        friend iterator operator+(difference_type offset, iterator it)
+        {
+            return it += offset;
+        }
+
+        friend iterator operator-(iterator it, difference_type offset)
+        {
+            return it -= offset;
+        }
+
+        friend difference_type operator-(const iterator &a, const iterator &b)
+        {
+            return a.index_ - b.index_;
+        }
+
+        friend bool operator==(const iterator &a, const iterator &b)
+        {
+            return a.index_ == b.index_;
+        }
+
+        friend std::strong_ordering operator<=>(const iterator &a, const iterator &b)
+        {
+            return a.index_ <=> b.index_;
+        }
+
+    private:
+        const struct json_value *array_ = nullptr;
+        difference_type index_ = 0;
+    };
+
+    number_view() = default;
+
+    /**
+     * @brief Creates a view over `array`.
+     *
+     * A NULL or non-array value yields an empty view.
+     */
+    explicit number_view(const struct json_value *array)
+    {
+        if (!json_is_array(array))
+            return;
+
+        array_ = array;
+        length_ = array->array.length;
+    }
+
+    iterator begin() const
+    {
+        return iterator(array_, 0);
+    }
+
+    iterator end() const
+    {
+        return iterator(array_, length_);
+    }
+
+    std::size_t size() const
+    {
+        return static_cast<std::size_t>(length_);
+    }
+
+private:
+    const struct json_value *array_ = nullptr;
+    std::ptrdiff_t length_ = 0;
+};
+
+/**
+ * @brief View over the members of a JSON object, in insertion order.
+ *
+ * Dereferencing yields a `member` by value, holding the key as a
+ * `std::string_view` over the stored key. Because of that the iterator is a
+ * forward iterator in the C++20 sense but only an input iterator to code that
+ * checks `iterator_category`.
+ */
+class object_view : public std::ranges::view_interface<object_view>
+{
+public:
+    class iterator
+    {
+    public:
+        using iterator_concept = std::forward_iterator_tag;
+        using iterator_category = std::input_iterator_tag;
+        using value_type = member;
+        using difference_type = std::ptrdiff_t;
+        using reference = member;
+
+        iterator() = default;
+
+        explicit iterator(struct json_object_entry *const *entry) : entry_(entry)
+        {
+        }
+
+        member operator*() const
+        {
+            return member{std::string_view((*entry_)->key, (*entry_)->key_length), (*entry_)->value};
+        }
+
+        iterator &operator++()
+        {
+            ++entry_;
+            return *this;
+        }
+
+        iterator operator++(int)
+        {
+            iterator copy = *this;
+            ++entry_;
+            return copy;
+        }
+
+        friend bool operator==(const iterator &, const iterator &) = default;
+
+    private:
+        struct json_object_entry *const *entry_ = nullptr;
+    };
+
+    object_view() = default;
+
+    /**
+     * @brief Creates a view over `object`.
+     *
+     * A NULL or non-object value yields an empty view.
+     */
+    explicit object_view(struct json_value *object)
+    {
+        if (!json_is_object(object))
+            return;
+
+        first_ = object->object.items;
+        last_ = first_ + object->object.n_items;
+    }
+
+    iterator begin() const
+    {
+        return iterator(first_);
+    }
+
+    iterator end() const
+    {
+        return iterator(last_);
+    }
+
+    std::size_t size() const
+    {
+        return static_cast<std::size_t>(last_ - first_);
+    }
+
+private:
+    struct json_object_entry *const *first_ = nullptr;
+    struct json_object_entry *const *last_ = nullptr;
+};
+
+/**
+ * @brief Returns a view over the elements of `array`.
+ */
+inline array_view elements(struct json_value *array)
+{
+    return array_view(array);
+}
+
+/**
+ * @brief Returns a view over the elements of `array` as `double`s.
+ */
+inline number_view numbers(const struct json_value *array)
+{
+    return number_view(array);
+}
+
+/**
+ * @brief Returns a view over the members of `object`.
+ */
+inline object_view members(struct json_value *object)
+{
+    return object_view(object);
+}
+
+/**
+ * @brief Looks up a member of a read-only object.
+ *
+ * Unlike `json_object_get`, takes and returns `const` values, so it works on
+ * `static_value`. An object index may still be built lazily, as by
+ * `json_hash`, unless the tree is frozen.
+ *
+ * @return The member's value, or nullptr if `object` is not an object or has
+ *         no such key.
+ */
+inline const struct json_value *find(const struct json_value *object, std::string_view key) noexcept
+{
+    int index;
+
+    if (!json_is_object(object))
+        return nullptr;
+
+    index = json__object_lookup(object, key.data(), static_cast<int>(key.size()));
+    return index >= 0 ? object->object.items[index]->value : nullptr;
+}
+
+/**
+ * @brief Returns an element of a read-only array.
+ *
+ * Packed number arrays have no element nodes and are not converted, so they
+ * yield nullptr; read them with `numbers`.
+ *
+ * @return The element, or nullptr if `array` is not a regular array or
+ *         `index` is out of bounds.
+ */
+inline const struct json_value *at(const struct json_value *array, std::size_t index) noexcept
+{
+    if (array == nullptr || array->type != JSON_TYPE_ARRAY || index >= static_cast<std::size_t>(array->array.length))
+        return nullptr;
+
+    return array->array.items[index];
+}
+
+/**
+ * @brief Reasons a typed read can fail.
+ */
+enum class errc
+{
+    null_value = 1, /**< The value pointer is NULL. */
+    type_mismatch,  /**< The value holds a different JSON type. */
+    not_integer,    /**< An integer was requested but the number has a fraction. */
+    out_of_range    /**< The number does not fit the requested type. */
+};
+
+namespace detail
+{
+
+template <class T>
+inline constexpr bool readable_v = std::is_same_v<T, bool> || std::is_floating_point_v<T> || std::is_integral_v<T>
+                                   || std::is_same_v<T, std::string_view>;
+
+// 2^digits as a double, the first magnitude an integer type cannot hold
+template <class T>
+inline constexpr double integer_limit_v = static_cast<double>(std::numeric_limits<T>::max() / 2 + 1) * 2.0;
+
+template <class T>
+constexpr errc read(const struct json_value *value, T &out) noexcept
+{
+    static_assert(readable_v<T>, "json::get supports bool, arithmetic types and std::string_view");
+
+    if (value == nullptr)
+        return errc::null_value;
+
+    if constexpr (std::is_same_v<T, bool>) {
+        if (value->type != JSON_TYPE_BOOLEAN)
+            return errc::type_mismatch;
+        out = value->number != 0.0;
+    } else if constexpr (std::is_same_v<T, std::string_view>) {
+        if (value->type != JSON_TYPE_STRING)
+            return errc::type_mismatch;
+        out = std::string_view(value->string.value, static_cast<std::size_t>(value->string.length));
+    } else if constexpr (std::is_floating_point_v<T>) {
+        if (value->type != JSON_TYPE_NUMBER)
+            return errc::type_mismatch;
+        out = static_cast<T>(value->number);
+    } else {
+        double number;
+
+        if (value->type != JSON_TYPE_NUMBER)
+            return errc::type_mismatch;
+
+        // Numbers are stored as doubles, so only integral values convert,
+        // and only when they lie within the range of `T`
+        number = value->number;
+        if (number >= integer_limit_v<T> || number < (std::is_signed_v<T> ? -integer_limit_v<T> : 0.0))
+            return errc::out_of_range;
+        if (number != static_cast<double>(static_cast<T>(number)))
+            return errc::not_integer;
+        out = static_cast<T>(number);
+    }
+
+    return errc{};
+}
+
+} // namespace detail
+
+/**
+ * @brief Reads `value` as `T`, or returns nothing if it holds anything else.
+ *
+ * `T` is one of `bool`, a floating point type, an integer type or
+ * `std::string_view`. Each instantiation is a type check and a load; integers
+ * additionally require the stored number to be integral and in range, and
+ * strings keep their stored length, embedded null bytes included.
+ */
+template <class T>
+constexpr std::optional<T> get_if(const struct json_value *value) noexcept
+{
+    T out{};
+
+    if (detail::read(value, out) != errc{})
+        return std::nullopt;
+    return out;
+}
+
+#if defined(__cpp_lib_expected)
+/**
+ * @brief Reads `value` as `T`, reporting why it could not when it fails.
+ *
+ * Accepts the same types as `get_if`. Only available with `std::expected`.
+ */
+template <class T>
+constexpr std::expected<T, errc> get(const struct json_value *value) noexcept
+{
+    T out{};
+    errc error = detail::read(value, out);
+
+    if (error != errc{})
+        return std::unexpected(error);
+    return out;
+}
+#endif
+
+/**
+ * @brief Incremental parser that hands out the elements of a top-level array
+ * as soon as each one is complete.
+ *
+ * A producer coroutine feeds chunks as they arrive and a consumer coroutine
+ * awaits elements; the two hand control to each other on the same thread.
+ * Only the bytes of the element currently being received are buffered, and
+ * each finished element is decoded with `json_decode_with_length`.
+ *
+ * @code
+ * // producer
+ * while (auto chunk = co_await socket.read())
+ *     co_await parser.feed(*chunk);
+ * parser.close();
+ *
+ * // consumer
+ * while (struct json_value *record = co_await parser.next()) {
+ *     handle(record);
+ *     json_free(record);
+ * }
+ * if (parser.failed())
+ *     ...
+ * @endcode
+ *
+ * The parser is not thread-safe; both sides must be resumed on one thread.
+ */
+class async_parser
+{
+public:
+    async_parser() = default;
+    async_parser(const async_parser &) = delete;
+    async_parser &operator=(const async_parser &) = delete;
+
+    ~async_parser()
+    {
+        if (pending_ != nullptr)
+            json_free(pending_);
+    }
+
+    /**
+     * @brief Awaitable returned by `feed`.
+     *
+     * Suspends the producer until the consumer has taken every element the
+     * buffered input completes and needs more bytes. Does not suspend once
+     * the array has ended.
+     */
+    class feed_awaiter
+    {
+    public:
+        explicit feed_awaiter(async_parser &parser) : parser_(parser)
+        {
+        }
+
+        bool await_ready() const noexcept
+        {
+            return parser_.state_ == state::done;
+        }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> producer) noexcept
+        {
+            // Nobody is waiting for elements yet, stay parked until someone asks
+            if (!parser_.consumer_) {
+                parser_.producer_ = producer;
+                return std::noop_coroutine();
+            }
+
+            if (!parser_.advance())
+                return producer;
+
+            parser_.producer_ = producer;
+            return std::exchange(parser_.consumer_, nullptr);
+        }
+
+        void await_resume() const noexcept
+        {
+        }
+
+    private:
+        async_parser &parser_;
+    };
+
+    /**
+     * @brief Awaitable returned by `next`.
+     *
+     * Resumes with the next element, or NULL once the array is closed, the
+     * input ended or an error occurred.
+     */
+    class next_awaiter
+    {
+    public:
+        explicit next_awaiter(async_parser &parser) : parser_(parser)
+        {
+        }
+
+        bool await_ready()
+        {
+            return parser_.advance();
+        }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> consumer) noexcept
+        {
+            parser_.consumer_ = consumer;
+            if (parser_.producer_)
+                return std::exchange(parser_.producer_, nullptr);
+            return std::noop_coroutine();
+        }
+
+        struct json_value *await_resume()
+        {
+            struct json_value *value = std::exchange(parser_.pending_, nullptr);
+
+            // End of the stream, let a producer parked in `feed` run on
+            parser_.ready_ = false;
+            if (value == nullptr && parser_.producer_)
+                std::exchange(parser_.producer_, nullptr).resume();
+            return value;
+        }
+
+    private:
+        async_parser &parser_;
+    };
+
+    /**
+     * @brief Appends a chunk of input.
+     *
+     * The chunk is copied, so it may be reused once this returns.
+     */
+    feed_awaiter feed(std::string_view chunk)
+    {
+        buffer_.append(chunk);
+        return feed_awaiter(*this);
+    }
+
+    /**
+     * @brief Marks the end of the input.
+     *
+     * A consumer waiting in `next` is resumed with the remaining result.
+     */
+    void close()
+    {
+        closed_ = true;
+        if (consumer_ && advance())
+            std::exchange(consumer_, nullptr).resume();
+    }
+
+    /**
+     * @brief Waits for the next element of the array.
+     *
+     * The caller owns the returned value and releases it with `json_free`.
+     */
+    next_awaiter next()
+    {
+        return next_awaiter(*this);
+    }
+
+    /**
+     * @brief Returns true if the input was malformed or truncated.
+     */
+    bool failed() const noexcept
+    {
+        return failed_;
+    }
+
+private:
+    enum class state
+    {
+        before_array,
+        in_array,
+        done
+    };
+
+    // Scans buffered bytes for the end of the current element; returns true
+    // once `pending_` holds the element or the stream has ended
+    bool advance()
+    {
+        if (ready_)
+            return true;
+
+        while (state_ != state::done && position_ < buffer_.size()) {
+            char c = buffer_[position_++];
+
+            if (state_ == state::before_array) {
+                if (c == '[') {
+                    state_ = state::in_array;
+                    start_ = position_;
+                } else if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+                    return fail();
+                }
+                continue;
+            }
+
+            if (in_string_) {
+                if (escape_)
+                    escape_ = false;
+                else if (c == '\\')
+                    escape_ = true;
+                else if (c == '"')
+                    in_string_ = false;
+                continue;
+            }
+
+            switch (c) {
+            case '"':
+                in_string_ = true;
+                break;
+            case '[':
+            case '{':
+                depth_++;
+                break;
+            case '}':
+                depth_--;
+                break;
+            case ']':
+                if (depth_-- == 0)
+                    return finish_element(true);
+                break;
+            case ',':
+                if (depth_ == 0)
+                    return finish_element(false);
+                break;
+            }
+        }
+
+        if (state_ == state::done)
+            return ready_ = true;
+
+        // Drop bytes of elements already handed out, keep the partial one
+        if (state_ == state::in_array && start_ > 0) {
+            buffer_.erase(0, start_);
+            position_ -= start_;
+            start_ = 0;
+        }
+
+        return closed_ ? fail() : false;
+    }
+
+    bool finish_element(bool last)
+    {
+        std::string_view slice(buffer_.data() + start_, position_ - 1 - start_);
+        std::size_t first = slice.find_first_not_of(" \t\n\r");
+
+        start_ = position_;
+        if (last)
+            state_ = state::done;
+
+        // `[]` ends without an element, `[1,]` and `[,` are malformed
+        if (first == std::string_view::npos) {
+            if (!last || count_ > 0)
+                return fail();
+            return ready_ = true;
+        }
+
+        // The decoder does not skip leading whitespace
+        slice.remove_prefix(first);
+
+        if ((pending_ = json_decode_with_length(slice.data(), static_cast<int>(slice.size()))) == nullptr)
+            return fail();
+
+        count_++;
+        return ready_ = true;
+    }
+
+    bool fail()
+    {
+        failed_ = true;
+        state_ = state::done;
+        return ready_ = true;
+    }
+
+    std::string buffer_;
+    std::size_t position_ = 0;
+    std::size_t start_ = 0;
+    std::size_t count_ = 0;
+    int depth_ = 0;
+    bool in_string_ = false;
+    bool escape_ = false;
+    bool closed_ = false;
+    bool failed_ = false;
+    bool ready_ = false;
+    state state_ = state::before_array;
+    struct json_value *pending_ = nullptr;
+    std::coroutine_handle<> producer_;
+    std::coroutine_handle<> consumer_;
+};
+
+/**
+ * @brief A string literal usable as a template argument.
+ */
+template <std::size_t N>
+struct literal
+{
+    char data[N];
+
+    constexpr literal(const char (&source)[N])
+    {
+        for (std::size_t i = 0; i < N; i++)
+            data[i] = source[i];
+    }
+
+    constexpr std::string_view view() const
+    {
+        return std::string_view(data, N - 1);
+    }
+};
+
+namespace detail
+{
+
+// Not constexpr, so reaching it during constant evaluation fails the build
+// with the message in the diagnostic
+inline void static_parse_error(const char *message)
+{
+    (void) message;
+    std::abort();
+}
+
+struct static_counts
+{
+    std::size_t values = 0;
+    std::size_t items = 0;
+    std::size_t entries = 0;
+    std::size_t chars = 0;
+};
+
+template <static_counts Counts>
+struct static_storage
+{
+    struct json_value values[Counts.values];
+    struct json_value *items[Counts.items > 0 ? Counts.items : 1];
+    struct json_object_entry entries[Counts.entries > 0 ? Counts.entries : 1];
+    struct json_object_entry *entry_items[Counts.entries > 0 ? Counts.entries : 1];
+    char chars[Counts.chars > 0 ? Counts.chars : 1];
+};
+
+// Recursive descent parser run twice at compile time: once with `Storage`
+// void to size the tables, once to fill them. Pointers are taken into
+// `self`, the static object the filled tables are copied into. Containers
+// are marked frozen, so reads never cache hashes or indexes into them.
+template <class Storage>
+class static_parser
+{
+public:
+    constexpr static_parser(std::string_view input, Storage *out, Storage *self)
+        : input_(input), out_(out), self_(self)
+    {
+    }
+
+    constexpr static_counts run()
+    {
+        parse_value(counts_.values++);
+        skip_whitespace();
+        if (position_ != input_.size())
+            static_parse_error("unexpected characters after the root value");
+        return counts_;
+    }
+
+private:
+    static constexpr bool emit = !std::is_void_v<Storage>;
+
+    constexpr char peek() const
+    {
+        return position_ < input_.size() ? input_[position_] : '\0';
+    }
+
+    constexpr void expect(char c)
+    {
+        if (peek() != c)
+            static_parse_error("unexpected character");
+        position_++;
+    }
+
+    constexpr void skip_whitespace()
+    {
+        while (peek() == ' ' || peek() == '\t' || peek() == '\n' || peek() == '\r')
+            position_++;
+    }
+
+    constexpr void parse_value(std::size_t index)
+    {
+        skip_whitespace();
+        switch (peek()) {
+        case '{':
+            parse_object(index);
+            break;
+        case '[':
+            parse_array(index);
+            break;
+        case '"': {
+            std::size_t offset = parse_string();
+            if constexpr (emit) {
+                int length = static_cast<int>(counts_.chars - offset - 1);
+                struct json_value &value = out_->values[index];
+                value.type = JSON_TYPE_STRING;
+                value.string = decltype(value.string){length + 1, length, &self_->chars[offset]};
+            }
+            break;
+        }
+        case 't':
+            parse_literal(index, "true", JSON_TYPE_BOOLEAN, 1);
+            break;
+        case 'f':
+            parse_literal(index, "false", JSON_TYPE_BOOLEAN, 0);
+            break;
+        case 'n':
+            parse_literal(index, "null", JSON_TYPE_NULL, 0);
+            break;
+        default:
+            parse_number(index);
+            break;
+        }
+
+#if defined(JSON_REFCOUNT)
+        if constexpr (emit)
+            out_->values[index].refcount = 1;
+#endif
+    }
+
+    constexpr void parse_literal(std::size_t index, std::string_view word, enum json_type type, double number)
+    {
+        if (input_.substr(position_, word.size()) != word)
+            static_parse_error("invalid literal");
+        position_ += word.size();
+
+        if constexpr (emit) {
+            out_->values[index].type = type;
+            out_->values[index].number = number;
+        }
+    }
+
+    // Exact for up to 15 significant digits with a decimal exponent within
+    // +-22, which covers typical configuration values. Longer or more extreme
+    // numbers may differ from strtod in the last bit.
+    constexpr void parse_number(std::size_t index)
+    {
+        bool negative = false;
+        std::uint64_t mantissa = 0;
+        int digits = 0, exponent = 0;
+
+        if (peek() == '-') {
+            negative = true;
+            position_++;
+        }
+
+        if (peek() == '0') {
+            position_++;
+        } else if (peek() >= '1' && peek() <= '9') {
+            while (peek() >= '0' && peek() <= '9')
+                accumulate(mantissa, digits, exponent, false);
+        } else {
+            static_parse_error("invalid value");
+        }
+
+        if (peek() == '.') {
+            position_++;
+            if (!(peek() >= '0' && peek() <= '9'))
+                static_parse_error("expected digits after the decimal point");
+            while (peek() >= '0' && peek() <= '9')
+                accumulate(mantissa, digits, exponent, true);
+        }
+
+        if (peek() == 'e' || peek() == 'E') {
+            bool exponent_negative = false;
+            int value = 0;
+
+            position_++;
+            if (peek() == '+' || peek() == '-')
+                exponent_negative = input_[position_++] == '-';
+            if (!(peek() >= '0' && peek() <= '9'))
+                static_parse_error("expected digits in the exponent");
+            while (peek() >= '0' && peek() <= '9') {
+                if (value < 10000)
+                    value = value * 10 + (input_[position_] - '0');
+                position_++;
+            }
+            exponent += exponent_negative ? -value : value;
+        }
+
+        if constexpr (emit) {
+            double number = static_cast<double>(mantissa);
+            double scale = 1.0;
+
+            for (int i = exponent < 0 ? -exponent : exponent; i > 0; i--)
+                scale *= 10.0;
+            number = exponent < 0 ? number / scale : number * scale;
+
+            out_->values[index].type = JSON_TYPE_NUMBER;
+            out_->values[index].number = negative ? -number : number;
+        }
+    }
+
+    // Keeps the first 19 significant digits, later ones only shift the exponent
+    constexpr void accumulate(std::uint64_t &mantissa, int &digits, int &exponent, bool fraction)
+    {
+        int digit = input_[position_++] - '0';
+
+        if (digits < 19) {
+            mantissa = mantissa * 10 + static_cast<std::uint64_t>(digit);
+            if (mantissa != 0)
+                digits++;
+            if (fraction)
+                exponent--;
+        } else if (!fraction) {
+            exponent++;
+        }
+    }
+
+    // Counts the elements of the array or object starting at the current
+    // position without validating them, so their slots can be reserved
+    // contiguously before the elements are parsed
+    constexpr std::size_t count_elements(char close) const
+    {
+        std::size_t position = position_, count = 1;
+        int depth = 0;
+
+        while (position < input_.size() && (input_[position] == ' ' || input_[position] == '\t'
+                                             || input_[position] == '\n' || input_[position] == '\r'))
+            position++;
+        if (position < input_.size() && input_[position] == close)
+            return 0;
+
+        for (; position < input_.size(); position++) {
+            char c = input_[position];
+
+            if (c == '"') {
+                for (position++; position < input_.size() && input_[position] != '"'; position++)
+                    if (input_[position] == '\\')
+                        position++;
+            } else if (c == '[' || c == '{') {
+                depth++;
+            } else if ((c == ']' || c == '}') && depth-- == 0) {
+                break;
+            } else if (c == ',' && depth == 0) {
+                count++;
+            }
+        }
+
+        return count;
+    }
+
+    constexpr void parse_array(std::size_t index)
+    {
+        std::size_t count, base;
+
+        position_++;
+        count = count_elements(']');
+        base = counts_.items;
+        counts_.items += count;
+
+        if constexpr (emit) {
+            struct json_value &value = out_->values[index];
+            decltype(value.array) array{};
+
+            array.capacity = array.length = static_cast<int>(count);
+            array.items = count > 0 ? &self_->items[base] : nullptr;
+            value.type = JSON_TYPE_ARRAY;
+            value.array = array;
+#if defined(JSON_HASH_CACHE) || defined(JSON_INDEX)
+            value.frozen = 1;
+#endif
+        }
+
+        for (std::size_t i = 0; i < count; i++) {
+            std::size_t child = counts_.values++;
+
+            if (i > 0)
+                expect(',');
+            if constexpr (emit)
+                out_->items[base + i] = &self_->values[child];
+            parse_value(child);
+            skip_whitespace();
+        }
+
+        skip_whitespace();
+        expect(']');
+    }
+
+    constexpr void parse_object(std::size_t index)
+    {
+        std::size_t count, base;
+
+        position_++;
+        count = count_elements('}');
+        base = counts_.entries;
+        counts_.entries += count;
+
+        if constexpr (emit) {
+            struct json_value &value = out_->values[index];
+            decltype(value.object) object{};
+
+            object.capacity = object.n_items = static_cast<int>(count);
+            object.items = count > 0 ? &self_->entry_items[base] : nullptr;
+            value.type = JSON_TYPE_OBJECT;
+            value.object = object;
+#if defined(JSON_HASH_CACHE) || defined(JSON_INDEX)
+            value.frozen = 1;
+#endif
+        }
+
+        for (std::size_t i = 0; i < count; i++) {
+            std::size_t key, child;
+
+            if (i > 0)
+                expect(',');
+            skip_whitespace();
+            if (peek() != '"')
+                static_parse_error("expected a string key");
+            key = parse_string();
+            skip_whitespace();
+            expect(':');
+            child = counts_.values++;
+
+            if constexpr (emit) {
+                struct json_object_entry &entry = out_->entries[base + i];
+                entry.key = &self_->chars[key];
+                entry.key_length = static_cast<int>(counts_.chars - key - 1);
+                entry.value = &self_->values[child];
+                out_->entry_items[base + i] = &self_->entries[base + i];
+                check_duplicate(base, i);
+            }
+
+            parse_value(child);
+            skip_whitespace();
+        }
+
+        skip_whitespace();
+        expect('}');
+    }
+
+    // The runtime decoder keeps the last of duplicate keys; a table baked
+    // into the binary rejects them instead, as they are almost always a typo
+    constexpr void check_duplicate(std::size_t base, std::size_t index) const
+    {
+        const struct json_object_entry &entry = out_->entries[base + index];
+        std::size_t key = static_cast<std::size_t>(entry.key - self_->chars);
+
+        for (std::size_t i = 0; i < index; i++) {
+            const struct json_object_entry &other = out_->entries[base + i];
+            std::size_t other_key = static_cast<std::size_t>(other.key - self_->chars);
+
+            if (other.key_length == entry.key_length
+                && std::string_view(&out_->chars[other_key], other.key_length)
+                       == std::string_view(&out_->chars[key], entry.key_length))
+                static_parse_error("duplicate key");
+        }
+    }
+
+    // Decodes the string at the current position into the character table,
+    // null-terminated, and returns its offset
+    constexpr std::size_t parse_string()
+    {
+        std::size_t offset = counts_.chars;
+
+        position_++;
+        for (;;) {
+            char c = peek();
+
+            if (position_ >= input_.size())
+                static_parse_error("unterminated string");
+            position_++;
+
+            if (c == '"')
+                break;
+            if (static_cast<unsigned char>(c) < 0x20)
+                static_parse_error("control character in string");
+            if (c != '\\') {
+                put(c);
+                continue;
+            }
+
+            switch (c = peek(), position_++, c) {
+            case '"':
+            case '\\':
+            case '/':
+                put(c);
+                break;
+            case 'b':
+                put('\b');
+                break;
+            case 'f':
+                put('\f');
+                break;
+            case 'n':
+                put('\n');
+                break;
+            case 'r':
+                put('\r');
+                break;
+            case 't':
+                put('\t');
+                break;
+            case 'u':
+                put_codepoint(parse_codepoint());
+                break;
+            default:
+                static_parse_error("invalid escape sequence");
+            }
+        }
+
+        put('\0');
+        return offset;
+    }
+
+    constexpr std::uint32_t parse_hex4()
+    {
+        std::uint32_t value = 0;
+
+        for (int i = 0; i < 4; i++) {
+            char c = peek();
+
+            position_++;
+            if (c >= '0' && c <= '9')
+                value = value * 16 + static_cast<std::uint32_t>(c - '0');
+            else if (c >= 'a' && c <= 'f')
+                value = value * 16 + static_cast<std::uint32_t>(c - 'a' + 10);
+            else if (c >= 'A' && c <= 'F')
+                value = value * 16 + static_cast<std::uint32_t>(c - 'A' + 10);
+            else
+                static_parse_error("invalid unicode escape");
+        }
+
+        return value;
+    }
+
+    constexpr std::uint32_t parse_codepoint()
+    {
+        std::uint32_t high = parse_hex4(), low;
+
+        if (high >= 0xDC00 && high <= 0xDFFF)
+            static_parse_error("unpaired low surrogate");
+        if (high < 0xD800 || high > 0xDBFF)
+            return high;
+
+        if (peek() != '\\' || input_.substr(position_ + 1, 1) != "u")
+            static_parse_error("unpaired high surrogate");
+        position_ += 2;
+
+        if ((low = parse_hex4()) < 0xDC00 || low > 0xDFFF)
+            static_parse_error("invalid low surrogate");
+        return 0x10000 + ((high - 0xD800) << 10) + (low - 0xDC00);
+    }
+
+    constexpr void put_codepoint(std::uint32_t codepoint)
+    {
+        if (codepoint < 0x80) {
+            put(static_cast<char>(codepoint));
+        } else if (codepoint < 0x800) {
+            put(static_cast<char>(0xC0 | (codepoint >> 6)));
+            put(static_cast<char>(0x80 | (codepoint & 0x3F)));
+        } else if (codepoint < 0x10000) {
+            put(static_cast<char>(0xE0 | (codepoint >> 12)));
+            put(static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F)));
+            put(static_cast<char>(0x80 | (codepoint & 0x3F)));
+        } else {
+            put(static_cast<char>(0xF0 | (codepoint >> 18)));
+            put(static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F)));
+            put(static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F)));
+            put(static_cast<char>(0x80 | (codepoint & 0x3F)));
+        }
+    }
+
+    constexpr void put(char c)
+    {
+        if constexpr (emit)
+            out_->chars[counts_.chars] = c;
+        counts_.chars++;
+    }
+
+    std::string_view input_;
+    std::size_t position_ = 0;
+    static_counts counts_;
+    Storage *out_;
+    Storage *self_;
+};
+
+template <literal Source>
+inline constexpr static_counts static_counts_of = static_parser<void>(Source.view(), nullptr, nullptr).run();
+
+template <literal Source>
+using static_storage_of = static_storage<static_counts_of<Source>>;
+
+template <literal Source>
+constexpr static_storage_of<Source> static_build(static_storage_of<Source> *self)
+{
+    static_storage_of<Source> result{};
+    static_parser<static_storage_of<Source>>(Source.view(), &result, self).run();
+    return result;
+}
+
+template <literal Source>
+inline constinit static_storage_of<Source> static_document = static_build<Source>(&static_document<Source>);
+
+} // namespace detail
+
+/**
+ * @brief A JSON document parsed at compile time.
+ *
+ * @code
+ * const struct json_value *features = json::static_value<R"({"fast_path": true, "limit": 64})">;
+ * json::get_if<bool>(json::find(features, "fast_path"));
+ * @endcode
+ *
+ * The tree lives in static storage built by the compiler, so nothing is
+ * parsed or allocated at runtime, and malformed JSON fails the build. It is
+ * `const`: read it with `json::find`, `json::at`, `json::numbers`,
+ * `json::get_if`, `json_hash` and `json_equal`. Its containers are frozen, so
+ * those reads never write to it either. Duplicate object keys are rejected.
+ */
+template <literal Source>
+inline constexpr const struct json_value *static_value = &detail::static_document<Source>.values[0];
+
+} // namespace json
+
+#if defined(JSON_PMR)
+namespace json
+{
+
+/**
+ * @brief Routes allocations made on this thread to `resource` while alive.
+ *
+ * Needed around C API calls that create values for a `document`, such as
+ * `json_object_set(doc.root(), "key", json_number_new(1))`. Blocks that are
+ * resized or freed always go back to the resource they came from, whatever
+ * scope is active.
+ */
+class resource_scope
+{
+public:
+    explicit resource_scope(std::pmr::memory_resource *resource) noexcept
+        : previous_(std::exchange(detail::current_resource, resource))
+    {
+    }
+
+    resource_scope(const resource_scope &) = delete;
+    resource_scope &operator=(const resource_scope &) = delete;
+
+    ~resource_scope()
+    {
+        detail::current_resource = previous_;
+    }
+
+private:
+    std::pmr::memory_resource *previous_;
+};
+
+/**
+ * @brief A JSON tree whose nodes, keys and strings all live in one
+ * `std::pmr::memory_resource`.
+ *
+ * @code
+ * std::byte buffer[16384];
+ * std::pmr::monotonic_buffer_resource arena(buffer, sizeof buffer);
+ * json::document doc(&arena);
+ *
+ * if (doc.parse(body)) {
+ *     json::resource_scope scope = doc.scope();
+ *     json_object_set(doc.root(), "seen", json_boolean_new(1));
+ *     std::pmr::string reply = doc.encode();
+ * }
+ * @endcode
+ *
+ * Requires `JSON_PMR` to be defined before including json.hpp.
+ */
+class document
+{
+public:
+    explicit document(std::pmr::memory_resource *resource = std::pmr::get_default_resource()) noexcept
+        : resource_(resource)
+    {
+    }
+
+    document(document &&other) noexcept : resource_(other.resource_), root_(std::exchange(other.root_, nullptr))
+    {
+    }
+
+    document &operator=(document &&other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            resource_ = other.resource_;
+            root_ = std::exchange(other.root_, nullptr);
+        }
+        return *this;
+    }
+
+    ~document()
+    {
+        reset();
+    }
+
+    /**
+     * @brief Parses `text` into the document, replacing its previous root.
+     *
+     * @return false if `text` is not valid JSON, leaving the document as is.
+     */
+    bool parse(std::string_view text)
+    {
+        resource_scope scope(resource_);
+        struct json_value *root = json_decode_with_length(text.data(), static_cast<int>(text.size()));
+
+        if (root == nullptr)
+            return false;
+
+        reset(root);
+        return true;
+    }
+
+    /**
+     * @brief Serializes the root into a string allocated from the resource.
+     *
+     * @throws std::bad_alloc if encoding runs out of memory.
+     */
+    std::pmr::string encode() const
+    {
+        resource_scope scope(resource_);
+        char *text;
+
+        if (root_ == nullptr)
+            return std::pmr::string(resource_);
+        if ((text = json_encode(root_)) == nullptr)
+            throw std::bad_alloc();
+
+        std::pmr::string result(text, resource_);
+        pmr_free(text);
+        return result;
+    }
+
+    /**
+     * @brief Replaces the root with `root`, freeing the previous one.
+     *
+     * The document takes ownership of `root`.
+     */
+    void reset(struct json_value *root = nullptr) noexcept
+    {
+        if (root_ != nullptr)
+            json_free(root_);
+        root_ = root;
+    }
+
+    /**
+     * @brief Makes the document's resource current for C API calls.
+     */
+    resource_scope scope() const noexcept
+    {
+        return resource_scope(resource_);
+    }
+
+    struct json_value *root() const noexcept
+    {
+        return root_;
+    }
+
+    std::pmr::memory_resource *resource() const noexcept
+    {
+        return resource_;
+    }
+
+private:
+    std::pmr::memory_resource *resource_;
+    struct json_value *root_ = nullptr;
+};
+
+} // namespace json
+#endif
+
+// The views do not own the values, so iterators outlive them safely
+template <> inline constexpr bool std::ranges::enable_borrowed_range<json::array_view> = true;
+template <> inline constexpr bool std::ranges::enable_borrowed_range<json::number_view> = true;
+template <> inline constexpr bool std::ranges::enable_borrowed_range<json::object_view> = true;
+
+#endif /* JSON_HPP */